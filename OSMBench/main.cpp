@@ -0,0 +1,1322 @@
+﻿#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <thread>
+#include <memory>
+#include <ctime>
+#include <QFile>
+#include <QStringList>
+#include <QElapsedTimer>
+#include <QDir>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QDomDocument>
+#include <QTextStream>
+#include <QImage>
+#include <QPainter>
+#include "RoadGraph.h"
+#include "OSMRoadsParser.h"
+#include "OSMStreamParser.h"
+#include "OSMParallelParser.h"
+#include "OSMPbfParser.h"
+#include "OSMRoadsExporter.h"
+#include "RoadGraphSnapshot.h"
+#include "History.h"
+#include "RoadRenderer.h"
+#include "RoadTileCache.h"
+#include "RoadGraphGenerator.h"
+#include "RoadGraphLoader.h"
+
+/**
+* Load the OSM file into the road graph using QXmlSimpleReader.
+*/
+void loadOSMWithSAX(const QString& filename, RoadGraph& roads) {
+	roads.clear();
+
+	OSMRoadsParser parser(&roads);
+	QXmlSimpleReader reader;
+	reader.setContentHandler(&parser);
+	QFile file(filename);
+	QXmlInputSource source(&file);
+	reader.parse(source);
+}
+
+/**
+* Save the road graph by building a QDomDocument, as OSMRoadsExporter::save used to do.
+*/
+void saveWithDOM(const QString& filename, const RoadGraph& roads) {
+	QFile file(filename);
+	if (!file.open(QFile::WriteOnly)) return;
+
+	QDomDocument doc;
+	QDomElement root = doc.createElement("osm");
+	root.setAttribute("generator", "OSM Editor");
+	root.setAttribute("version", "0.6");
+	doc.appendChild(root);
+
+	double minlon, maxlon, minlat, maxlat;
+	OSMRoadsExporter::calculateBounds(roads, minlon, maxlon, minlat, maxlat);
+	QDomElement bounds = doc.createElement("bounds");
+	bounds.setAttribute("minlon", minlon);
+	bounds.setAttribute("maxlon", maxlon);
+	bounds.setAttribute("minlat", minlat);
+	bounds.setAttribute("maxlat", maxlat);
+	root.appendChild(bounds);
+
+	int node_id = 0;
+	RoadVertexIter vi, vend;
+	for (boost::tie(vi, vend) = boost::vertices(roads.graph); vi != vend; vi++) {
+		if (!roads.graph[*vi]->valid) continue;
+
+		QDomElement node = doc.createElement("node");
+		node.setAttribute("id", *vi);
+		std::pair<double, double> lonlat = RoadGraph::projMeterToLatLon(roads.graph[*vi]->pt, roads.centerLonLat);
+		node.setAttribute("lon", lonlat.first);
+		node.setAttribute("lat", lonlat.second);
+		root.appendChild(node);
+
+		node_id = std::max(node_id, (int)*vi);
+	}
+	node_id++;
+
+	int way_id = 0;
+	RoadEdgeIter ei, eend;
+	for (boost::tie(ei, eend) = boost::edges(roads.graph); ei != eend; ei++) {
+		if (!roads.graph[*ei]->valid) continue;
+
+		RoadVertexDesc src = boost::source(*ei, roads.graph);
+		RoadVertexDesc tgt = boost::target(*ei, roads.graph);
+		if (!roads.graph[src]->valid || !roads.graph[tgt]->valid) continue;
+		if ((roads.graph[*ei]->polyline[0] - roads.graph[src]->pt).lengthSquared() >= (roads.graph[*ei]->polyline[0] - roads.graph[tgt]->pt).lengthSquared()) {
+			std::swap(src, tgt);
+		}
+
+		QDomElement way = doc.createElement("way");
+		way.setAttribute("id", way_id++);
+
+		QDomElement nd = doc.createElement("nd");
+		nd.setAttribute("ref", src);
+		way.appendChild(nd);
+
+		for (int i = 1; i < roads.graph[*ei]->polyline.size() - 1; i++) {
+			QDomElement node = doc.createElement("node");
+			node.setAttribute("id", node_id);
+			std::pair<double, double> lonlat = RoadGraph::projMeterToLatLon(roads.graph[*ei]->polyline[i], roads.centerLonLat);
+			node.setAttribute("lon", lonlat.first);
+			node.setAttribute("lat", lonlat.second);
+			root.appendChild(node);
+
+			QDomElement nd = doc.createElement("nd");
+			nd.setAttribute("ref", node_id);
+			way.appendChild(nd);
+
+			node_id++;
+		}
+
+		nd = doc.createElement("nd");
+		nd.setAttribute("ref", tgt);
+		way.appendChild(nd);
+
+		QDomElement tag_highway = doc.createElement("tag");
+		tag_highway.setAttribute("k", "highway");
+		if (roads.graph[*ei]->type == RoadEdge::TYPE_HIGHWAY) {
+			tag_highway.setAttribute("v", "trunk");
+		}
+		else if (roads.graph[*ei]->type == RoadEdge::TYPE_BOULEVARD) {
+			tag_highway.setAttribute("v", "primary");
+		}
+		else if (roads.graph[*ei]->type == RoadEdge::TYPE_AVENUE) {
+			tag_highway.setAttribute("v", "secondary");
+		}
+		else if (roads.graph[*ei]->type == RoadEdge::TYPE_STREET) {
+			tag_highway.setAttribute("v", "residential");
+		}
+		way.appendChild(tag_highway);
+
+		QDomElement tag_lanes = doc.createElement("tag");
+		tag_lanes.setAttribute("k", "lanes");
+		tag_lanes.setAttribute("v", roads.graph[*ei]->lanes);
+		way.appendChild(tag_lanes);
+
+		QDomElement tag_oneway = doc.createElement("tag");
+		tag_oneway.setAttribute("k", "oneway");
+		tag_oneway.setAttribute("v", roads.graph[*ei]->oneWay ? "yes" : "no");
+		way.appendChild(tag_oneway);
+
+		root.appendChild(way);
+	}
+
+	QTextStream out(&file);
+	doc.save(out, 4);
+}
+
+/**
+* Report the parse throughput of QXmlSimpleReader, OSMStreamParser, and OSMParallelParser with increasing number of threads.
+*/
+void benchParseXML(const QString& filename) {
+	double size_mb = QFile(filename).size() / 1024.0 / 1024.0;
+	std::cout << "parse: " << filename.toStdString() << " (" << size_mb << " MB)" << std::endl;
+
+	QElapsedTimer timer;
+	RoadGraph roads;
+	int num_vertices, num_edges;
+
+	timer.start();
+	loadOSMWithSAX(filename, roads);
+	double elapsed = timer.nsecsElapsed() * 1e-9;
+	roads.countValid(num_vertices, num_edges);
+	std::cout << "  sax:                       " << elapsed * 1000 << " ms, " << size_mb / elapsed << " MB/s -> " << num_vertices << " vertices, " << num_edges << " edges" << std::endl;
+
+	for (int used_nodes_only = 0; used_nodes_only < 2; used_nodes_only++) {
+		roads.clear();
+		OSMRoadsParser parser(&roads);
+		OSMStreamParser reader(&parser, used_nodes_only != 0);
+
+		timer.start();
+		reader.parse(filename);
+		elapsed = timer.nsecsElapsed() * 1e-9;
+		roads.countValid(num_vertices, num_edges);
+		std::cout << (used_nodes_only ? "  stream (used nodes only): " : "  stream (all nodes):       ") << elapsed * 1000 << " ms, " << size_mb / elapsed << " MB/s -> " << num_vertices << " vertices, " << num_edges << " edges, " << parser.numStoredNodes() << " nodes stored in " << parser.nodeMemoryUsage() / 1024 << " KB" << std::endl;
+	}
+
+	int max_threads = std::max(1, (int)std::thread::hardware_concurrency());
+	for (int num_threads = 1; ; num_threads = std::min(num_threads * 2, max_threads)) {
+		roads.clear();
+		OSMRoadsParser parser(&roads);
+		OSMParallelParser reader(&parser, true, num_threads);
+
+		timer.start();
+		reader.parse(filename);
+		elapsed = timer.nsecsElapsed() * 1e-9;
+		roads.countValid(num_vertices, num_edges);
+		std::cout << "  parallel (" << num_threads << " threads): " << elapsed * 1000 << " ms, " << size_mb / elapsed << " MB/s -> " << num_vertices << " vertices, " << num_edges << " edges, buffers " << reader.bufferMemoryUsage() / 1024 << " KB + node table " << parser.nodeMemoryUsage() / 1024 << " KB" << std::endl;
+
+		if (num_threads == max_threads) break;
+	}
+}
+
+/**
+* Report the parse throughput of OSMPbfParser with increasing number of threads.
+*/
+void benchParsePBF(const QString& filename) {
+	double size_mb = QFile(filename).size() / 1024.0 / 1024.0;
+	std::cout << "parse: " << filename.toStdString() << " (" << size_mb << " MB)" << std::endl;
+
+	QElapsedTimer timer;
+	RoadGraph roads;
+	int num_vertices, num_edges;
+
+	int max_threads = std::max(1, (int)std::thread::hardware_concurrency());
+	for (int num_threads = 1; ; num_threads = std::min(num_threads * 2, max_threads)) {
+		roads.clear();
+		OSMRoadsParser parser(&roads);
+		OSMPbfParser reader(&parser, true, num_threads);
+
+		timer.start();
+		bool ok = reader.parse(filename);
+		double elapsed = timer.nsecsElapsed() * 1e-9;
+		if (!ok) {
+			std::cout << "  failed to read the PBF file" << std::endl;
+			return;
+		}
+		roads.countValid(num_vertices, num_edges);
+		std::cout << "  pbf (" << num_threads << " threads): " << elapsed * 1000 << " ms, " << size_mb / elapsed << " MB/s -> " << num_vertices << " vertices, " << num_edges << " edges, buffers " << reader.bufferMemoryUsage() / 1024 << " KB + node table " << parser.nodeMemoryUsage() / 1024 << " KB" << std::endl;
+
+		if (num_threads == max_threads) break;
+	}
+}
+
+/**
+* Report the parse throughput of the file.
+* For an XML file, the PBF file of the same data (file.osm.pbf) is also measured if it exists.
+*/
+void benchParse(const QString& filename) {
+	if (filename.endsWith(".pbf", Qt::CaseInsensitive)) {
+		benchParsePBF(filename);
+		return;
+	}
+
+	benchParseXML(filename);
+	if (QFile::exists(filename + ".pbf")) {
+		benchParsePBF(filename + ".pbf");
+	}
+}
+
+/**
+* Compare the grid-based planarify() against the one-intersection-at-a-time planarifyNaive().
+*/
+void benchPlanarify(const QString& filename, bool naive) {
+	RoadGraph roads;
+	RoadGraphLoader::load(filename, roads);
+
+	int num_vertices, num_edges;
+	roads.countValid(num_vertices, num_edges);
+	std::cout << "planarify: " << filename.toStdString() << " (" << num_vertices << " vertices, " << num_edges << " edges)" << std::endl;
+
+	QElapsedTimer timer;
+	if (naive) {
+		RoadGraph copied_roads = roads.clone();
+		timer.start();
+		int num_intersections = copied_roads.planarifyNaive();
+		qint64 elapsed = timer.elapsed();
+		copied_roads.countValid(num_vertices, num_edges);
+		std::cout << "  naive: " << elapsed << " ms, " << num_intersections << " intersections -> " << num_vertices << " vertices, " << num_edges << " edges" << std::endl;
+	}
+
+	RoadGraph copied_roads = roads.clone();
+	timer.start();
+	int num_intersections = copied_roads.planarify();
+	qint64 elapsed = timer.elapsed();
+	copied_roads.countValid(num_vertices, num_edges);
+	std::cout << "  grid:  " << elapsed << " ms, " << num_intersections << " intersections -> " << num_vertices << " vertices, " << num_edges << " edges" << std::endl;
+}
+
+/**
+* Compare the chain-merging reduce() against the restart-from-scratch reduceNaive().
+*/
+void benchReduce(const QString& filename, bool naive) {
+	RoadGraph roads;
+	RoadGraphLoader::load(filename, roads);
+
+	int num_vertices, num_edges;
+	roads.countValid(num_vertices, num_edges);
+	std::cout << "reduce: " << filename.toStdString() << " (" << num_vertices << " vertices, " << num_edges << " edges)" << std::endl;
+
+	QElapsedTimer timer;
+	if (naive) {
+		RoadGraph copied_roads = roads.clone();
+		timer.start();
+		copied_roads.reduceNaive();
+		qint64 elapsed = timer.elapsed();
+		copied_roads.countValid(num_vertices, num_edges);
+		std::cout << "  naive:    " << elapsed << " ms -> " << num_vertices << " vertices, " << num_edges << " edges" << std::endl;
+	}
+
+	RoadGraph copied_roads = roads.clone();
+	timer.start();
+	copied_roads.reduce();
+	qint64 elapsed = timer.elapsed();
+	copied_roads.countValid(num_vertices, num_edges);
+	std::cout << "  worklist: " << elapsed << " ms -> " << num_vertices << " vertices, " << num_edges << " edges" << std::endl;
+}
+
+/**
+* Report the time and the polyline allocations per operation of the edit paths which build new polylines:
+* splitting edges, merging one vertex of degree 2, merging whole chains, and planarify.
+* Each new polyline should be allocated once regardless of its length.
+*/
+void benchPolyline(const QString& filename) {
+	RoadGraph roads;
+	RoadGraphLoader::load(filename, roads);
+
+	int num_vertices, num_edges;
+	roads.countValid(num_vertices, num_edges);
+	std::cout << "polyline: " << filename.toStdString() << " (" << num_vertices << " vertices, " << num_edges << " edges)" << std::endl;
+
+	// merge one vertex of degree 2 at a time
+	RoadGraph copied_roads = roads.clone();
+	int num_merged = 0;
+	Instrumentation::resetCounters();
+	double elapsed = timeRepeated(1, [&]() {
+		for (RoadVertexDesc v = 0; v < boost::num_vertices(copied_roads.graph); v++) {
+			if (copied_roads.graph[v]->valid && copied_roads.getDegree(v) == 2 && copied_roads.reduce(v)) num_merged++;
+		}
+	});
+	std::cout << "  reduce(v):  " << elapsed / std::max(num_merged, 1) << " ms, " << (double)Instrumentation::counter(Instrumentation::POLYLINE_ALLOCATIONS) / std::max(num_merged, 1) << " allocations per merged vertex" << std::endl;
+
+	// merge whole chains
+	copied_roads = roads.clone();
+	int num_edges_before = boost::num_edges(copied_roads.graph);
+	Instrumentation::resetCounters();
+	elapsed = timeRepeated(1, [&]() { copied_roads.reduce(); });
+	int num_chains = boost::num_edges(copied_roads.graph) - num_edges_before;
+	std::cout << "  reduce():   " << elapsed << " ms, " << (double)Instrumentation::counter(Instrumentation::POLYLINE_ALLOCATIONS) / std::max(num_chains, 1) << " allocations per merged chain" << std::endl;
+
+	// split the long edges made by reduce() at the middle of their first segment
+	std::vector<RoadEdgeDesc> edges;
+	int num_points = 0;
+	RoadEdgeIter ei, eend;
+	for (boost::tie(ei, eend) = boost::edges(copied_roads.graph); ei != eend; ++ei) {
+		if (!copied_roads.graph[*ei]->valid) continue;
+		const std::vector<QVector2D>& polyline = copied_roads.graph[*ei]->polyline;
+		if ((polyline[1] - polyline[0]).length() < 2.0f) continue;
+
+		edges.push_back(*ei);
+		num_points += polyline.size();
+	}
+	Instrumentation::resetCounters();
+	elapsed = timeRepeated(1, [&]() {
+		for (int i = 0; i < edges.size(); i++) {
+			const std::vector<QVector2D>& polyline = copied_roads.graph[edges[i]]->polyline;
+			copied_roads.splitEdge(edges[i], (polyline[0] + polyline[1]) * 0.5f);
+		}
+	});
+	int num_splits = std::max((int)edges.size(), 1);
+	std::cout << "  splitEdge:  " << elapsed / num_splits << " ms, " << (double)Instrumentation::counter(Instrumentation::POLYLINE_ALLOCATIONS) / num_splits << " allocations per split (" << (double)num_points / num_splits << " points per edge)" << std::endl;
+
+	// planarify
+	copied_roads = roads.clone();
+	num_edges_before = boost::num_edges(copied_roads.graph);
+	Instrumentation::resetCounters();
+	int num_intersections;
+	elapsed = timeRepeated(1, [&]() { num_intersections = copied_roads.planarify(); });
+	int num_pieces = std::max((int)boost::num_edges(copied_roads.graph) - num_edges_before, 1);
+	std::cout << "  planarify:  " << elapsed << " ms, " << num_intersections << " intersections, " << (double)Instrumentation::counter(Instrumentation::POLYLINE_ALLOCATIONS) / num_pieces << " allocations per piece" << std::endl;
+}
+
+/**
+* Measure splitEdge on straight edges of increasing length, each split at a point off the middle of the edge.
+* The split point is projected onto each segment, so the split itself should not depend on the length.
+* The edges are added directly to the graph as the parser does, so that the spatial index is not maintained
+* and only the split is measured first. Then the same splits are measured with the spatial index, whose update
+* is proportional to the number of grid cells the segments cover.
+*/
+void benchSplitEdge() {
+	std::cout << "split:" << std::endl;
+
+	const int num_edges = 1000;
+	const float lengths[] = { 10.0f, 100.0f, 1000.0f, 10000.0f };
+	for (int l = 0; l < sizeof(lengths) / sizeof(lengths[0]); l++) {
+		double elapsed[2];
+		for (int indexed = 0; indexed < 2; indexed++) {
+			RoadGraph roads;
+			std::vector<RoadEdgeDesc> edges;
+			for (int i = 0; i < num_edges; i++) {
+				RoadVertexDesc src = boost::add_vertex(roads.graph);
+				RoadVertexDesc tgt = boost::add_vertex(roads.graph);
+				roads.graph[src] = RoadVertexPtr(new RoadVertex(QVector2D(0.0f, i * 10.0f)));
+				roads.graph[tgt] = RoadVertexPtr(new RoadVertex(QVector2D(lengths[l], i * 10.0f)));
+
+				RoadEdgePtr edge = RoadEdgePtr(new RoadEdge(RoadEdge::TYPE_STREET, 1));
+				edge->polyline.push_back(roads.graph[src]->pt);
+				edge->polyline.push_back(roads.graph[tgt]->pt);
+				std::pair<RoadEdgeDesc, bool> edge_pair = boost::add_edge(src, tgt, roads.graph);
+				roads.graph[edge_pair.first] = edge;
+				edges.push_back(edge_pair.first);
+			}
+
+			// the first query builds the spatial index
+			if (indexed) {
+				RoadVertexDesc v;
+				roads.findClosestVertex(QVector2D(0.0f, 0.0f), 1.0f, v);
+			}
+
+			elapsed[indexed] = timeRepeated(1, [&]() {
+				for (int i = 0; i < num_edges; i++) {
+					roads.splitEdge(edges[i], QVector2D(lengths[l] * 0.37f, i * 10.0f + 1.0f));
+				}
+			});
+		}
+		std::cout << "  " << lengths[l] << " m: " << elapsed[0] * 1000.0 / num_edges << " us per split, " << elapsed[1] * 1000.0 / num_edges << " us with the spatial index" << std::endl;
+	}
+}
+
+/**
+* Copy the valid vertices and edges of the road graph n x n times side by side.
+* The copies are added directly to the graph as the parser does.
+*/
+void tileRoads(RoadGraph& src, int n, RoadGraph& roads) {
+	QVector2D minPt(std::numeric_limits<float>::max(), std::numeric_limits<float>::max());
+	QVector2D maxPt(-std::numeric_limits<float>::max(), -std::numeric_limits<float>::max());
+	RoadVertexIter vi, vend;
+	for (boost::tie(vi, vend) = boost::vertices(src.graph); vi != vend; ++vi) {
+		if (!src.graph[*vi]->valid) continue;
+
+		minPt.setX(std::min(minPt.x(), src.graph[*vi]->pt.x()));
+		minPt.setY(std::min(minPt.y(), src.graph[*vi]->pt.y()));
+		maxPt.setX(std::max(maxPt.x(), src.graph[*vi]->pt.x()));
+		maxPt.setY(std::max(maxPt.y(), src.graph[*vi]->pt.y()));
+	}
+
+	roads.clear();
+	for (int y = 0; y < n; y++) {
+		for (int x = 0; x < n; x++) {
+			QVector2D offset((maxPt.x() - minPt.x()) * x, (maxPt.y() - minPt.y()) * y);
+
+			std::vector<RoadVertexDesc> vertices(boost::num_vertices(src.graph));
+			for (boost::tie(vi, vend) = boost::vertices(src.graph); vi != vend; ++vi) {
+				if (!src.graph[*vi]->valid) continue;
+
+				vertices[*vi] = boost::add_vertex(roads.graph);
+				roads.graph[vertices[*vi]] = RoadVertexPtr(new RoadVertex(src.graph[*vi]->pt + offset));
+			}
+
+			RoadEdgeIter ei, eend;
+			for (boost::tie(ei, eend) = boost::edges(src.graph); ei != eend; ++ei) {
+				if (!src.graph[*ei]->valid) continue;
+
+				RoadEdgePtr edge = RoadEdgePtr(new RoadEdge(*src.graph[*ei]));
+				for (int i = 0; i < edge->polyline.size(); i++) {
+					edge->polyline[i] += offset;
+				}
+				std::pair<RoadEdgeDesc, bool> edge_pair = boost::add_edge(vertices[boost::source(*ei, src.graph)], vertices[boost::target(*ei, src.graph)], roads.graph);
+				roads.graph[edge_pair.first] = edge;
+			}
+		}
+	}
+}
+
+/**
+* Measure the frame time of drawing the road graph into a 1024x768 image as Canvas does, with and without the culling mode of RoadRenderer,
+* on 1, 4, 16, and 64 copies of the graph, both when the whole graph is in view and when zoomed in to 1 pixel per meter at its center.
+* The first culled frame, which builds the spatial index and simplifies the polylines for the zoom level, is reported separately.
+* The draw calls are counted for the paths of the road classes and the markers.
+*/
+void benchRender(const QString& filename) {
+	RoadGraph loaded_roads;
+	RoadGraphLoader::load(filename, loaded_roads);
+
+	int num_vertices, num_edges;
+	loaded_roads.countValid(num_vertices, num_edges);
+	std::cout << "render: " << filename.toStdString() << " (" << num_vertices << " vertices, " << num_edges << " edges)" << std::endl;
+	if (num_vertices == 0) return;
+
+	const int width = 1024;
+	const int height = 768;
+	QImage image(width, height, QImage::Format_RGB32);
+
+	for (int n = 1; n <= 8; n *= 2) {
+		RoadGraph roads;
+		tileRoads(loaded_roads, n, roads);
+		roads.countValid(num_vertices, num_edges);
+		std::cout << "  " << n * n << " copies (" << num_vertices << " vertices, " << num_edges << " edges):" << std::endl;
+
+		QVector2D minPt(std::numeric_limits<float>::max(), std::numeric_limits<float>::max());
+		QVector2D maxPt(-std::numeric_limits<float>::max(), -std::numeric_limits<float>::max());
+		RoadVertexIter vi, vend;
+		for (boost::tie(vi, vend) = boost::vertices(roads.graph); vi != vend; ++vi) {
+			minPt.setX(std::min(minPt.x(), roads.graph[*vi]->pt.x()));
+			minPt.setY(std::min(minPt.y(), roads.graph[*vi]->pt.y()));
+			maxPt.setX(std::max(maxPt.x(), roads.graph[*vi]->pt.x()));
+			maxPt.setY(std::max(maxPt.y(), roads.graph[*vi]->pt.y()));
+		}
+		QVector2D center = (minPt + maxPt) * 0.5f;
+
+		for (int zoomed = 0; zoomed < 2; zoomed++) {
+			double scale = zoomed ? 1.0 : std::min(width / (maxPt.x() - minPt.x()), height / (maxPt.y() - minPt.y()));
+			QPointF origin(width * 0.5 - center.x() * scale, height * 0.5 + center.y() * scale);
+
+			RoadRenderer renderer;
+			std::function<void()> frame = [&]() {
+				QPainter painter(&image);
+				painter.fillRect(0, 0, width, height, QColor(255, 255, 255));
+				renderer.setView(roads, origin, scale, width, height);
+				renderer.drawEdges(painter);
+				renderer.drawVertices(painter);
+			};
+
+			renderer.culling = false;
+			double full = timeRepeated(5, frame);
+			int full_points = renderer.numDrawnPoints;
+			int full_calls = renderer.numDrawCalls;
+
+			renderer.culling = true;
+			double first = timeRepeated(1, frame);
+			double culled = timeRepeated(5, frame);
+
+			std::cout << "    " << (zoomed ? "zoomed in:   " : "whole graph: ") << "full " << full << " ms (" << full_points << " points, " << full_calls << " draw calls), culled "
+				<< culled << " ms (" << renderer.numDrawnPoints << " points, " << renderer.numDrawCalls << " draw calls" << (renderer.markersDrawn ? "" : ", no markers") << "), first culled frame " << first << " ms" << std::endl;
+		}
+	}
+}
+
+
+/**
+* Measure the frame time of panning a 1024x768 view by 4 pixels per frame over 256 copies of the road graph for 120 frames,
+* drawing directly with the culling RoadRenderer as against blitting the tiles of RoadTileCache,
+* both when the whole graph is in view and when zoomed in to 1 pixel per meter at its center.
+* The drag case moves the vertex closest to the center by 1 pixel per frame, so that the tiles touched by its edges are drawn again.
+*/
+void benchPan(const QString& filename) {
+	RoadGraph loaded_roads;
+	RoadGraphLoader::load(filename, loaded_roads);
+
+	RoadGraph roads;
+	tileRoads(loaded_roads, 16, roads);
+
+	int num_vertices, num_edges;
+	roads.countValid(num_vertices, num_edges);
+	int num_segments = 0;
+	RoadEdgeIter ei, eend;
+	for (boost::tie(ei, eend) = boost::edges(roads.graph); ei != eend; ++ei) {
+		num_segments += roads.graph[*ei]->polyline.size() - 1;
+	}
+	std::cout << "pan: 256 copies of " << filename.toStdString() << " (" << num_vertices << " vertices, " << num_edges << " edges, " << num_segments << " segments)" << std::endl;
+	if (num_vertices == 0) return;
+
+	const int width = 1024;
+	const int height = 768;
+	const int num_frames = 120;
+	QImage image(width, height, QImage::Format_RGB32);
+
+	QVector2D minPt(std::numeric_limits<float>::max(), std::numeric_limits<float>::max());
+	QVector2D maxPt(-std::numeric_limits<float>::max(), -std::numeric_limits<float>::max());
+	RoadVertexIter vi, vend;
+	for (boost::tie(vi, vend) = boost::vertices(roads.graph); vi != vend; ++vi) {
+		minPt.setX(std::min(minPt.x(), roads.graph[*vi]->pt.x()));
+		minPt.setY(std::min(minPt.y(), roads.graph[*vi]->pt.y()));
+		maxPt.setX(std::max(maxPt.x(), roads.graph[*vi]->pt.x()));
+		maxPt.setY(std::max(maxPt.y(), roads.graph[*vi]->pt.y()));
+	}
+	QVector2D center = (minPt + maxPt) * 0.5f;
+
+	RoadVertexDesc dragged;
+	float min_dist = std::numeric_limits<float>::max();
+	for (boost::tie(vi, vend) = boost::vertices(roads.graph); vi != vend; ++vi) {
+		float dist = (roads.graph[*vi]->pt - center).lengthSquared();
+		if (dist < min_dist) {
+			min_dist = dist;
+			dragged = *vi;
+		}
+	}
+
+	for (int zoomed = 0; zoomed < 2; zoomed++) {
+		double scale = zoomed ? 1.0 : std::min(width / (maxPt.x() - minPt.x()), height / (maxPt.y() - minPt.y()));
+		QPointF origin(width * 0.5 - center.x() * scale, height * 0.5 + center.y() * scale);
+		std::cout << "  " << (zoomed ? "zoomed in:" : "whole graph:") << std::endl;
+
+		// mode 0: direct drawing, 1: tiles, 2: tiles while dragging the vertex
+		for (int mode = 0; mode < 3; mode++) {
+			RoadRenderer renderer;
+			RoadTileCache tiles;
+			QVector2D dragged_pt = roads.graph[dragged]->pt;
+
+			double first = 0.0;
+			double total = 0.0;
+			double max_time = 0.0;
+			int num_rendered = 0;
+			for (int i = 0; i <= num_frames; i++) {
+				QPointF pan(origin.x() - i * 4, origin.y() - i * 2);
+				if (mode == 2) roads.moveVertex(dragged, dragged_pt + QVector2D(i, 0) / scale);
+
+				QElapsedTimer timer;
+				timer.start();
+				QPainter painter(&image);
+				painter.fillRect(0, 0, width, height, QColor(255, 255, 255));
+				if (mode == 0) {
+					renderer.setView(roads, pan, scale, width, height);
+					renderer.drawEdges(painter);
+					renderer.drawVertices(painter);
+				}
+				else {
+					tiles.draw(painter, roads, pan, scale, width, height);
+				}
+				painter.end();
+				double elapsed = timer.nsecsElapsed() * 1e-6;
+
+				// the first frame, which builds the spatial index and draws all the tiles, is reported separately
+				if (i == 0) {
+					first = elapsed;
+					continue;
+				}
+				total += elapsed;
+				max_time = std::max(max_time, elapsed);
+				if (mode > 0) num_rendered += tiles.numRenderedTiles;
+			}
+			if (mode == 2) roads.moveVertex(dragged, dragged_pt);
+
+			std::cout << "    " << (mode == 0 ? "direct: " : (mode == 1 ? "tiles:  " : "drag:   ")) << total / num_frames << " ms per frame, max " << max_time << " ms, first frame " << first << " ms";
+			if (mode > 0) std::cout << ", " << (double)num_rendered / num_frames << " tiles drawn per frame, " << tiles.memoryUsage() / 1024 / 1024 << " MB";
+			std::cout << std::endl;
+		}
+	}
+}
+
+
+/**
+* Measure the time of drawing all the tiles of a 1024x768 view of 64 copies of the road graph by RoadTileCache with 1, 2, 4, ... threads up to the number of cores,
+* both when the whole graph is in view and when zoomed in to 4 pixels per meter at its center.
+* The first frame also simplifies the polylines for the zoom level in each thread, and the next frames, whose tiles are discarded beforehand, only draw.
+*/
+void benchRaster(const QString& filename) {
+	RoadGraph loaded_roads;
+	RoadGraphLoader::load(filename, loaded_roads);
+
+	RoadGraph roads;
+	tileRoads(loaded_roads, 8, roads);
+
+	int num_vertices, num_edges;
+	roads.countValid(num_vertices, num_edges);
+	std::cout << "raster: 64 copies of " << filename.toStdString() << " (" << num_vertices << " vertices, " << num_edges << " edges)" << std::endl;
+	if (num_vertices == 0) return;
+
+	const int width = 1024;
+	const int height = 768;
+	QImage image(width, height, QImage::Format_RGB32);
+
+	QVector2D minPt(std::numeric_limits<float>::max(), std::numeric_limits<float>::max());
+	QVector2D maxPt(-std::numeric_limits<float>::max(), -std::numeric_limits<float>::max());
+	RoadVertexIter vi, vend;
+	for (boost::tie(vi, vend) = boost::vertices(roads.graph); vi != vend; ++vi) {
+		minPt.setX(std::min(minPt.x(), roads.graph[*vi]->pt.x()));
+		minPt.setY(std::min(minPt.y(), roads.graph[*vi]->pt.y()));
+		maxPt.setX(std::max(maxPt.x(), roads.graph[*vi]->pt.x()));
+		maxPt.setY(std::max(maxPt.y(), roads.graph[*vi]->pt.y()));
+	}
+	QVector2D center = (minPt + maxPt) * 0.5f;
+
+	int max_threads = std::max(1, (int)std::thread::hardware_concurrency());
+	for (int zoomed = 0; zoomed < 2; zoomed++) {
+		double scale = zoomed ? 4.0 : std::min(width / (maxPt.x() - minPt.x()), height / (maxPt.y() - minPt.y()));
+		QPointF origin(width * 0.5 - center.x() * scale, height * 0.5 + center.y() * scale);
+		std::cout << "  " << (zoomed ? "zoomed in:" : "whole graph:") << std::endl;
+
+		double elapsed_one_thread = 0.0;
+		for (int num_threads = 1; ; num_threads = std::min(num_threads * 2, max_threads)) {
+			RoadTileCache tiles(num_threads);
+			std::function<void()> frame = [&]() {
+				tiles.clear();
+				QPainter painter(&image);
+				tiles.draw(painter, roads, origin, scale, width, height);
+			};
+
+			double first = timeRepeated(1, frame);
+			double elapsed = timeRepeated(5, frame);
+			if (num_threads == 1) elapsed_one_thread = elapsed;
+
+			std::cout << "    " << num_threads << " threads: " << elapsed << " ms for " << tiles.numRenderedTiles << " tiles (x" << elapsed_one_thread / elapsed << "), first frame " << first << " ms" << std::endl;
+			if (num_threads == max_threads) break;
+		}
+	}
+}
+
+/**
+* Compare the streaming OSMRoadsExporter::save against building a QDomDocument.
+*/
+void benchExport(const QString& filename) {
+	RoadGraph roads;
+	RoadGraphLoader::load(filename, roads);
+
+	int num_vertices, num_edges;
+	roads.countValid(num_vertices, num_edges);
+	std::cout << "export: " << filename.toStdString() << " (" << num_vertices << " vertices, " << num_edges << " edges)" << std::endl;
+
+	QString output = QDir::temp().filePath("OSMBench_export.osm");
+	QElapsedTimer timer;
+
+	timer.start();
+	saveWithDOM(output, roads);
+	double elapsed = timer.nsecsElapsed() * 1e-9;
+	double size_mb = QFile(output).size() / 1024.0 / 1024.0;
+	std::cout << "  dom:    " << elapsed * 1000 << " ms, " << size_mb / elapsed << " MB/s" << std::endl;
+
+	timer.start();
+	OSMRoadsExporter::save(output, roads);
+	elapsed = timer.nsecsElapsed() * 1e-9;
+	size_mb = QFile(output).size() / 1024.0 / 1024.0;
+	std::cout << "  stream: " << elapsed * 1000 << " ms, " << size_mb / elapsed << " MB/s" << std::endl;
+
+	QFile::remove(output);
+}
+
+/**
+* Compare loading the binary snapshot against loading the OSM file.
+*/
+void benchSnapshot(const QString& filename) {
+	QElapsedTimer timer;
+	RoadGraph roads;
+	int num_vertices, num_edges;
+
+	timer.start();
+	RoadGraphLoader::load(filename, roads);
+	qint64 elapsed = timer.nsecsElapsed();
+	roads.countValid(num_vertices, num_edges);
+	std::cout << "snapshot: " << filename.toStdString() << " (" << num_vertices << " vertices, " << num_edges << " edges)" << std::endl;
+	std::cout << "  load osm:      " << elapsed * 1e-6 << " ms" << std::endl;
+
+	QString output = QDir::temp().filePath("OSMBench_snapshot.rgs");
+	timer.start();
+	RoadGraphSnapshot::save(output, roads);
+	elapsed = timer.nsecsElapsed();
+	std::cout << "  save snapshot: " << elapsed * 1e-6 << " ms, " << QFile(output).size() / 1024 << " KB" << std::endl;
+
+	RoadGraph loaded_roads;
+	timer.start();
+	RoadGraphSnapshot::load(output, loaded_roads);
+	elapsed = timer.nsecsElapsed();
+	loaded_roads.countValid(num_vertices, num_edges);
+	std::cout << "  load snapshot: " << elapsed * 1e-6 << " ms -> " << num_vertices << " vertices, " << num_edges << " edges" << std::endl;
+
+	QFile::remove(output);
+}
+
+/**
+* Return the average time in ms of calling the function the specified number of times.
+*/
+double timeRepeated(int repeat, std::function<void()> func) {
+	QElapsedTimer timer;
+	timer.start();
+	for (int i = 0; i < repeat; i++) func();
+	return timer.nsecsElapsed() * 1e-6 / repeat;
+}
+
+/**
+* Compare recording a vertex drag by cloning the whole road graph, as History used to do on every vertex press,
+* against recording only the changed elements, and report the time of undoing and redoing all the drags.
+*/
+void benchHistory(const QString& filename) {
+	RoadGraph roads;
+	RoadGraphLoader::load(filename, roads);
+
+	int num_vertices, num_edges;
+	roads.countValid(num_vertices, num_edges);
+	std::cout << "history: " << filename.toStdString() << " (" << num_vertices << " vertices, " << num_edges << " edges)" << std::endl;
+
+	// pick the vertices to drag
+	std::vector<RoadVertexDesc> vertices;
+	RoadVertexIter vi, vend;
+	for (boost::tie(vi, vend) = boost::vertices(roads.graph); vi != vend; ++vi) {
+		if (roads.graph[*vi]->valid && roads.getDegree(*vi) > 0) vertices.push_back(*vi);
+	}
+	if (vertices.empty()) return;
+	const int num_drags = 100;
+
+	QElapsedTimer timer;
+	timer.start();
+	for (int i = 0; i < num_drags; i++) {
+		RoadGraph copied_roads = roads.clone();
+	}
+	double elapsed = timer.nsecsElapsed() * 1e-6;
+	std::cout << "  clone:  " << elapsed / num_drags << " ms per drag" << std::endl;
+
+	History history;
+	timer.start();
+	for (int i = 0; i < num_drags; i++) {
+		RoadVertexDesc v = vertices[(i * 7919) % vertices.size()];
+		history.begin(roads);
+		for (int j = 1; j <= 10; j++) {
+			roads.moveVertex(v, roads.graph[v]->pt + QVector2D(1.0f, 1.0f));
+		}
+		history.end(roads);
+	}
+	elapsed = timer.nsecsElapsed() * 1e-6;
+	std::cout << "  delta:  " << elapsed / num_drags << " ms per drag (10 moves each), " << history.memoryUsage() / 1024 << " KB for " << history.numCommands() << " drags" << std::endl;
+
+	timer.start();
+	for (int i = 0; i < num_drags; i++) {
+		history.undo(roads);
+	}
+	double elapsed_undo = timer.nsecsElapsed() * 1e-6;
+	timer.start();
+	for (int i = 0; i < num_drags; i++) {
+		history.redo(roads);
+	}
+	double elapsed_redo = timer.nsecsElapsed() * 1e-6;
+	std::cout << "  undo:   " << elapsed_undo / num_drags << " ms, redo: " << elapsed_redo / num_drags << " ms per drag" << std::endl;
+}
+
+/**
+* Compare RoadGraph::clone against taking a persistent snapshot after each edit, and report the memory per retained version.
+*/
+void benchClone(const QString& filename) {
+	RoadGraph roads;
+	RoadGraphLoader::load(filename, roads);
+
+	int num_vertices, num_edges;
+	roads.countValid(num_vertices, num_edges);
+	std::cout << "clone: " << filename.toStdString() << " (" << num_vertices << " vertices, " << num_edges << " edges)" << std::endl;
+
+	std::vector<RoadVertexDesc> vertices;
+	RoadVertexIter vi, vend;
+	for (boost::tie(vi, vend) = boost::vertices(roads.graph); vi != vend; ++vi) {
+		if (roads.graph[*vi]->valid && roads.getDegree(*vi) > 0) vertices.push_back(*vi);
+	}
+	if (vertices.empty()) return;
+	const int num_versions = 100;
+
+	QElapsedTimer timer;
+	timer.start();
+	for (int i = 0; i < num_versions; i++) {
+		RoadGraph copied_roads = roads.clone();
+	}
+	std::cout << "  clone:          " << timer.nsecsElapsed() * 1e-6 / num_versions << " ms" << std::endl;
+
+	timer.start();
+	std::vector<RoadGraphVersion> versions;
+	versions.push_back(roads.snapshot());
+	std::cout << "  first snapshot: " << timer.nsecsElapsed() * 1e-6 << " ms, " << versions[0].memoryUsage() / 1024 << " KB" << std::endl;
+
+	// keep a version after every vertex move
+	double elapsed = 0.0;
+	for (int i = 1; i < num_versions; i++) {
+		RoadVertexDesc v = vertices[(i * 7919) % vertices.size()];
+		roads.moveVertex(v, roads.graph[v]->pt + QVector2D(1.0f, 1.0f));
+
+		timer.start();
+		versions.push_back(roads.snapshot());
+		elapsed += timer.nsecsElapsed() * 1e-6;
+	}
+
+	timer.start();
+	for (int i = 0; i < num_versions; i++) {
+		RoadGraphVersion copied_version = versions.back();
+	}
+	double elapsed_copy = timer.nsecsElapsed() * 1e-6;
+
+	size_t total_memory = 0;
+	for (int i = 0; i < versions.size(); i++) {
+		total_memory += versions[i].ownMemoryUsage();
+	}
+	std::cout << "  snapshot:       " << elapsed / (num_versions - 1) << " ms after each move, copy " << elapsed_copy / num_versions << " ms" << std::endl;
+	std::cout << "  memory:         " << total_memory / 1024 << " KB for " << versions.size() << " versions (" << total_memory / 1024 / versions.size() << " KB per version, " << versions.back().memoryUsage() / 1024 << " KB if not shared)" << std::endl;
+}
+
+/**
+* Split every edge at its middle a few times and delete some of them, which leaves many invalid elements,
+* and compare the traversals and the queries before and after compacting the road graph.
+*/
+void benchCompact(const QString& filename) {
+	RoadGraph roads;
+	RoadGraphLoader::load(filename, roads);
+
+	int num_vertices, num_edges;
+	roads.countValid(num_vertices, num_edges);
+	std::cout << "compact: " << filename.toStdString() << " (" << num_vertices << " vertices, " << num_edges << " edges)" << std::endl;
+	if (num_vertices == 0) return;
+
+	for (int round = 0; round < 3; round++) {
+		std::vector<RoadEdgeDesc> edges;
+		RoadEdgeIter ei, eend;
+		for (boost::tie(ei, eend) = boost::edges(roads.graph); ei != eend; ++ei) {
+			if (roads.graph[*ei]->valid) edges.push_back(*ei);
+		}
+		for (int i = 0; i < edges.size(); i++) {
+			const std::vector<QVector2D>& polyline = roads.graph[edges[i]]->polyline;
+			if (i % 5 == 0) {
+				roads.deleteEdge(edges[i]);
+			}
+			else {
+				roads.splitEdge(edges[i], (polyline[0] + polyline[1]) * 0.5f);
+			}
+		}
+	}
+	roads.countValid(num_vertices, num_edges);
+
+	std::vector<QVector2D> query_points;
+	RoadVertexIter vi, vend;
+	for (boost::tie(vi, vend) = boost::vertices(roads.graph); vi != vend; ++vi) {
+		if (roads.graph[*vi]->valid && query_points.size() < 1000) query_points.push_back(roads.graph[*vi]->pt + QVector2D(3.0f, 4.0f));
+	}
+
+	const int repeat = 10;
+	for (int compacted = 0; compacted < 2; compacted++) {
+		if (compacted) {
+			RoadGraphMapping mapping;
+			int num_removed;
+			double elapsed = timeRepeated(1, [&]() { num_removed = roads.compact(mapping); });
+			std::cout << "  compaction: " << elapsed << " ms, " << num_removed << " elements removed" << std::endl;
+		}
+
+		float total_length = 0.0f;
+		long long total_degree = 0;
+		double elapsed_traverse = timeRepeated(repeat, [&]() {
+			total_length = 0.0f;
+			RoadEdgeIter ei, eend;
+			for (boost::tie(ei, eend) = boost::edges(roads.graph); ei != eend; ++ei) {
+				if (roads.graph[*ei]->valid) total_length += roads.graph[*ei]->getLength();
+			}
+			total_degree = 0;
+			RoadVertexIter vi, vend;
+			for (boost::tie(vi, vend) = boost::vertices(roads.graph); vi != vend; ++vi) {
+				if (roads.graph[*vi]->valid) total_degree += roads.getDegree(*vi);
+			}
+		});
+
+		// the first query builds the spatial index
+		double elapsed_index = timeRepeated(1, [&]() {
+			RoadVertexDesc v;
+			roads.findClosestVertex(query_points[0], 10.0f, v);
+		});
+		int num_found = 0;
+		double elapsed_query = timeRepeated(repeat, [&]() {
+			num_found = 0;
+			for (int i = 0; i < query_points.size(); i++) {
+				RoadEdgeDesc e;
+				QVector2D closest_pt;
+				if (roads.findClosestEdge(query_points[i], 10.0f, e, closest_pt)) num_found++;
+			}
+		});
+
+		std::cout << (compacted ? "  after:  " : "  before: ") << boost::num_vertices(roads.graph) << " vertices, " << boost::num_edges(roads.graph) << " edges stored for " << num_vertices << " / " << num_edges << " valid"
+			<< ", traverse " << elapsed_traverse << " ms (" << total_length << " m, degree " << total_degree << ")"
+			<< ", index " << elapsed_index << " ms, " << query_points.size() << " edge queries " << elapsed_query << " ms (" << num_found << " found)" << std::endl;
+	}
+}
+
+/**
+* Result of a benchmark of the suite, with the fields of the JSON output of Google Benchmark.
+* The times are in nanoseconds per iteration, and the counters are reported as they are.
+*/
+struct SuiteResult {
+	std::string name;
+	long long iterations;
+	double realTime;
+	double cpuTime;
+	std::vector<std::pair<std::string, double> > counters;
+};
+
+/**
+* Run the function repeatedly until it has taken the minimum time in total, as Google Benchmark does, and print and append the result.
+* The setup is run before each iteration without being timed, so that the benchmarks which modify the graph start from the same graph.
+* The polyline allocations (Instrumentation counters) of the timed function are reported per iteration.
+*
+* @param items		number of the items (e.g. queries) processed by an iteration, which is reported as items_per_second if positive
+*/
+void runSuiteBenchmark(const std::string& name, double min_time, int items, const std::function<void()>& setup, const std::function<void()>& func, RoadGraph& roads, std::vector<SuiteResult>& results) {
+	long long iterations = 0;
+	qint64 real_ns = 0;
+	std::clock_t cpu_ticks = 0;
+	long long allocations = 0;
+	while (iterations == 0 || real_ns < min_time * 1e9) {
+		if (setup) setup();
+
+		long long allocations_before = Instrumentation::counter(Instrumentation::POLYLINE_ALLOCATIONS);
+		std::clock_t cpu_start = std::clock();
+		QElapsedTimer timer;
+		timer.start();
+		func();
+		real_ns += timer.nsecsElapsed();
+		cpu_ticks += std::clock() - cpu_start;
+		allocations += Instrumentation::counter(Instrumentation::POLYLINE_ALLOCATIONS) - allocations_before;
+		iterations++;
+	}
+
+	SuiteResult result;
+	result.name = name;
+	result.iterations = iterations;
+	result.realTime = (double)real_ns / iterations;
+	result.cpuTime = cpu_ticks * 1e9 / CLOCKS_PER_SEC / iterations;
+	int num_vertices, num_edges;
+	roads.countValid(num_vertices, num_edges);
+	result.counters.push_back(std::make_pair(std::string("vertices"), (double)num_vertices));
+	result.counters.push_back(std::make_pair(std::string("edges"), (double)num_edges));
+	result.counters.push_back(std::make_pair(std::string("allocations"), (double)allocations / iterations));
+	if (items > 0) {
+		result.counters.push_back(std::make_pair(std::string("items_per_second"), items * 1e9 / result.realTime));
+	}
+	results.push_back(result);
+
+	std::cout << "  " << name << ": " << result.realTime * 1e-6 << " ms (cpu " << result.cpuTime * 1e-6 << " ms), " << iterations << " iterations";
+	if (items > 0) std::cout << ", " << items * 1e9 / result.realTime << " items/s";
+	std::cout << ", " << (double)allocations / iterations << " allocations" << std::endl;
+}
+
+/**
+* Run the benchmarks of the core operations on the road graph: export, parse, clone, reduce, planarify, splitEdge, snapVertex,
+* moveVertex, and the hit tests of Canvas (findClosestVertex, findClosestEdgePoint, and findClosestEdge with the thresholds of Canvas
+* at 1 pixel per meter). The operations which modify the graph run on a clone of it, which is made before each iteration.
+* The edits and the queries are spread over the graph, and are the same in every run.
+*
+* @param filename	OSM file to parse, which is the file exported by the suite if empty
+*/
+void runSuite(const std::string& label, RoadGraph& roads, const QString& filename, double min_time, std::vector<SuiteResult>& results) {
+	int num_vertices, num_edges;
+	roads.countValid(num_vertices, num_edges);
+	std::cout << "suite: " << label << " (" << num_vertices << " vertices, " << num_edges << " edges)" << std::endl;
+	if (num_edges == 0) return;
+
+	QString exported = QDir::temp().filePath("osmbench_suite.osm");
+	runSuiteBenchmark("BM_Export/" + label, min_time, 0, nullptr, [&]() {
+		OSMRoadsExporter::save(exported, roads);
+	}, roads, results);
+
+	RoadGraph parsed;
+	runSuiteBenchmark("BM_Parse/" + label, min_time, 0, [&]() { parsed.clear(); }, [&]() {
+		RoadGraphLoader::load(filename.isEmpty() ? exported : filename, parsed);
+	}, roads, results);
+	parsed.clear();
+	QFile::remove(exported);
+
+	std::unique_ptr<RoadGraph> copied_roads;
+	runSuiteBenchmark("BM_Clone/" + label, min_time, 0, [&]() { copied_roads.reset(); }, [&]() {
+		copied_roads.reset(new RoadGraph(roads.clone()));
+	}, roads, results);
+
+	runSuiteBenchmark("BM_Reduce/" + label, min_time, 0, [&]() { copied_roads.reset(new RoadGraph(roads.clone())); }, [&]() {
+		copied_roads->reduce();
+	}, roads, results);
+
+	runSuiteBenchmark("BM_Planarify/" + label, min_time, 0, [&]() { copied_roads.reset(new RoadGraph(roads.clone())); }, [&]() {
+		copied_roads->planarify();
+	}, roads, results);
+
+	// split 1000 edges spread over the graph at the middle of their first segments
+	const int num_edits = 1000;
+	int step = std::max(1, num_edges / num_edits);
+	std::vector<RoadEdgeDesc> split_edges;
+	std::vector<QVector2D> split_points;
+	runSuiteBenchmark("BM_SplitEdge/" + label, min_time, std::min(num_edits, num_edges), [&]() {
+		copied_roads.reset(new RoadGraph(roads.clone()));
+		split_edges.clear();
+		split_points.clear();
+		int count = 0;
+		RoadEdgeIter ei, eend;
+		for (boost::tie(ei, eend) = boost::edges(copied_roads->graph); ei != eend && split_edges.size() < num_edits; ++ei) {
+			if (!copied_roads->graph[*ei]->valid || count++ % step != 0) continue;
+
+			const std::vector<QVector2D>& polyline = copied_roads->graph[*ei]->polyline;
+			split_edges.push_back(*ei);
+			split_points.push_back((polyline[0] + polyline[1]) * 0.5f);
+		}
+	}, [&]() {
+		for (int i = 0; i < split_edges.size(); i++) {
+			copied_roads->splitEdge(split_edges[i], split_points[i]);
+		}
+	}, roads, results);
+
+	// snap 1000 vertices spread over the graph to one of their neighbors as dragging a vertex onto another one does
+	step = std::max(1, num_vertices / num_edits);
+	std::vector<std::pair<RoadVertexDesc, RoadVertexDesc> > snapped_vertices;
+	runSuiteBenchmark("BM_SnapVertex/" + label, min_time, std::min(num_edits, num_vertices), [&]() {
+		copied_roads.reset(new RoadGraph(roads.clone()));
+		snapped_vertices.clear();
+		int count = 0;
+		RoadVertexIter vi, vend;
+		for (boost::tie(vi, vend) = boost::vertices(copied_roads->graph); vi != vend && snapped_vertices.size() < num_edits; ++vi) {
+			if (!copied_roads->graph[*vi]->valid || count++ % step != 0) continue;
+
+			RoadOutEdgeIter ei, eend;
+			for (boost::tie(ei, eend) = boost::out_edges(*vi, copied_roads->graph); ei != eend; ++ei) {
+				if (!copied_roads->graph[*ei]->valid) continue;
+
+				snapped_vertices.push_back(std::make_pair(*vi, boost::target(*ei, copied_roads->graph)));
+				break;
+			}
+		}
+	}, [&]() {
+		for (int i = 0; i < snapped_vertices.size(); i++) {
+			// the vertex may have been invalidated by the previous snaps
+			if (!copied_roads->graph[snapped_vertices[i].first]->valid || !copied_roads->graph[snapped_vertices[i].second]->valid) continue;
+			copied_roads->snapVertex(snapped_vertices[i].first, snapped_vertices[i].second);
+		}
+	}, roads, results);
+	copied_roads.reset();
+
+	// the queries are 5 m away from the vertices spread over the graph
+	std::vector<RoadVertexDesc> moved_vertices;
+	std::vector<QVector2D> query_points;
+	int count = 0;
+	RoadVertexIter vi, vend;
+	for (boost::tie(vi, vend) = boost::vertices(roads.graph); vi != vend && moved_vertices.size() < num_edits; ++vi) {
+		if (!roads.graph[*vi]->valid || count++ % step != 0) continue;
+
+		moved_vertices.push_back(*vi);
+		query_points.push_back(roads.graph[*vi]->pt + QVector2D(3.0f, 4.0f));
+	}
+
+	// the first query builds the spatial index
+	RoadVertexDesc v;
+	roads.findClosestVertex(query_points[0], 10.0f, v);
+
+	int num_found = 0;
+	runSuiteBenchmark("BM_FindClosestVertex/" + label, min_time, query_points.size(), nullptr, [&]() {
+		for (int i = 0; i < query_points.size(); i++) {
+			if (roads.findClosestVertex(query_points[i], 10.0f, v)) num_found++;
+		}
+	}, roads, results);
+
+	RoadEdgeDesc e;
+	int edge_point;
+	runSuiteBenchmark("BM_FindClosestEdgePoint/" + label, min_time, query_points.size(), nullptr, [&]() {
+		for (int i = 0; i < query_points.size(); i++) {
+			if (roads.findClosestEdgePoint(query_points[i], 9.0f, e, edge_point)) num_found++;
+		}
+	}, roads, results);
+
+	QVector2D closest_pt;
+	runSuiteBenchmark("BM_FindClosestEdge/" + label, min_time, query_points.size(), nullptr, [&]() {
+		for (int i = 0; i < query_points.size(); i++) {
+			if (roads.findClosestEdge(query_points[i], 9.0f, e, closest_pt)) num_found++;
+		}
+	}, roads, results);
+
+	// move each vertex 5 m away and back, so that the graph is the same after every iteration
+	runSuiteBenchmark("BM_MoveVertex/" + label, min_time, moved_vertices.size() * 2, nullptr, [&]() {
+		for (int i = 0; i < moved_vertices.size(); i++) {
+			QVector2D pt = roads.graph[moved_vertices[i]]->pt;
+			roads.moveVertex(moved_vertices[i], pt + QVector2D(3.0f, 4.0f));
+			roads.moveVertex(moved_vertices[i], pt);
+		}
+	}, roads, results);
+}
+
+/**
+* Return the string as a JSON string literal.
+*/
+std::string jsonString(const std::string& str) {
+	std::string quoted = "\"";
+	for (int i = 0; i < str.size(); i++) {
+		if (str[i] == '"' || str[i] == '\\') quoted += '\\';
+		quoted += str[i];
+	}
+	return quoted + "\"";
+}
+
+/**
+* Write the results in the JSON format of Google Benchmark (--benchmark_out_format=json), so that the existing tools can compare the runs.
+*/
+bool writeSuiteJSON(const QString& filename, const std::string& executable, const std::vector<SuiteResult>& results) {
+	std::ofstream out(filename.toStdString().c_str());
+	if (!out) return false;
+
+	out.precision(12);
+	out << "{\n";
+	out << "  \"context\": {\n";
+	out << "    \"date\": " << jsonString(QDateTime::currentDateTime().toString(Qt::ISODate).toStdString()) << ",\n";
+	out << "    \"executable\": " << jsonString(executable) << ",\n";
+	out << "    \"num_cpus\": " << std::max(1, (int)std::thread::hardware_concurrency()) << ",\n";
+#ifdef NDEBUG
+	out << "    \"library_build_type\": \"release\"\n";
+#else
+	out << "    \"library_build_type\": \"debug\"\n";
+#endif
+	out << "  },\n";
+	out << "  \"benchmarks\": [\n";
+	for (int i = 0; i < results.size(); i++) {
+		out << "    {\n";
+		out << "      \"name\": " << jsonString(results[i].name) << ",\n";
+		out << "      \"run_name\": " << jsonString(results[i].name) << ",\n";
+		out << "      \"run_type\": \"iteration\",\n";
+		out << "      \"iterations\": " << results[i].iterations << ",\n";
+		out << "      \"real_time\": " << results[i].realTime << ",\n";
+		out << "      \"cpu_time\": " << results[i].cpuTime << ",\n";
+		out << "      \"time_unit\": \"ns\"";
+		for (int j = 0; j < results[i].counters.size(); j++) {
+			out << ",\n      " << jsonString(results[i].counters[j].first) << ": " << results[i].counters[j].second;
+		}
+		out << "\n    }" << (i + 1 < results.size() ? "," : "") << "\n";
+	}
+	out << "  ]\n";
+	out << "}\n";
+
+	return (bool)out;
+}
+
+/**
+* Run the suite on the OSM files and on the synthetic networks (grid, radial, and random with crossings) of 10k, 100k, 1M, and 10M edges
+* up to the maximum number of edges, and write the results to the JSON file if specified.
+*/
+void benchSuite(const QStringList& filenames, int max_edges, double min_time, const QString& json_filename, const std::string& executable) {
+	std::vector<SuiteResult> results;
+
+	for (int i = 0; i < filenames.size(); i++) {
+		RoadGraph roads;
+		RoadGraphLoader::load(filenames[i], roads);
+		runSuite(QFileInfo(filenames[i]).fileName().toStdString(), roads, filenames[i], min_time, results);
+	}
+
+	for (int num_edges = 10000; num_edges <= max_edges && num_edges <= 10000000; num_edges *= 10) {
+		for (int layout = 0; layout < RoadGraphGenerator::NUM_LAYOUTS; layout++) {
+			RoadGraph roads;
+			RoadGraphGenerator(layout, num_edges).generate(roads);
+			std::ostringstream label;
+			label << RoadGraphGenerator::layoutName(layout) << ":" << num_edges;
+			runSuite(label.str(), roads, "", min_time, results);
+		}
+	}
+
+	if (json_filename.isEmpty()) return;
+
+	if (writeSuiteJSON(json_filename, executable, results)) {
+		std::cout << "  " << results.size() << " results written to " << json_filename.toStdString() << std::endl;
+	}
+	else {
+		std::cout << "  " << json_filename.toStdString() << " cannot be written" << std::endl;
+	}
+}
+
+/**
+* Usage: OSMBench [parse] [planarify] [export] [snapshot] [history] [clone] [compact] [reduce] [polyline] [split] [render] [pan] [raster] [suite] [--no-naive] [--json file.json] [--max-edges n] [--min-time seconds] [file.osm|file.osm.pbf]
+* All the benchmarks except suite are run if none is specified.
+* The suite runs on the specified file, or on all the OSM files of the data directory if none is specified, and on the synthetic grids.
+*/
+int main(int argc, char *argv[]) {
+	QString filename = "../OSMEditor/data/urayasu.osm";
+	bool filename_specified = false;
+	QStringList benchmarks;
+	bool naive = true;
+	QString json_filename;
+	int max_edges = 1000000;
+	double min_time = 0.5;
+
+	for (int i = 1; i < argc; i++) {
+		QString arg = argv[i];
+		if (arg == "--no-naive") {
+			naive = false;
+		}
+		else if (arg == "--json" && i + 1 < argc) {
+			json_filename = argv[++i];
+		}
+		else if (arg == "--max-edges" && i + 1 < argc) {
+			max_edges = atoi(argv[++i]);
+		}
+		else if (arg == "--min-time" && i + 1 < argc) {
+			min_time = atof(argv[++i]);
+		}
+		else if (arg == "parse" || arg == "planarify" || arg == "export" || arg == "snapshot" || arg == "history" || arg == "clone" || arg == "compact" || arg == "reduce" || arg == "polyline" || arg == "split" || arg == "render" || arg == "pan" || arg == "raster" || arg == "suite") {
+			benchmarks.push_back(arg);
+		}
+		else {
+			filename = arg;
+			filename_specified = true;
+		}
+	}
+
+	if (benchmarks.empty() || benchmarks.contains("parse")) {
+		benchParse(filename);
+	}
+	if (benchmarks.empty() || benchmarks.contains("planarify")) {
+		benchPlanarify(filename, naive);
+	}
+	if (benchmarks.empty() || benchmarks.contains("export")) {
+		benchExport(filename);
+	}
+	if (benchmarks.empty() || benchmarks.contains("snapshot")) {
+		benchSnapshot(filename);
+	}
+	if (benchmarks.empty() || benchmarks.contains("history")) {
+		benchHistory(filename);
+	}
+	if (benchmarks.empty() || benchmarks.contains("clone")) {
+		benchClone(filename);
+	}
+	if (benchmarks.empty() || benchmarks.contains("compact")) {
+		benchCompact(filename);
+	}
+	if (benchmarks.empty() || benchmarks.contains("reduce")) {
+		benchReduce(filename, naive);
+	}
+	if (benchmarks.empty() || benchmarks.contains("polyline")) {
+		benchPolyline(filename);
+	}
+	if (benchmarks.empty() || benchmarks.contains("split")) {
+		benchSplitEdge();
+	}
+	if (benchmarks.empty() || benchmarks.contains("render")) {
+		benchRender(filename);
+	}
+	if (benchmarks.empty() || benchmarks.contains("pan")) {
+		benchPan(filename);
+	}
+	if (benchmarks.empty() || benchmarks.contains("raster")) {
+		benchRaster(filename);
+	}
+	// the suite is run only if it is specified, since it takes much longer than the others
+	if (benchmarks.contains("suite")) {
+		QStringList filenames;
+		if (filename_specified) {
+			filenames.push_back(filename);
+		}
+		else {
+			QDir dir = QFileInfo(filename).dir();
+			QStringList names = dir.entryList(QStringList() << "*.osm", QDir::Files, QDir::Name);
+			for (int i = 0; i < names.size(); i++) {
+				filenames.push_back(dir.filePath(names[i]));
+			}
+		}
+		benchSuite(filenames, max_edges, min_time, json_filename, argv[0]);
+	}
+
+	return 0;
+}
@@ -0,0 +1,126 @@
+#include "BufferedWriter.h"
+#include <QByteArray>
+#include <string.h>
+#include <math.h>
+
+namespace {
+	const double POW10[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15 };
+
+	/**
+	* Write the digits of the value backward from the end, and return the pointer to the first digit.
+	*/
+	char* formatDigits(unsigned long long value, char* end) {
+		do {
+			*--end = '0' + (char)(value % 10);
+			value /= 10;
+		} while (value > 0);
+
+		return end;
+	}
+}
+
+BufferedWriter::BufferedWriter(QIODevice* device) {
+	this->device = device;
+	length = 0;
+	failed = false;
+}
+
+BufferedWriter::~BufferedWriter() {
+	flush();
+}
+
+void BufferedWriter::write(const char* str) {
+	write(str, strlen(str));
+}
+
+void BufferedWriter::write(const char* str, int len) {
+	if (length + len > BUFFER_SIZE) {
+		flush();
+		if (len > BUFFER_SIZE) {
+			if (device->write(str, len) != len) failed = true;
+			return;
+		}
+	}
+
+	memcpy(buffer + length, str, len);
+	length += len;
+}
+
+void BufferedWriter::writeInt(unsigned long long value) {
+	char str[24];
+	char* begin = formatDigits(value, str + sizeof(str));
+	write(begin, str + sizeof(str) - begin);
+}
+
+void BufferedWriter::writeDouble(double value) {
+	char str[32];
+	write(str, formatDouble(value, str));
+}
+
+/**
+* Pass the buffered data to the device.
+*
+* @return		false if the device has failed to write any data so far
+*/
+bool BufferedWriter::flush() {
+	if (length > 0) {
+		if (device->write(buffer, length) != length) failed = true;
+		length = 0;
+	}
+
+	return !failed;
+}
+
+/**
+* Format the value in the same way as printf("%.16g"), which QDomElement::setAttribute uses for double values,
+* and return the length of the string.
+* Values in [1, 1e15), which include the longitudes and the latitudes except near zero, are formatted from the exact
+* integer and fractional parts. The others and the ones too close to the rounding boundary fall back to qsnprintf.
+*/
+int BufferedWriter::formatDouble(double value, char* str) {
+	double abs_value = value < 0 ? -value : value;
+	if (abs_value >= 1.0 && abs_value < 1e15) {
+		unsigned long long integer = (unsigned long long)abs_value;
+		double fraction = abs_value - (double)integer;
+
+		int num_integer_digits = 1;
+		for (unsigned long long p = 10; p <= integer; p *= 10) num_integer_digits++;
+		int num_decimals = 16 - num_integer_digits;
+
+		// The rounding error of the scaled fraction is at most half an ulp, which is below 10^num_decimals * 2^-53,
+		// so the rounded digits are exact unless the scaled fraction is that close to the middle of two integers.
+		double scaled = fraction * POW10[num_decimals];
+		double below = floor(scaled);
+		double margin = POW10[num_decimals] * 1.2e-16;
+		if (fabs(scaled - below - 0.5) > margin && below + 1.0 < POW10[num_decimals]) {
+			unsigned long long decimals = (unsigned long long)(scaled - below > 0.5 ? below + 1.0 : below);
+
+			char* p = str;
+			if (value < 0) *p++ = '-';
+
+			char digits[24];
+			char* begin = formatDigits(integer, digits + sizeof(digits));
+			memcpy(p, begin, digits + sizeof(digits) - begin);
+			p += digits + sizeof(digits) - begin;
+
+			if (decimals > 0) {
+				// remove the trailing zeros as %g does
+				while (decimals % 10 == 0) {
+					decimals /= 10;
+					num_decimals--;
+				}
+
+				*p++ = '.';
+				char* end = p + num_decimals;
+				begin = formatDigits(decimals, end);
+				while (begin > p) *--begin = '0';
+				p = end;
+			}
+
+			*p = '\0';
+			return p - str;
+		}
+	}
+
+	return qsnprintf(str, 32, "%.16g", value);
+}
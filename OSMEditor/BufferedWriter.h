@@ -0,0 +1,30 @@
+#pragma once
+
+#include <QIODevice>
+
+/**
+* Writer which formats numbers into a fixed-size buffer and passes it to the device when it is full.
+* The numbers are formatted without QString or QVariant, so writing a large file does not allocate per value.
+* Once the device fails to write, the error is kept and returned by the last flush().
+*/
+class BufferedWriter {
+private:
+	static const int BUFFER_SIZE = 64 * 1024;
+
+	QIODevice* device;
+	char buffer[BUFFER_SIZE];
+	int length;
+	bool failed;
+
+public:
+	BufferedWriter(QIODevice* device);
+	~BufferedWriter();
+
+	void write(const char* str);
+	void write(const char* str, int len);
+	void writeInt(unsigned long long value);
+	void writeDouble(double value);
+	bool flush();
+
+	static int formatDouble(double value, char* str);
+};
@@ -1,6 +1,7 @@
 #include "Canvas.h"
 #include <QPainter>
 #include <iostream>
+#include <algorithm>
 #include <QFileInfoList>
 #include <QDir>
 #include <QMessageBox>
@@ -10,8 +11,14 @@
 #include <QtWidgets/QApplication>
 #include <QDate>
 #include "MainWindow.h"
-#include "OSMRoadsParser.h"
-#include "OSMRoadsExporter.h"
+
+namespace {
+	/** interval in milliseconds at which the progress of the background loading is polled and its new edges are drawn */
+	const int LOAD_POLL_INTERVAL = 100;
+
+	/** interval in milliseconds at which the background saving is polled */
+	const int SAVE_POLL_INTERVAL = 100;
+}
 
 Canvas::Canvas(MainWindow* mainWin) {
 	this->mainWin = mainWin;
@@ -21,11 +28,21 @@ Canvas::Canvas(MainWindow* mainWin) {
 	origin = QPoint(0, 0);// width() * 0.5, height() * 0.5);
 	scale = 0.1;
 
+	// the roads are drawn from the cached tiles, or all of them are drawn directly every frame
+	fastRendering = true;
+	renderer.culling = false;
+	showInstrumentation = false;
+
 	vertex_selected = false;
 	edge_selected = false;
 	edge_point_selected = false;
 	vertex_moved = false;
 	adding_new_edge = false;
+
+	loadTimer = 0;
+	numDrawnLoadedEdges = 0;
+	loadedImageScale = 0.0;
+	saveTimer = 0;
 }
 
 Canvas::~Canvas() {
@@ -35,32 +52,62 @@ void Canvas::clear() {
 	update();
 }
 
-void Canvas::open(const QString& filename) {
-	roads.clear();
+/**
+* Start loading the file on the worker thread of the loader. The roads are kept until the file is loaded,
+* and the edges of the file are drawn instead of them as they are parsed, while the view can be moved but the roads cannot be edited.
+* The progress is polled by the timer, which replaces the roads with the loaded ones when the loader is done.
+*/
+void Canvas::startOpen(const QString& filename) {
 	vertex_selected = false;
 	edge_selected = false;
 	edge_point_selected = false;
+	adding_new_edge = false;
+	setMouseTracking(false);
 
-	OSMRoadsParser parser(&roads);
-	QXmlSimpleReader reader;
-	reader.setContentHandler(&parser);
-	QFile file(filename);
-	QXmlInputSource source(&file);
-	reader.parse(source);
+	loadedEdges.clear();
+	numDrawnLoadedEdges = 0;
+	loadedImage = QImage();
 
-	//roads.reduce();
-	//roads.planarify();
+	loader.start(filename);
+	if (loadTimer == 0) loadTimer = startTimer(LOAD_POLL_INTERVAL);
 
 	update();
 }
 
+/**
+* Cancel the background loading, after which the roads are kept as they were.
+*/
+void Canvas::cancelOpen() {
+	loader.cancel();
+}
+
+/**
+* Start writing the current version of the roads to the file on the worker thread of the saver, while the roads can be edited.
+* Only the chunks of the elements changed since the last version are copied here. The timer reports the result when the file is written.
+*/
 void Canvas::save(const QString& filename) {
-	OSMRoadsExporter::save(filename, roads);
+	if (saver.isSaving()) finishSave();
+
+	saver.start(filename, roads.snapshot());
+	if (saveTimer == 0) saveTimer = startTimer(SAVE_POLL_INTERVAL);
+}
+
+/**
+* Wait for the file being written, and report the result to the main window.
+*/
+void Canvas::finishSave() {
+	if (saveTimer != 0) {
+		killTimer(saveTimer);
+		saveTimer = 0;
+	}
+
+	bool succeeded = saver.finish();
+	mainWin->finishSaving(saver.getFilename(), succeeded);
 }
 
 void Canvas::undo() {
 	try {
-		roads = history.undo();
+		history.undo(roads);
 	}
 	catch (char* ex) {
 	}
@@ -75,7 +122,7 @@ void Canvas::undo() {
 
 void Canvas::redo() {
 	try {
-		roads = history.redo();
+		history.redo(roads);
 	}
 	catch (char* ex) {
 	}
@@ -90,106 +137,101 @@ void Canvas::redo() {
 
 void Canvas::deleteEdge() {
 	if (edge_selected) {
-		history.push(roads);
+		history.begin(roads);
 		roads.deleteEdge(selected_edge_desc);
+		endCommand();
 		edge_selected = false;
 		update();
 	}
 }
 
 void Canvas::planarGraph() {
+	history.begin(roads);
 	roads.planarify();
+	endCommand();
 }
 
 /**
- * Find the closest vertex.
- *
- * @param x		x coordinate in the world coordinate system
- * @param y		y coordinate in the world coordinate system
- */
-bool Canvas::findClosestVertex(const QVector2D& pt, float threshold, RoadVertexDesc& closest_vertex_desc) {
-	float min_dist = std::numeric_limits<float>::max();
-
-	QVector2D screen_pt = worldToScreenCoordinates(pt);
-
-	RoadVertexIter vi, vend;
-	for (boost::tie(vi, vend) = boost::vertices(roads.graph); vi != vend; vi++) {
-		if (!roads.graph[*vi]->valid) continue;
-
-		QVector2D vert_pt = worldToScreenCoordinates(roads.graph[*vi]->pt);
-		float dist = std::hypot(vert_pt.x() - screen_pt.x(), vert_pt.y() - screen_pt.y());
-		if (dist < min_dist) {
-			min_dist = dist;
-			closest_vertex_desc = *vi;
-		}
-	}
+* Remove the invalid vertices and edges from the road graph, and remap the selection.
+* The elements which the history refers to are kept so that all the commands can still be undone.
+*/
+void Canvas::compact() {
+	RoadGraphMapping mapping;
+	history.compact(roads, mapping);
 
-	if (min_dist < threshold) {
-		return true;
+	if (vertex_selected && !mapping.mapVertex(selected_vertex_desc)) {
+		vertex_selected = false;
 	}
-	else {
-		return false;
+	if ((edge_selected || edge_point_selected) && !mapping.mapEdge(selected_edge_desc)) {
+		edge_selected = false;
+		edge_point_selected = false;
 	}
+
+	update();
 }
 
 /**
-* Find the closest vertex.
-*
-* @param x		x coordinate in the world coordinate system
-* @param y		y coordinate in the world coordinate system
+* Finish the command of the current operation, and compact the road graph if it has too many invalid elements.
 */
-bool Canvas::findClosestVertexExcept(const QVector2D& pt, float threshold, RoadVertexDesc except_vertex, RoadVertexDesc& closest_vertex_desc) {
-	float min_dist = std::numeric_limits<float>::max();
-
-	QVector2D screen_pt = worldToScreenCoordinates(pt);
-
-	RoadVertexIter vi, vend;
-	for (boost::tie(vi, vend) = boost::vertices(roads.graph); vi != vend; vi++) {
-		if (!roads.graph[*vi]->valid || *vi == except_vertex) continue;
-
-		QVector2D vert_pt = worldToScreenCoordinates(roads.graph[*vi]->pt);
-		float dist = std::hypot(vert_pt.x() - screen_pt.x(), vert_pt.y() - screen_pt.y());
-		if (dist < min_dist) {
-			min_dist = dist;
-			closest_vertex_desc = *vi;
-		}
-	}
+void Canvas::endCommand() {
+	history.end(roads);
+	if (roads.needsCompaction()) compact();
+}
 
-	if (min_dist < threshold) {
-		return true;
+/**
+* Replace the attributes of the edge, which is shown in the property window.
+* The edge is looked up by its object because the selection may have changed since it was shown.
+*/
+void Canvas::updateEdge(RoadEdgePtr edge, const RoadEdge& new_edge) {
+	RoadEdgeDesc edge_desc;
+	bool found = false;
+	if ((edge_selected || edge_point_selected) && roads.graph[selected_edge_desc] == edge) {
+		edge_desc = selected_edge_desc;
+		found = true;
 	}
 	else {
-		return false;
+		RoadEdgeIter ei, eend;
+		for (boost::tie(ei, eend) = boost::edges(roads.graph); ei != eend; ++ei) {
+			if (roads.graph[*ei] == edge) {
+				edge_desc = *ei;
+				found = true;
+				break;
+			}
+		}
 	}
-}
+	if (!found) return;
 
-bool Canvas::findClosestEdgePoint(const QVector2D& pt, float threshold, RoadEdgeDesc& closest_edge_desc, int& closest_edge_point) {
-	float min_dist = std::numeric_limits<float>::max();
-
-	QVector2D screen_pt = worldToScreenCoordinates(pt);
+	history.begin(roads);
+	roads.setEdge(edge_desc, new_edge);
+	endCommand();
 
-	RoadEdgeIter ei, eend;
-	for (boost::tie(ei, eend) = boost::edges(roads.graph); ei != eend; ei++) {
-		if (!roads.graph[*ei]->valid) continue;
+	update();
+}
 
-		for (int i = 0; i < roads.graph[*ei]->polyline.size() - 1; i++) {
-			QVector2D p = worldToScreenCoordinates(roads.graph[*ei]->polyline[i]);
-			double dist = (p - screen_pt).length();
-			if (dist < min_dist) {
-				min_dist = dist;
-				closest_edge_desc = *ei;
-				closest_edge_point = i;
-			}
-		}
-	}
+/**
+ * Find the closest vertex.
+ *
+ * @param pt			coordinates in the world coordinate system
+ * @param threshold		distance threshold in the screen coordinate system
+ */
+bool Canvas::findClosestVertex(const QVector2D& pt, float threshold, RoadVertexDesc& closest_vertex_desc) {
+	return roads.findClosestVertex(pt, threshold / scale, closest_vertex_desc);
+}
 
-	if (min_dist < threshold) {
-		return true;
-	}
-	else {
-		return false;
-	}
+/**
+* Find the closest vertex except the specified one.
+*
+* @param pt			coordinates in the world coordinate system
+* @param threshold		distance threshold in the screen coordinate system
+*/
+bool Canvas::findClosestVertexExcept(const QVector2D& pt, float threshold, RoadVertexDesc except_vertex, RoadVertexDesc& closest_vertex_desc) {
+	return roads.findClosestVertex(pt, threshold / scale, closest_vertex_desc, [&](RoadVertexDesc v) {
+		return v == except_vertex;
+	});
+}
 
+bool Canvas::findClosestEdgePoint(const QVector2D& pt, float threshold, RoadEdgeDesc& closest_edge_desc, int& closest_edge_point) {
+	return roads.findClosestEdgePoint(pt, threshold / scale, closest_edge_desc, closest_edge_point);
 }
 
 /**
@@ -198,31 +240,8 @@ bool Canvas::findClosestEdgePoint(const QVector2D& pt, float threshold, RoadEdge
 * @param pt		coordinates in the world coordinate system
 */
 bool Canvas::findClosestEdge(const QVector2D& pt, float threshold, RoadEdgeDesc& closest_edge_desc) {
-	float min_dist = std::numeric_limits<float>::max();
-
-	QVector2D screen_pt = worldToScreenCoordinates(pt);
-
-	RoadEdgeIter ei, eend;
-	for (boost::tie(ei, eend) = boost::edges(roads.graph); ei != eend; ei++) {
-		if (!roads.graph[*ei]->valid) continue;
-
-		for (int i = 0; i < roads.graph[*ei]->polyline.size() - 1; i++) {
-			QVector2D p0 = worldToScreenCoordinates(roads.graph[*ei]->polyline[i]);
-			QVector2D p1 = worldToScreenCoordinates(roads.graph[*ei]->polyline[i + 1]);
-			double dist = RoadGraph::pointSegmentDistance(p0, p1, screen_pt);
-			if (dist < min_dist) {
-				min_dist = dist;
-				closest_edge_desc = *ei;
-			}
-		}
-	}
-
-	if (min_dist < threshold) {
-		return true;
-	}
-	else {
-		return false;
-	}
+	QVector2D closest_pt;
+	return roads.findClosestEdge(pt, threshold / scale, closest_edge_desc, closest_pt);
 }
 
 /**
@@ -232,67 +251,16 @@ bool Canvas::findClosestEdge(const QVector2D& pt, float threshold, RoadEdgeDesc&
 * @param closest_pt		coordinates of the closest point in the world coordinate system
 */
 bool Canvas::findClosestEdge(const QVector2D& pt, float threshold, RoadEdgeDesc& closest_edge_desc, QVector2D& closest_pt) {
-	float min_dist = std::numeric_limits<float>::max();
-
-	QVector2D screen_pt = worldToScreenCoordinates(pt);
-
-	RoadEdgeIter ei, eend;
-	for (boost::tie(ei, eend) = boost::edges(roads.graph); ei != eend; ei++) {
-		if (!roads.graph[*ei]->valid) continue;
-
-		for (int i = 0; i < roads.graph[*ei]->polyline.size() - 1; i++) {
-			QVector2D p0 = worldToScreenCoordinates(roads.graph[*ei]->polyline[i]);
-			QVector2D p1 = worldToScreenCoordinates(roads.graph[*ei]->polyline[i + 1]);
-			QVector2D p2;
-			double dist = RoadGraph::pointSegmentDistance(p0, p1, screen_pt, p2);
-			if (dist < min_dist) {
-				min_dist = dist;
-				closest_edge_desc = *ei;
-				closest_pt = screenToWorldCoordinates(p2);
-			}
-		}
-	}
-
-	if (min_dist < threshold) {
-		return true;
-	}
-	else {
-		return false;
-	}
+	return roads.findClosestEdge(pt, threshold / scale, closest_edge_desc, closest_pt);
 }
 
+/**
+* Find the closest edge except the ones connected to the specified vertex.
+*/
 bool Canvas::findClosestEdgeExcept(const QVector2D& pt, float threshold, RoadVertexDesc except_vertex, RoadEdgeDesc& closest_edge_desc, QVector2D& closest_pt) {
-	float min_dist = std::numeric_limits<float>::max();
-
-	QVector2D screen_pt = worldToScreenCoordinates(pt);
-
-	RoadEdgeIter ei, eend;
-	for (boost::tie(ei, eend) = boost::edges(roads.graph); ei != eend; ei++) {
-		if (!roads.graph[*ei]->valid) continue;
-
-		RoadVertexDesc src = boost::source(*ei, roads.graph);
-		RoadVertexDesc tgt = boost::target(*ei, roads.graph);
-		if (except_vertex == src || except_vertex == tgt) continue;
-
-		for (int i = 0; i < roads.graph[*ei]->polyline.size() - 1; i++) {
-			QVector2D p0 = worldToScreenCoordinates(roads.graph[*ei]->polyline[i]);
-			QVector2D p1 = worldToScreenCoordinates(roads.graph[*ei]->polyline[i + 1]);
-			QVector2D p2;
-			double dist = RoadGraph::pointSegmentDistance(p0, p1, screen_pt, p2);
-			if (dist < min_dist) {
-				min_dist = dist;
-				closest_edge_desc = *ei;
-				closest_pt = screenToWorldCoordinates(p2);
-			}
-		}
-	}
-
-	if (min_dist < threshold) {
-		return true;
-	}
-	else {
-		return false;
-	}
+	return roads.findClosestEdge(pt, threshold / scale, closest_edge_desc, closest_pt, [&](RoadEdgeDesc e) {
+		return boost::source(e, roads.graph) == except_vertex || boost::target(e, roads.graph) == except_vertex;
+	});
 }
 
 QVector2D Canvas::screenToWorldCoordinates(const QVector2D& p) {
@@ -308,27 +276,21 @@ QVector2D Canvas::worldToScreenCoordinates(const QVector2D& p) {
 }
 
 void Canvas::paintEvent(QPaintEvent *e) {
+	ScopedTimer timer(Instrumentation::TIMER_PAINT);
 	QPainter painter(this);
 	painter.fillRect(0, 0, width(), height(), QColor(255, 255, 255));
 
-	// draw road edges
-	painter.setPen(QPen(QColor(128, 128, 255), 1));
-	painter.setBrush(QColor(128, 128, 255));
-	RoadEdgeIter ei, eend;
-	for (boost::tie(ei, eend) = boost::edges(roads.graph); ei != eend; ei++) {
-		if (!roads.graph[*ei]->valid) continue;
-
-		QPolygonF polygon;
-		for (int i = 0; i < roads.graph[*ei]->polyline.size(); i++) {
-			QVector2D pt = worldToScreenCoordinates(roads.graph[*ei]->polyline[i]);
-			polygon.push_back(QPointF(pt.x(), pt.y()));
-		}
-		painter.drawPolyline(polygon);
-
-		for (int i = 1; i < roads.graph[*ei]->polyline.size() - 1; i++) {
-			QVector2D pt = worldToScreenCoordinates(roads.graph[*ei]->polyline[i]);
-			painter.drawEllipse(pt.x() - 1, pt.y() - 1, 3, 3);
-		}
+	// draw road edges and vertices, over which the selection and the adding edge are drawn
+	if (isLoading()) {
+		drawLoadedEdges(painter);
+	}
+	else if (fastRendering) {
+		tiles.draw(painter, roads, origin, scale, width(), height());
+	}
+	else {
+		renderer.setView(roads, origin, scale, width(), height());
+		renderer.drawEdges(painter);
+		renderer.drawVertices(painter);
 	}
 
 	// draw selected edge
@@ -357,17 +319,6 @@ void Canvas::paintEvent(QPaintEvent *e) {
 		painter.drawEllipse(pt.x() - 2, pt.y() - 2, 5, 5);
 	}
 
-	// draw road vertices
-	painter.setPen(QPen(QColor(192, 192, 192), 1));
-	painter.setBrush(QBrush(QColor(255, 255, 255)));
-	RoadVertexIter vi, vend;
-	for (boost::tie(vi, vend) = boost::vertices(roads.graph); vi != vend; vi++) {
-		if (!roads.graph[*vi]->valid) continue;
-
-		QVector2D pt = worldToScreenCoordinates(roads.graph[*vi]->pt);
-		painter.drawEllipse(pt.x() - 2, pt.y() - 2, 5, 5);
-	}
-
 	// draw selected vertex
 	if (vertex_selected) {
 		painter.setPen(QPen(QColor(0, 0, 0), 3));
@@ -394,12 +345,98 @@ void Canvas::paintEvent(QPaintEvent *e) {
 			painter.drawEllipse(pt.x() - 2, pt.y() - 2, 5, 5);
 		}
 	}
+
+	if (showInstrumentation) {
+		drawInstrumentation(painter);
+	}
+}
+
+/**
+* Draw the edges of the file being loaded, as thin lines in the colors of the road classes.
+* They are drawn into the image, which keeps the edges drawn so far unless the view changes, so that only the new edges are drawn each time.
+*/
+void Canvas::drawLoadedEdges(QPainter& painter) {
+	if (loadedImage.size() != size() || loadedImageOrigin != origin || loadedImageScale != scale) {
+		loadedImage = QImage(size(), QImage::Format_ARGB32_Premultiplied);
+		loadedImage.fill(Qt::transparent);
+		loadedImageOrigin = origin;
+		loadedImageScale = scale;
+		numDrawnLoadedEdges = 0;
+	}
+
+	RoadRenderer::ClassStyle styles[RoadRenderer::NUM_CLASSES];
+	RoadRenderer::getStyles(roads, styles);
+
+	QPainterPath paths[RoadRenderer::NUM_CLASSES];
+	for (; numDrawnLoadedEdges < loadedEdges.size(); numDrawnLoadedEdges++) {
+		const RoadEdgePtr& edge = loadedEdges[numDrawnLoadedEdges];
+		int c = RoadRenderer::getClass(edge->type);
+		if (!styles[c].shown || edge->polyline.empty()) continue;
+
+		QVector2D pt = worldToScreenCoordinates(edge->polyline[0]);
+		paths[c].moveTo(pt.x(), pt.y());
+		for (int i = 1; i < edge->polyline.size(); i++) {
+			pt = worldToScreenCoordinates(edge->polyline[i]);
+			paths[c].lineTo(pt.x(), pt.y());
+		}
+	}
+
+	QPainter image_painter(&loadedImage);
+	for (int c = 0; c < RoadRenderer::NUM_CLASSES; c++) {
+		if (paths[c].isEmpty()) continue;
+
+		image_painter.setPen(QPen(styles[c].color, 1));
+		image_painter.drawPath(paths[c]);
+	}
+	image_painter.end();
+
+	painter.drawImage(0, 0, loadedImage);
+}
+
+/**
+* Draw the overlay of the instrumentation at the top left corner: the frame time, the latency of the hit tests,
+* the polyline allocations, and the time of the other timers which have been called, since the overlay was shown.
+* The frame time is up to the previous frame, since this frame is still being painted.
+*/
+void Canvas::drawInstrumentation(QPainter& painter) {
+	auto format = [](const QString& name, const Instrumentation::TimerStats& stats) {
+		return QString("%1: last %2 ms, avg %3 ms, max %4 ms (%5 calls)").arg(name).arg(stats.lastNsecs * 1e-6, 0, 'f', 3)
+			.arg(stats.calls > 0 ? stats.totalNsecs * 1e-6 / stats.calls : 0.0, 0, 'f', 3).arg(stats.maxNsecs * 1e-6, 0, 'f', 3).arg(stats.calls);
+	};
+
+	QStringList lines;
+	lines.push_back(format("frame", Instrumentation::timerStats(Instrumentation::TIMER_PAINT)));
+	lines.push_back(format(Instrumentation::timerName(Instrumentation::TIMER_FIND), Instrumentation::timerStats(Instrumentation::TIMER_FIND)));
+	lines.push_back(QString("%1: %2").arg(Instrumentation::counterName(Instrumentation::POLYLINE_ALLOCATIONS)).arg(Instrumentation::counter(Instrumentation::POLYLINE_ALLOCATIONS)));
+	for (int i = 0; i < Instrumentation::NUM_TIMERS; i++) {
+		if (i == Instrumentation::TIMER_PAINT || i == Instrumentation::TIMER_FIND) continue;
+
+		Instrumentation::TimerStats stats = Instrumentation::timerStats(i);
+		if (stats.calls > 0) lines.push_back(format(Instrumentation::timerName(i), stats));
+	}
+
+	int line_height = painter.fontMetrics().height();
+	int max_width = 0;
+	for (int i = 0; i < lines.size(); i++) {
+		max_width = std::max(max_width, painter.fontMetrics().width(lines[i]));
+	}
+	painter.fillRect(8, 8, max_width + 8, line_height * lines.size() + 8, QColor(255, 255, 255, 224));
+	painter.setPen(QColor(0, 0, 0));
+	for (int i = 0; i < lines.size(); i++) {
+		painter.drawText(12, 12 + line_height * i + painter.fontMetrics().ascent(), lines[i]);
+	}
 }
 
 void Canvas::mousePressEvent(QMouseEvent* e) {
 	// This is necessary to get key event occured even after the user selects a menu.
 	setFocus();
 
+	// nothing can be selected while a file is being loaded, but the camera can be moved
+	if (isLoading()) {
+		prev_mouse_pt = e->pos();
+		return;
+	}
+
 	if (e->buttons() & Qt::LeftButton) {
 		vertex_moved = false;
 		vertex_selected = false;
@@ -422,7 +459,9 @@ void Canvas::mousePressEvent(QMouseEvent* e) {
 			// hit test against the vertices
 			if (findClosestVertex(pt, 10, selected_vertex_desc)) {
 				vertex_selected = true;
-				history.push(roads);
+
+				// record the changes until the mouse is released, which are nothing if the vertex is not moved
+				history.begin(roads);
 			}
 			else if (findClosestEdgePoint(pt, 9, selected_edge_desc, selected_edge_point)) {
 				edge_point_selected = true;
@@ -475,11 +514,7 @@ void Canvas::mouseMoveEvent(QMouseEvent* e) {
 void Canvas::mouseReleaseEvent(QMouseEvent* e) {
 	if (e->button() == Qt::LeftButton) {
 		if (vertex_selected) {
-			if (!vertex_moved) {
-				// if the currently selected vertex was not moved at all, cancel backuping the current state of roads
-				history.undo();
-			}
-			else {
+			if (vertex_moved) {
 				QVector2D pt = screenToWorldCoordinates(e->x(), e->y());
 
 				// merge the snapped vertex to the closest one if that exists.
@@ -506,6 +541,8 @@ void Canvas::mouseReleaseEvent(QMouseEvent* e) {
 
 				update();
 			}
+
+			endCommand();
 		}
 	}
 }
@@ -519,15 +556,17 @@ void Canvas::mouseDoubleClickEvent(QMouseEvent* e) {
 			QVector2D closest_pt;
 
 			if (findClosestEdge(new_edge[0], 10, closest_edge_desc, closest_pt)) {
-				history.push(roads);
+				history.begin(roads);
 
 				// add a vertex on the edge
 				selected_vertex_desc = roads.splitEdge(closest_edge_desc, closest_pt);
 				vertex_selected = true;
+
+				endCommand();
 			}
 		}
 		else if (new_edge.size() >= 2) {
-			history.push(roads);
+			history.begin(roads);
 
 			// add the new edge
 			for (int i = 0; i < new_edge.size() - 1; i++) {
@@ -540,9 +579,7 @@ void Canvas::mouseDoubleClickEvent(QMouseEvent* e) {
 					src = roads.splitEdge(closest_edge_desc, closest_pt);
 				}
 				else {
-					RoadVertexPtr v = RoadVertexPtr(new RoadVertex(new_edge[i]));
-					src = boost::add_vertex(roads.graph);
-					roads.graph[src] = v;
+					src = roads.addVertex(new_edge[i]);
 				}
 
 				RoadVertexDesc tgt;
@@ -552,15 +589,15 @@ void Canvas::mouseDoubleClickEvent(QMouseEvent* e) {
 					tgt = roads.splitEdge(closest_edge_desc, closest_pt);
 				}
 				else {
-					RoadVertexPtr v = RoadVertexPtr(new RoadVertex(new_edge[i + 1]));
-					tgt = boost::add_vertex(roads.graph);
-					roads.graph[tgt] = v;
+					tgt = roads.addVertex(new_edge[i + 1]);
 				}
 
-				std::pair<RoadEdgeDesc, bool> edge_pair = boost::add_edge(src, tgt, roads.graph);
-				roads.graph[edge_pair.first] = RoadEdgePtr(new RoadEdge(RoadEdge::TYPE_STREET, 1));
-				roads.graph[edge_pair.first]->polyline = { roads.graph[src]->pt, roads.graph[tgt]->pt };
+				RoadEdgePtr edge = RoadEdgePtr(new RoadEdge(RoadEdge::TYPE_STREET, 1));
+				edge->polyline = { roads.graph[src]->pt, roads.graph[tgt]->pt };
+				roads.addEdge(src, tgt, edge);
 			}
+
+			endCommand();
 		}
 
 		adding_new_edge = false;
@@ -589,6 +626,40 @@ void Canvas::resizeEvent(QResizeEvent *e) {
 	origin.setY(e->size().height() * 0.5 + p.y() * scale);
 }
 
+/**
+* Take the new edges of the file being loaded and report the progress, and replace the roads when the loader is done.
+*/
+void Canvas::timerEvent(QTimerEvent* e) {
+	if (e->timerId() == saveTimer) {
+		if (saver.isDone()) finishSave();
+		return;
+	}
+	if (e->timerId() != loadTimer) {
+		QWidget::timerEvent(e);
+		return;
+	}
+
+	loader.takeEdges(loadedEdges);
+	mainWin->showLoadingProgress(loader.bytesConsumed(), loader.bytesTotal());
+
+	if (loader.isDone()) {
+		killTimer(loadTimer);
+		loadTimer = 0;
+
+		int result = loader.finish(roads);
+		if (result == RoadGraphLoader::RESULT_LOADED) {
+			history.clear(roads);
+		}
+
+		std::vector<RoadEdgePtr>().swap(loadedEdges);
+		loadedImage = QImage();
+
+		mainWin->finishLoading(loader.getFilename(), result);
+	}
+
+	update();
+}
+
 void Canvas::keyPressEvent(QKeyEvent* e) {
 	ctrlPressed = false;
 	shiftPressed = false;
@@ -603,6 +674,7 @@ void Canvas::keyPressEvent(QKeyEvent* e) {
 	switch (e->key()) {
 	case Qt::Key_Escape:
 		adding_new_edge = false;
+		if (isLoading()) cancelOpen();
 		break;
 	}
 
@@ -3,9 +3,14 @@
 
 #include <QWidget>
 #include <QKeyEvent>
+#include <QImage>
 #include <boost/shared_ptr.hpp>
 #include "RoadGraph.h"
 #include "History.h"
+#include "RoadRenderer.h"
+#include "RoadTileCache.h"
+#include "RoadGraphLoader.h"
+#include "RoadGraphSaver.h"
 
 class MainWindow;
 
@@ -18,6 +23,10 @@ public:
 	bool shiftPressed;
 	RoadGraph roads;
 	History history;
+	bool fastRendering;
+	bool showInstrumentation;
+	RoadRenderer renderer;
+	RoadTileCache tiles;
 
 	QPointF prev_mouse_pt;
 	QPointF origin;
@@ -33,17 +42,38 @@ public:
 	bool adding_new_edge;
 	std::vector<QVector2D> new_edge;
 
+	// file being loaded in the background, whose edges are drawn into the image as they arrive instead of the roads,
+	// and the view of the image, which is drawn again if the view changes
+	RoadGraphLoader loader;
+	int loadTimer;
+	std::vector<RoadEdgePtr> loadedEdges;
+	int numDrawnLoadedEdges;
+	QImage loadedImage;
+	QPointF loadedImageOrigin;
+	double loadedImageScale;
+
+	// file being written in the background from a version of the roads, which can be edited meanwhile
+	RoadGraphSaver saver;
+	int saveTimer;
+
 public:
 	Canvas(MainWindow* mainWin);
 	~Canvas();
 
 	void clear();
-	void open(const QString& filename);
+	void startOpen(const QString& filename);
+	void cancelOpen();
+	bool isLoading() const { return loader.isLoading(); }
 	void save(const QString& filename);
+	void finishSave();
+	bool isSaving() const { return saver.isSaving(); }
 	void undo();
 	void redo();
 	void deleteEdge();
 	void planarGraph();
+	void compact();
+	void endCommand();
+	void updateEdge(RoadEdgePtr edge, const RoadEdge& new_edge);
 	bool findClosestVertex(const QVector2D& pt, float threshold, RoadVertexDesc& closest_vertex_desc);
 	bool findClosestVertexExcept(const QVector2D& pt, float threshold, RoadVertexDesc except_vertex, RoadVertexDesc& closest_vertex_desc);
 	bool findClosestEdgePoint(const QVector2D& pt, float threshold, RoadEdgeDesc& closest_edge_desc, int& closest_edge_point);
@@ -53,6 +83,8 @@ public:
 	QVector2D screenToWorldCoordinates(const QVector2D& p);
 	QVector2D screenToWorldCoordinates(double x, double y);
 	QVector2D worldToScreenCoordinates(const QVector2D& p);
+	void drawInstrumentation(QPainter& painter);
+	void drawLoadedEdges(QPainter& painter);
 
 protected:
 	void paintEvent(QPaintEvent* e);
@@ -62,6 +94,7 @@ protected:
 	void mouseDoubleClickEvent(QMouseEvent* e);
 	void wheelEvent(QWheelEvent* e);
 	void resizeEvent(QResizeEvent *e);
+	void timerEvent(QTimerEvent* e);
 
 public:
 	void keyPressEvent(QKeyEvent* e);
@@ -1,29 +1,290 @@
 #include "History.h"
 
-History::History() {
+/**
+* Record the vertex unless it has already been recorded.
+*
+* @param added		true if the vertex has just been added
+*/
+void HistoryCommand::recordVertex(RoadGraph& roads, RoadVertexDesc v, bool added) {
+	if (vertexIndices.find(v) != vertexIndices.end()) return;
+	vertexIndices[v] = vertices.size();
+
+	VertexRecord record;
+	record.desc = v;
+	record.added = added;
+	record.validAfter = true;
+	if (!added) record.before = *roads.graph[v];
+	vertices.push_back(record);
+}
+
+/**
+* Record the edge unless it has already been recorded.
+*
+* @param added		true if the edge has just been added
+*/
+void HistoryCommand::recordEdge(RoadGraph& roads, RoadEdgeDesc e, bool added) {
+	RoadEdge* edge = roads.graph[e].get();
+	if (edgeIndices.find(edge) != edgeIndices.end()) return;
+	edgeIndices[edge] = edges.size();
+
+	EdgeRecord record;
+	record.desc = e;
+	record.added = added;
+	record.validAfter = true;
+	if (!added) record.before = RoadEdgePtr(new RoadEdge(*edge));
+	edges.push_back(record);
+}
+
+/**
+* Keep the current state of the recorded elements, and stop recording.
+* The state after the command is needed only for the elements which existed before it,
+* because the added ones are left as they are by undo except for their validity.
+*/
+void HistoryCommand::finish(RoadGraph& roads) {
+	for (int i = 0; i < vertices.size(); i++) {
+		if (vertices[i].added) {
+			vertices[i].validAfter = roads.graph[vertices[i].desc]->valid;
+		}
+		else {
+			vertices[i].after = *roads.graph[vertices[i].desc];
+		}
+	}
+
+	for (int i = 0; i < edges.size(); i++) {
+		if (edges[i].added) {
+			edges[i].validAfter = roads.graph[edges[i].desc]->valid;
+		}
+		else {
+			edges[i].after = RoadEdgePtr(new RoadEdge(*roads.graph[edges[i].desc]));
+		}
+	}
+
+	vertexIndices.clear();
+	edgeIndices.clear();
+}
+
+/**
+* Restore the recorded elements to their state before the command, and invalidate the added ones.
+*/
+void HistoryCommand::undo(RoadGraph& roads) {
+	for (int i = edges.size() - 1; i >= 0; i--) {
+		if (edges[i].added) {
+			if (roads.graph[edges[i].desc]->valid) roads.invalidateEdge(edges[i].desc);
+		}
+		else {
+			roads.setEdge(edges[i].desc, *edges[i].before);
+		}
+	}
+
+	for (int i = vertices.size() - 1; i >= 0; i--) {
+		if (vertices[i].added) {
+			if (roads.graph[vertices[i].desc]->valid) roads.invalidateVertex(vertices[i].desc);
+		}
+		else {
+			roads.setVertex(vertices[i].desc, vertices[i].before);
+		}
+	}
+}
+
+/**
+* Restore the recorded elements to their state after the command.
+*/
+void HistoryCommand::redo(RoadGraph& roads) {
+	for (int i = 0; i < vertices.size(); i++) {
+		if (vertices[i].added) {
+			RoadVertex vertex = *roads.graph[vertices[i].desc];
+			vertex.valid = vertices[i].validAfter;
+			roads.setVertex(vertices[i].desc, vertex);
+		}
+		else {
+			roads.setVertex(vertices[i].desc, vertices[i].after);
+		}
+	}
+
+	for (int i = 0; i < edges.size(); i++) {
+		if (edges[i].added) {
+			RoadEdge edge = *roads.graph[edges[i].desc];
+			edge.valid = edges[i].validAfter;
+			roads.setEdge(edges[i].desc, edge);
+		}
+		else {
+			roads.setEdge(edges[i].desc, *edges[i].after);
+		}
+	}
+}
+
+bool HistoryCommand::empty() const {
+	return vertices.empty() && edges.empty();
+}
+
+/**
+* Return the approximate number of bytes used by the records and the copied polylines.
+*/
+size_t HistoryCommand::memoryUsage() const {
+	size_t size = sizeof(HistoryCommand) + vertices.capacity() * sizeof(VertexRecord) + edges.capacity() * sizeof(EdgeRecord);
+	for (int i = 0; i < edges.size(); i++) {
+		if (edges[i].before) size += sizeof(RoadEdge) + edges[i].before->polyline.capacity() * sizeof(QVector2D);
+		if (edges[i].after) size += sizeof(RoadEdge) + edges[i].after->polyline.capacity() * sizeof(QVector2D);
+	}
+	return size;
+}
+
+/**
+* Mark the vertices and the edges which this command refers to.
+*/
+void HistoryCommand::collectReferences(std::vector<bool>& referenced_vertices, std::unordered_set<const void*>& referenced_edges) {
+	for (int i = 0; i < vertices.size(); i++) {
+		referenced_vertices[vertices[i].desc] = true;
+	}
+	for (int i = 0; i < edges.size(); i++) {
+		referenced_edges.insert(edges[i].desc.get_property());
+	}
+}
+
+/**
+* Replace the descriptors with the new ones after the road graph has been compacted.
+*/
+void HistoryCommand::remap(const RoadGraphMapping& mapping) {
+	for (int i = 0; i < vertices.size(); i++) {
+		mapping.mapVertex(vertices[i].desc);
+	}
+	for (int i = 0; i < edges.size(); i++) {
+		mapping.mapEdge(edges[i].desc);
+	}
+}
+
+History::History(size_t memoryBudget) {
 	index = 0;
+	this->memoryBudget = memoryBudget;
+	totalMemory = 0;
 }
 
-void History::push(RoadGraph roads) {
-	// remove the index-th element and their after
-	history.resize(index);
+/**
+* Discard all the commands. This has to be called whenever the road graph is replaced.
+*/
+void History::clear(RoadGraph& roads) {
+	if (current) {
+		roads.command = NULL;
+		current.reset();
+	}
 
-	// add history
-	history.push_back(roads.clone());
-	index++;
+	commands.clear();
+	index = 0;
+	totalMemory = 0;
+	roads.releaseRetainedInvalid();
 }
 
-RoadGraph History::undo() {
+/**
+* Start recording the changes of the road graph as a new command.
+* The command which is still recording is finished first.
+*/
+void History::begin(RoadGraph& roads) {
+	if (current) end(roads);
+
+	current = HistoryCommandPtr(new HistoryCommand());
+	roads.command = current.get();
+}
+
+/**
+* Finish recording the command, and add it to the history unless nothing has changed.
+* The commands which have been undone are discarded.
+*/
+void History::end(RoadGraph& roads) {
+	if (!current) return;
+	ScopedTimer timer(Instrumentation::TIMER_HISTORY_PUSH);
+
+	roads.command = NULL;
+	current->finish(roads);
+
+	if (!current->empty()) {
+		// remove the index-th command and their after
+		while (commands.size() > index) {
+			totalMemory -= commands.back()->memoryUsage();
+			commands.pop_back();
+		}
+
+		// add history
+		commands.push_back(current);
+		totalMemory += current->memoryUsage();
+		index++;
+
+		discardOldCommands(roads);
+	}
+
+	current.reset();
+}
+
+void History::undo(RoadGraph& roads) {
+	ScopedTimer timer(Instrumentation::TIMER_UNDO);
+	if (current) end(roads);
 	if (index <= 0) throw "No history.";
 
-	// return the previous state
-	return history[--index].clone();
+	// revert the previous command
+	commands[--index]->undo(roads);
+}
+
+void History::redo(RoadGraph& roads) {
+	ScopedTimer timer(Instrumentation::TIMER_REDO);
+	if (current) end(roads);
+	if (index >= commands.size()) throw "No history.";
+
+	// apply the next command again
+	commands[index++]->redo(roads);
+}
+
+void History::setMemoryBudget(RoadGraph& roads, size_t memoryBudget) {
+	this->memoryBudget = memoryBudget;
+	discardOldCommands(roads);
+}
+
+/**
+* Return the approximate number of bytes used by all the commands.
+*/
+size_t History::memoryUsage() const {
+	return totalMemory;
+}
+
+int History::numCommands() const {
+	return commands.size();
 }
 
-RoadGraph History::redo() {
-	if (index >= history.size() - 1) throw "No history.";
+/**
+* Compact the road graph while keeping the vertices and edges which the commands refer to,
+* and remap the descriptors of the commands. The command which is still recording is finished first.
+*
+* @param mapping	the new descriptors, which the caller uses to remap the descriptors it holds
+* @return			the number of removed vertices and edges
+*/
+int History::compact(RoadGraph& roads, RoadGraphMapping& mapping) {
+	if (current) end(roads);
+
+	std::vector<bool> referenced_vertices(boost::num_vertices(roads.graph), false);
+	std::unordered_set<const void*> referenced_edges;
+	for (int i = 0; i < commands.size(); i++) {
+		commands[i]->collectReferences(referenced_vertices, referenced_edges);
+	}
+
+	int num_removed = roads.compact(mapping, referenced_vertices, referenced_edges);
 
-	// return the next state
-	return history[++index].clone();
+	for (int i = 0; i < commands.size(); i++) {
+		commands[i]->remap(mapping);
+	}
+
+	return num_removed;
 }
 
+/**
+* Discard the oldest commands while the total memory exceeds the budget.
+* The latest command is always kept so that the last operation can be undone.
+* The invalid elements which the discarded commands kept through the last compaction become garbage again.
+*/
+void History::discardOldCommands(RoadGraph& roads) {
+	if (totalMemory <= memoryBudget || commands.size() <= 1 || index <= 1) return;
+
+	while (totalMemory > memoryBudget && commands.size() > 1 && index > 1) {
+		totalMemory -= commands.front()->memoryUsage();
+		commands.pop_front();
+		index--;
+	}
+	roads.releaseRetainedInvalid();
+}
@@ -1,18 +1,90 @@
 #pragma once
 
 #include <vector>
+#include <deque>
+#include <unordered_map>
+#include <unordered_set>
+#include <boost/shared_ptr.hpp>
 #include "RoadGraph.h"
 
+/**
+* Changes of the road graph made by one editing operation.
+* While the command is recording, RoadGraph passes each vertex and edge to it before changing it or right after
+* adding it, and the command keeps the state of the first time it sees each element. When the recording is finished,
+* the current state of the changed elements is kept as well, so that undo and redo only touch the recorded elements.
+* Added elements are invalidated by undo and validated again by redo instead of being removed, so that all the
+* descriptors in the history remain valid.
+*/
+class HistoryCommand {
+private:
+	struct VertexRecord {
+		RoadVertexDesc desc;
+		bool added;
+		bool validAfter;
+		RoadVertex before;
+		RoadVertex after;
+	};
+
+	struct EdgeRecord {
+		RoadEdgeDesc desc;
+		bool added;
+		bool validAfter;
+		RoadEdgePtr before;
+		RoadEdgePtr after;
+	};
+
+	std::vector<VertexRecord> vertices;
+	std::vector<EdgeRecord> edges;
+
+	// recorded elements, which are used only while recording
+	std::unordered_map<RoadVertexDesc, int> vertexIndices;
+	std::unordered_map<RoadEdge*, int> edgeIndices;
+
+public:
+	void recordVertex(RoadGraph& roads, RoadVertexDesc v, bool added);
+	void recordEdge(RoadGraph& roads, RoadEdgeDesc e, bool added);
+	void finish(RoadGraph& roads);
+	void undo(RoadGraph& roads);
+	void redo(RoadGraph& roads);
+	bool empty() const;
+	size_t memoryUsage() const;
+	void collectReferences(std::vector<bool>& referenced_vertices, std::unordered_set<const void*>& referenced_edges);
+	void remap(const RoadGraphMapping& mapping);
+};
+
+typedef boost::shared_ptr<HistoryCommand> HistoryCommandPtr;
+
+/**
+* Undo/redo history which consists of the commands of the editing operations.
+* The oldest commands are discarded when the total memory of the commands exceeds the budget.
+* Since the commands refer to the elements by their descriptors, the road graph has to be compacted
+* through compact() so that the invalid elements in the history are kept and the descriptors are remapped.
+*/
 class History {
+public:
+	static const size_t DEFAULT_MEMORY_BUDGET = 64 * 1024 * 1024;
+
 private:
 	int index;
-	std::vector<RoadGraph> history;
+	std::deque<HistoryCommandPtr> commands;
+	HistoryCommandPtr current;
+	size_t memoryBudget;
+	size_t totalMemory;
 
 public:
-	History();
+	History(size_t memoryBudget = DEFAULT_MEMORY_BUDGET);
+
+	void clear(RoadGraph& roads);
+	void begin(RoadGraph& roads);
+	void end(RoadGraph& roads);
+	void undo(RoadGraph& roads);
+	void redo(RoadGraph& roads);
+	void setMemoryBudget(RoadGraph& roads, size_t memoryBudget);
+	size_t memoryUsage() const;
+	int numCommands() const;
+	int compact(RoadGraph& roads, RoadGraphMapping& mapping);
 
-	void push(RoadGraph roads);
-	RoadGraph undo();
-	RoadGraph redo();
+private:
+	void discardOldCommands(RoadGraph& roads);
 };
 
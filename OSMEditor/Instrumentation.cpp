@@ -0,0 +1,184 @@
+#include "Instrumentation.h"
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <algorithm>
+#include <QFile>
+#include <QElapsedTimer>
+#include "BufferedWriter.h"
+
+namespace {
+	struct Event {
+		int timer;
+		int thread;
+		long long start;
+		long long duration;
+	};
+
+	// clock of the timers, which is started when the program starts so that the time of the events is since then
+	struct Clock {
+		QElapsedTimer timer;
+
+		Clock() { timer.start(); }
+	};
+
+	Clock timerClock;
+
+	// The timer stats and the events are guarded by the mutex, which is taken only while the instrumentation is enabled.
+	std::mutex mutex;
+	Instrumentation::TimerStats stats[Instrumentation::NUM_TIMERS];
+	std::vector<Event> events;
+	std::vector<std::thread::id> threads;
+
+	/**
+	* Write the time in nanoseconds as microseconds with three decimals, which is the unit of the Chrome trace.
+	*/
+	void writeMicroseconds(BufferedWriter& out, long long nsecs) {
+		out.writeInt(nsecs / 1000);
+		char fraction[4] = { '.', (char)('0' + nsecs / 100 % 10), (char)('0' + nsecs / 10 % 10), (char)('0' + nsecs % 10) };
+		out.write(fraction, 4);
+	}
+}
+
+std::atomic<long long> Instrumentation::counters[Instrumentation::NUM_COUNTERS];
+std::atomic<bool> Instrumentation::enabled(false);
+
+const char* Instrumentation::counterName(int counter) {
+	switch (counter) {
+	case POLYLINE_ALLOCATIONS:
+		return "polyline allocations";
+	default:
+		return "";
+	}
+}
+
+void Instrumentation::resetCounters() {
+	for (int i = 0; i < NUM_COUNTERS; i++) {
+		counters[i] = 0;
+	}
+}
+
+/**
+* Enable or disable the timers. The stats and the events recorded so far are kept.
+*/
+void Instrumentation::setEnabled(bool enabled) {
+	Instrumentation::enabled = enabled;
+}
+
+/**
+* Return the time in nanoseconds since the program started.
+*/
+long long Instrumentation::now() {
+	return timerClock.timer.nsecsElapsed();
+}
+
+/**
+* Add the call of the timer to its stats and to the events, which are no longer recorded once MAX_EVENTS are recorded.
+*/
+void Instrumentation::record(int timer, long long start, long long duration) {
+	std::lock_guard<std::mutex> lock(mutex);
+
+	TimerStats& timer_stats = stats[timer];
+	timer_stats.calls++;
+	timer_stats.totalNsecs += duration;
+	timer_stats.maxNsecs = std::max(timer_stats.maxNsecs, duration);
+	timer_stats.lastNsecs = duration;
+
+	if (events.size() >= MAX_EVENTS) return;
+
+	// the threads are numbered in the order they record their first event
+	std::thread::id id = std::this_thread::get_id();
+	int thread = std::find(threads.begin(), threads.end(), id) - threads.begin();
+	if (thread == threads.size()) threads.push_back(id);
+
+	Event event;
+	event.timer = timer;
+	event.thread = thread;
+	event.start = start;
+	event.duration = duration;
+	events.push_back(event);
+}
+
+Instrumentation::TimerStats Instrumentation::timerStats(int timer) {
+	std::lock_guard<std::mutex> lock(mutex);
+	return stats[timer];
+}
+
+const char* Instrumentation::timerName(int timer) {
+	switch (timer) {
+	case TIMER_PARSE:
+		return "parse";
+	case TIMER_PARSE_CHUNK:
+		return "parse chunk";
+	case TIMER_ADD_CHUNK:
+		return "add chunk";
+	case TIMER_PAINT:
+		return "paint";
+	case TIMER_FIND:
+		return "hit test";
+	case TIMER_HISTORY_PUSH:
+		return "history push";
+	case TIMER_UNDO:
+		return "undo";
+	case TIMER_REDO:
+		return "redo";
+	case TIMER_PLANARIFY:
+		return "planarify";
+	case TIMER_REDUCE:
+		return "reduce";
+	case TIMER_CLONE:
+		return "clone";
+	case TIMER_EXPORT:
+		return "export";
+	default:
+		return "";
+	}
+}
+
+int Instrumentation::numEvents() {
+	std::lock_guard<std::mutex> lock(mutex);
+	return events.size();
+}
+
+/**
+* Clear the stats of the timers and the recorded events.
+*/
+void Instrumentation::resetTimers() {
+	std::lock_guard<std::mutex> lock(mutex);
+	for (int i = 0; i < NUM_TIMERS; i++) {
+		stats[i].calls = 0;
+		stats[i].totalNsecs = 0;
+		stats[i].maxNsecs = 0;
+		stats[i].lastNsecs = 0;
+	}
+	std::vector<Event>().swap(events);
+	threads.clear();
+}
+
+/**
+* Save the recorded events as complete events ("ph": "X") of the Chrome trace event format, which chrome://tracing and Perfetto open.
+*
+* @return		false if the file cannot be written
+*/
+bool Instrumentation::saveTrace(const QString& filename) {
+	QFile file(filename);
+	if (!file.open(QFile::WriteOnly)) return false;
+
+	std::lock_guard<std::mutex> lock(mutex);
+	BufferedWriter out(&file);
+	out.write("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	for (int i = 0; i < events.size(); i++) {
+		out.write("{\"name\":\"");
+		out.write(timerName(events[i].timer));
+		out.write("\",\"cat\":\"osmroads\",\"ph\":\"X\",\"pid\":1,\"tid\":");
+		out.writeInt(events[i].thread);
+		out.write(",\"ts\":");
+		writeMicroseconds(out, events[i].start);
+		out.write(",\"dur\":");
+		writeMicroseconds(out, events[i].duration);
+		out.write(i + 1 < events.size() ? "},\n" : "}\n");
+	}
+	out.write("]}\n");
+
+	return out.flush();
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <atomic>
+#include <QString>
+
+/**
+* Counters of the events which are worth watching on the hot editing paths, such as the allocations of polylines.
+* The counters are atomic, since the road graphs may be edited on several threads at once (e.g. by osmroads-cli),
+* but are updated with the relaxed order, which costs about the same as plain integers. They are read and reset by the benchmarks.
+*
+* Timers of the hot paths (parsing, painting, hit testing, history, planarify, reduce, clone, and export) are measured by ScopedTimer
+* only while the instrumentation is enabled, so a disabled timer costs a relaxed load of the flag.
+* While enabled, each timed call is also recorded as an event up to MAX_EVENTS, which can be saved as a Chrome trace (chrome://tracing).
+*/
+class Instrumentation {
+public:
+	enum { POLYLINE_ALLOCATIONS = 0, NUM_COUNTERS };
+	enum { TIMER_PARSE = 0, TIMER_PARSE_CHUNK, TIMER_ADD_CHUNK, TIMER_PAINT, TIMER_FIND, TIMER_HISTORY_PUSH, TIMER_UNDO, TIMER_REDO, TIMER_PLANARIFY, TIMER_REDUCE, TIMER_CLONE, TIMER_EXPORT, NUM_TIMERS };
+	static const int MAX_EVENTS = 1024 * 1024;
+
+	struct TimerStats {
+		long long calls;
+		long long totalNsecs;
+		long long maxNsecs;
+		long long lastNsecs;
+	};
+
+private:
+	static std::atomic<long long> counters[NUM_COUNTERS];
+	static std::atomic<bool> enabled;
+
+public:
+	static void count(int counter, long long n = 1) { counters[counter].fetch_add(n, std::memory_order_relaxed); }
+	static long long counter(int counter) { return counters[counter]; }
+	static const char* counterName(int counter);
+	static void resetCounters();
+
+	static bool isEnabled() { return enabled.load(std::memory_order_relaxed); }
+	static void setEnabled(bool enabled);
+	static long long now();
+	static void record(int timer, long long start, long long duration);
+	static TimerStats timerStats(int timer);
+	static const char* timerName(int timer);
+	static int numEvents();
+	static void resetTimers();
+	static bool saveTrace(const QString& filename);
+};
+
+/**
+* Measures the enclosing scope with the timer of Instrumentation if the instrumentation is enabled when the scope is entered.
+*/
+class ScopedTimer {
+private:
+	int timer;
+	long long start;
+
+public:
+	ScopedTimer(int timer) : timer(Instrumentation::isEnabled() ? timer : -1), start(this->timer >= 0 ? Instrumentation::now() : 0) {}
+	~ScopedTimer() { if (timer >= 0) Instrumentation::record(timer, start, Instrumentation::now() - start); }
+};
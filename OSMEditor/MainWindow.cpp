@@ -19,6 +19,10 @@ MainWindow::MainWindow(QWidget *parent) : QMainWindow(parent) {
 	connect(ui.actionRedo, SIGNAL(triggered()), this, SLOT(onRedo()));
 	connect(ui.actionDeleteEdge, SIGNAL(triggered()), this, SLOT(onDeleteEdge()));
 	connect(ui.actionPlanarGraph, SIGNAL(triggered()), this, SLOT(onPlanarGraph()));
+	connect(ui.actionCompact, SIGNAL(triggered()), this, SLOT(onCompact()));
+	connect(ui.actionFastRendering, SIGNAL(triggered()), this, SLOT(onFastRendering()));
+	connect(ui.actionInstrumentation, SIGNAL(triggered()), this, SLOT(onInstrumentation()));
+	connect(ui.actionExportTrace, SIGNAL(triggered()), this, SLOT(onExportTrace()));
 	connect(ui.actionPropertyWindow, SIGNAL(triggered()), this, SLOT(onPropertyWindow()));
 
 	// create tool bar for file menu
@@ -31,6 +35,17 @@ MainWindow::MainWindow(QWidget *parent) : QMainWindow(parent) {
 	ui.mainToolBar->addAction(ui.actionRedo);
 	ui.mainToolBar->addAction(ui.actionDeleteEdge);
 	//ui.mainToolBar->addSeparator();
+
+	// progress of the file being loaded in the background, which is shown only while loading
+	loadingProgressBar = new QProgressBar(this);
+	loadingProgressBar->setRange(0, 100);
+	loadingProgressBar->setMaximumWidth(200);
+	loadingProgressBar->hide();
+	ui.statusBar->addPermanentWidget(loadingProgressBar);
+	cancelLoadingButton = new QPushButton(tr("Cancel"), this);
+	cancelLoadingButton->hide();
+	ui.statusBar->addPermanentWidget(cancelLoadingButton);
+	connect(cancelLoadingButton, SIGNAL(clicked()), this, SLOT(onCancelLoading()));
 }
 
 MainWindow::~MainWindow() {
@@ -45,33 +60,90 @@ void MainWindow::keyReleaseEvent(QKeyEvent* e) {
 }
 
 void MainWindow::onOpen() {
-	QString filename = QFileDialog::getOpenFileName(this, tr("Open StreetMap file..."), "", tr("StreetMap Files (*.osm)"));
+	QString filename = QFileDialog::getOpenFileName(this, tr("Open StreetMap file..."), "", tr("StreetMap Files (*.osm *.pbf *.rgs);;Road Graph Snapshots (*.rgs)"));
 
 	if (filename.isEmpty()) {
 		return;
 	}
 
-	QApplication::setOverrideCursor(Qt::WaitCursor);
-	canvas->open(filename);
-	canvas->update();
-	QApplication::restoreOverrideCursor();
+	// the file is loaded in the background, and the editing is enabled again when it is done
+	setEditingEnabled(false);
+	loadingProgressBar->setValue(0);
+	loadingProgressBar->show();
+	cancelLoadingButton->show();
+	ui.statusBar->showMessage(QString("Loading %1...").arg(filename));
+	canvas->startOpen(filename);
+}
+
+void MainWindow::onCancelLoading() {
+	canvas->cancelOpen();
+}
 
-	setWindowTitle("OSM Editor - " + filename);
+/**
+* Show the progress of the file being loaded, which is called by the canvas while loading.
+*/
+void MainWindow::showLoadingProgress(long long consumed, long long total) {
+	loadingProgressBar->setValue(total > 0 ? (int)(consumed * 100 / total) : 0);
+}
+
+/**
+* Hide the progress and enable the editing again, which is called by the canvas when the loader is done.
+*
+* @param result		RoadGraphLoader::RESULT_LOADED, RESULT_FAILED, or RESULT_CANCELED
+*/
+void MainWindow::finishLoading(const QString& filename, int result) {
+	loadingProgressBar->hide();
+	cancelLoadingButton->hide();
+	setEditingEnabled(true);
+
+	if (result == RoadGraphLoader::RESULT_LOADED) {
+		ui.statusBar->clearMessage();
+		setWindowTitle("OSM Editor - " + filename);
+	}
+	else if (result == RoadGraphLoader::RESULT_CANCELED) {
+		ui.statusBar->showMessage(QString("Loading %1 is canceled.").arg(filename));
+	}
+	else {
+		ui.statusBar->showMessage(QString("%1 cannot be read.").arg(filename));
+	}
+}
+
+/**
+* Show the result of the saving, which is called by the canvas when the saver is done.
+*/
+void MainWindow::finishSaving(const QString& filename, bool succeeded) {
+	if (succeeded) {
+		ui.statusBar->clearMessage();
+		setWindowTitle("OSM Editor - " + filename);
+	}
+	else {
+		ui.statusBar->showMessage(QString("%1 cannot be written.").arg(filename));
+	}
+}
+
+/**
+* Enable or disable the actions which change the road graph or replace it.
+*/
+void MainWindow::setEditingEnabled(bool enabled) {
+	ui.actionOpen->setEnabled(enabled);
+	ui.actionSave->setEnabled(enabled);
+	ui.actionUndo->setEnabled(enabled);
+	ui.actionRedo->setEnabled(enabled);
+	ui.actionDeleteEdge->setEnabled(enabled);
+	ui.actionPlanarGraph->setEnabled(enabled);
+	ui.actionCompact->setEnabled(enabled);
+	propertyWidget->setEnabled(enabled);
 }
 
 void MainWindow::onSave() {
-	QString filename = QFileDialog::getSaveFileName(this, tr("Open StreetMap file..."), "", tr("StreetMap Files (*.osm)"));
+	QString filename = QFileDialog::getSaveFileName(this, tr("Open StreetMap file..."), "", tr("StreetMap Files (*.osm);;Road Graph Snapshots (*.rgs)"));
 
 	if (filename.isEmpty()) {
 		return;
 	}
 
-	QApplication::setOverrideCursor(Qt::WaitCursor);
 	canvas->save(filename);
-	canvas->update();
-	QApplication::restoreOverrideCursor();
-
-	setWindowTitle("OSM Editor - " + filename);
+	ui.statusBar->showMessage(QString("Saving %1...").arg(filename));
 }
 
 void MainWindow::onUndo() {
@@ -90,6 +162,48 @@ void MainWindow::onPlanarGraph() {
 	canvas->planarGraph();
 }
 
+void MainWindow::onCompact() {
+	canvas->compact();
+}
+
+void MainWindow::onFastRendering() {
+	canvas->fastRendering = ui.actionFastRendering->isChecked();
+	canvas->update();
+}
+
+/**
+* Show the overlay of the instrumentation and start the timers from zero, or hide it and stop the timers.
+* The recorded events are kept after the overlay is hidden, so that they can be exported.
+*/
+void MainWindow::onInstrumentation() {
+	if (ui.actionInstrumentation->isChecked()) {
+		Instrumentation::resetTimers();
+		Instrumentation::resetCounters();
+		Instrumentation::setEnabled(true);
+	}
+	else {
+		Instrumentation::setEnabled(false);
+	}
+
+	canvas->showInstrumentation = ui.actionInstrumentation->isChecked();
+	canvas->update();
+}
+
+void MainWindow::onExportTrace() {
+	QString filename = QFileDialog::getSaveFileName(this, tr("Export Trace..."), "", tr("Chrome Trace Files (*.json)"));
+
+	if (filename.isEmpty()) {
+		return;
+	}
+
+	if (Instrumentation::saveTrace(filename)) {
+		ui.statusBar->showMessage(QString("%1 events are exported.").arg(Instrumentation::numEvents()));
+	}
+	else {
+		ui.statusBar->showMessage(QString("%1 cannot be written.").arg(filename));
+	}
+}
+
 void MainWindow::onPropertyWindow() {
 	propertyWidget->show();
 	addDockWidget(Qt::RightDockWidgetArea, propertyWidget);
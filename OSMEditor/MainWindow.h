@@ -2,6 +2,8 @@
 #define MAINWINDOW_H
 
 #include <QtWidgets/QMainWindow>
+#include <QProgressBar>
+#include <QPushButton>
 #include "ui_MainWindow.h"
 #include "Canvas.h"
 #include "PropertyWidget.h"
@@ -13,22 +15,34 @@ public:
 	Ui::MainWindowClass ui;
 	Canvas* canvas;
 	PropertyWidget* propertyWidget;
+	QProgressBar* loadingProgressBar;
+	QPushButton* cancelLoadingButton;
 
 public:
 	MainWindow(QWidget *parent = 0);
 	~MainWindow();
 
+	void showLoadingProgress(long long consumed, long long total);
+	void finishLoading(const QString& filename, int result);
+	void finishSaving(const QString& filename, bool succeeded);
+	void setEditingEnabled(bool enabled);
+
 protected:
 	void keyPressEvent(QKeyEvent* e);
 	void keyReleaseEvent(QKeyEvent* e);
 
 public slots:
 	void onOpen();
+	void onCancelLoading();
 	void onSave();
 	void onUndo();
 	void onRedo();
 	void onDeleteEdge();
 	void onPlanarGraph();
+	void onCompact();
+	void onFastRendering();
+	void onInstrumentation();
+	void onExportTrace();
 	void onPropertyWindow();
 };
 
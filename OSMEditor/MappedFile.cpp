@@ -0,0 +1,38 @@
+#include "MappedFile.h"
+
+MappedFile::MappedFile(const QString& filename) : file(filename) {
+	mapped = NULL;
+	mappedSize = 0;
+}
+
+MappedFile::~MappedFile() {
+	if (mapped != NULL) file.unmap(mapped);
+}
+
+/**
+* Map the file, or read it into the buffer if it cannot be mapped.
+*
+* @return		false if the file cannot be opened
+*/
+bool MappedFile::open() {
+	if (!file.open(QIODevice::ReadOnly)) return false;
+
+	qint64 size = file.size();
+	if (size > 0) mapped = file.map(0, size);
+	if (mapped != NULL) {
+		mappedSize = size;
+	}
+	else {
+		buffer = file.readAll();
+	}
+
+	return true;
+}
+
+const char* MappedFile::data() const {
+	return mapped != NULL ? (const char*)mapped : buffer.constData();
+}
+
+qint64 MappedFile::size() const {
+	return mapped != NULL ? mappedSize : buffer.size();
+}
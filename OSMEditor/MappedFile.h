@@ -0,0 +1,24 @@
+#pragma once
+
+#include <QFile>
+#include <QByteArray>
+
+/**
+* Read-only view of the whole file, which is memory-mapped if possible, or read at once otherwise.
+* The data is valid until the object is destroyed.
+*/
+class MappedFile {
+private:
+	QFile file;
+	uchar* mapped;
+	qint64 mappedSize;
+	QByteArray buffer;
+
+public:
+	MappedFile(const QString& filename);
+	~MappedFile();
+
+	bool open();
+	const char* data() const;
+	qint64 size() const;
+};
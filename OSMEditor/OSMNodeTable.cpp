@@ -0,0 +1,100 @@
+#include "OSMNodeTable.h"
+
+const unsigned long long OSMNodeTable::EMPTY = ~0ULL;
+const int OSMNodeTable::NO_PT = -2;
+
+OSMNodeTable::OSMNodeTable() {
+	count = 0;
+	rehash(1024);
+}
+
+/**
+* Make the table large enough for the specified number of nodes, so that it does not need to grow while parsing.
+*/
+void OSMNodeTable::reserve(int num_nodes) {
+	int capacity = slots.size();
+	while (capacity < num_nodes * 2) capacity *= 2;
+
+	if (capacity > slots.size()) rehash(capacity);
+}
+
+/**
+* Add the node, or update its coordinates if it already exists.
+*/
+void OSMNodeTable::insert(unsigned long long id, const QVector2D& pt) {
+	// keep the load factor under 0.5
+	if ((count + 1) * 2 > slots.size()) rehash(slots.size() * 2);
+
+	int slot = probe(id);
+	if (slots[slot].id == EMPTY) {
+		slots[slot].id = id;
+		slots[slot].vertex = -1;
+		count++;
+	}
+	slots[slot].pt = pt;
+}
+
+/**
+* Add the node without coordinates, which are set later by setPt().
+* Nothing changes if the node already exists.
+*/
+void OSMNodeTable::insertId(unsigned long long id) {
+	if ((count + 1) * 2 > slots.size()) rehash(slots.size() * 2);
+
+	int slot = probe(id);
+	if (slots[slot].id == EMPTY) {
+		slots[slot].id = id;
+		slots[slot].vertex = NO_PT;
+		count++;
+	}
+}
+
+/**
+* Set the coordinates of the node which was added by insertId().
+*/
+void OSMNodeTable::setPt(int slot, const QVector2D& pt) {
+	slots[slot].pt = pt;
+	if (slots[slot].vertex == NO_PT) slots[slot].vertex = -1;
+}
+
+/**
+* Return the slot of the node, or -1 if it does not exist.
+*/
+int OSMNodeTable::find(unsigned long long id) const {
+	int slot = probe(id);
+	if (slots[slot].id == EMPTY) return -1;
+	else return slot;
+}
+
+/**
+* Return the slot which holds the id, or the empty slot where the id should be stored.
+*/
+int OSMNodeTable::probe(unsigned long long id) const {
+	int mask = slots.size() - 1;
+
+	// Fibonacci hashing spreads the sequential OSM ids over the table
+	int slot = (int)((id * 11400714819323198485ULL) >> 32) & mask;
+	while (slots[slot].id != EMPTY && slots[slot].id != id) {
+		slot = (slot + 1) & mask;
+	}
+
+	return slot;
+}
+
+/**
+* Resize the table to the specified capacity, which has to be a power of two.
+*/
+void OSMNodeTable::rehash(int capacity) {
+	std::vector<Slot> old_slots(capacity);
+	old_slots.swap(slots);
+	for (int i = 0; i < slots.size(); i++) {
+		slots[i].id = EMPTY;
+	}
+
+	for (int i = 0; i < old_slots.size(); i++) {
+		if (old_slots[i].id == EMPTY) continue;
+
+		int slot = probe(old_slots[i].id);
+		slots[slot] = old_slots[i];
+	}
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <vector>
+#include <QVector2D>
+
+/**
+* Open-addressing hash table from OSM node ids to their projected coordinates.
+* Each slot also holds the index of the graph vertex created for the node, or -1 if it has not been created yet.
+* A node can also be registered by its id alone before its coordinates are read, so that the table can be limited
+* to the nodes which the roads actually use.
+* This replaces the map-based node lists so that each node costs one flat slot instead of several tree nodes.
+*/
+class OSMNodeTable {
+private:
+	struct Slot {
+		unsigned long long id;
+		QVector2D pt;
+		int vertex;
+	};
+
+	static const unsigned long long EMPTY;
+	static const int NO_PT;
+
+	std::vector<Slot> slots;
+	int count;
+
+public:
+	OSMNodeTable();
+
+	void reserve(int num_nodes);
+	void insert(unsigned long long id, const QVector2D& pt);
+	void insertId(unsigned long long id);
+	int find(unsigned long long id) const;
+	int size() const { return count; }
+
+	size_t memoryUsage() const { return slots.size() * sizeof(Slot); }
+
+	const QVector2D& pt(int slot) const { return slots[slot].pt; }
+	bool hasPt(int slot) const { return slots[slot].vertex != NO_PT; }
+	void setPt(int slot, const QVector2D& pt);
+	int vertex(int slot) const { return slots[slot].vertex; }
+	void setVertex(int slot, int vertex) { slots[slot].vertex = vertex; }
+
+private:
+	int probe(unsigned long long id) const;
+	void rehash(int capacity);
+};
@@ -0,0 +1,160 @@
+#include "OSMParallelParser.h"
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include "OSMStreamParser.h"
+#include "MappedFile.h"
+
+namespace {
+	/** chunks smaller than this are not worth a thread */
+	const qint64 MIN_CHUNK_SIZE = 256 * 1024;
+
+	/** number of chunks per thread, so that the threads which read fast chunks take other chunks */
+	const int CHUNKS_PER_THREAD = 4;
+}
+
+/**
+* @param numThreads	number of the threads to use, or 0 to use all the cores
+*/
+OSMParallelParser::OSMParallelParser(OSMRoadsParser* handler, bool usedNodesOnly, int numThreads) {
+	this->handler = handler;
+	this->usedNodesOnly = usedNodesOnly;
+	bufferMemory = 0;
+
+	if (numThreads <= 0) numThreads = std::thread::hardware_concurrency();
+	this->numThreads = std::max(1, numThreads);
+}
+
+/**
+* Parse the OSM file, which is memory-mapped by MappedFile.
+*
+* @return		false if the file cannot be opened
+*/
+bool OSMParallelParser::parse(const QString& filename) {
+	ScopedTimer timer(Instrumentation::TIMER_PARSE);
+	MappedFile file(filename);
+	if (!file.open()) return false;
+	if (file.size() == 0) return true;
+
+	parse(file.data(), file.size());
+
+	return true;
+}
+
+/**
+* Parse the OSM XML data in the buffer.
+* If the parsing is canceled, it stops with the chunks added so far.
+*/
+void OSMParallelParser::parse(const char* data, qint64 size) {
+	bufferMemory = 0;
+
+	const char* end = data + size;
+	const char* body = OSMStreamParser::findTopLevelElement(data, end);
+
+	int num_chunks = (int)std::min((qint64)numThreads * CHUNKS_PER_THREAD, (end - body) / MIN_CHUNK_SIZE);
+	if (numThreads == 1 || num_chunks <= 1) {
+		OSMStreamParser reader(handler, usedNodesOnly);
+		reader.parse(data, size);
+		return;
+	}
+
+	// The body is read once for each scan and once more when the chunks are added.
+	OSMParseProgress* progress = handler->getProgress();
+	if (progress != NULL) progress->setTotal((body - data) + (end - body) * (usedNodesOnly ? 3 : 2));
+
+	// The header is read first, since the workers need the center of the bounds to project the nodes.
+	OSMStreamParser reader(handler);
+	reader.scan(data, body - data);
+
+	// split the body into chunks at the element boundaries
+	std::vector<const char*> bounds;
+	bounds.push_back(body);
+	qint64 chunk_size = (end - body) / num_chunks;
+	for (int i = 1; i < num_chunks; i++) {
+		const char* p = OSMStreamParser::findTopLevelElement(std::max(bounds.back(), body + chunk_size * i), end);
+		if (p > bounds.back() && p < end) bounds.push_back(p);
+	}
+	bounds.push_back(end);
+
+	std::vector<OSMRoadsChunk> chunks;
+	if (usedNodesOnly) {
+		// collect the nodes which the roads refer to
+		std::vector<OSMRoadsChunk> road_chunks;
+		readChunks(bounds, OSMStreamParser::WAYS_ONLY, NULL, road_chunks);
+		if (handler->isCanceled()) return;
+		handler->beginUsedNodeScan();
+		for (int i = 0; i < road_chunks.size(); i++) {
+			handler->addUsedNodes(road_chunks[i]);
+		}
+		handler->endUsedNodeScan();
+
+		// read the coordinates of those nodes only, and put the roads back to the chunks
+		readChunks(bounds, OSMStreamParser::NODES_ONLY, &handler->getNodeTable(), chunks);
+		if (handler->isCanceled()) return;
+		for (int i = 0; i < chunks.size(); i++) {
+			chunks[i].roads.swap(road_chunks[i].roads);
+			chunks[i].nds.swap(road_chunks[i].nds);
+			bufferMemory += chunks[i].memoryUsage();
+		}
+	}
+	else {
+		readChunks(bounds, OSMStreamParser::ALL_ELEMENTS, NULL, chunks);
+		if (handler->isCanceled()) return;
+
+		int num_nodes = 0;
+		for (int i = 0; i < chunks.size(); i++) {
+			num_nodes += chunks[i].nodes.size();
+			bufferMemory += chunks[i].memoryUsage();
+		}
+		handler->reserveNodes(num_nodes);
+	}
+
+	// add the chunks in the file order, and release each of them as soon as it is added
+	for (int i = 0; i < chunks.size(); i++) {
+		handler->addChunk(chunks[i]);
+		std::vector<OSMRoadsChunk::Node>().swap(chunks[i].nodes);
+		std::vector<OSMRoadsChunk::Road>().swap(chunks[i].roads);
+		std::vector<unsigned long long>().swap(chunks[i].nds);
+
+		if (progress != NULL) {
+			progress->consume(bounds[i + 1] - bounds[i]);
+			if (progress->isCanceled()) return;
+		}
+	}
+}
+
+/**
+* Read each chunk [bounds[i], bounds[i + 1]) into chunks[i] on the worker threads.
+* Once the parsing is canceled, the workers stop taking the chunks.
+*/
+void OSMParallelParser::readChunks(const std::vector<const char*>& bounds, int elements, const OSMNodeTable* nodeFilter, std::vector<OSMRoadsChunk>& chunks) {
+	chunks.clear();
+	chunks.resize(bounds.size() - 1);
+
+	std::atomic<int> next_chunk(0);
+	RoadGraph* roads = handler->getRoads();
+	OSMParseProgress* progress = handler->getProgress();
+	auto work = [&]() {
+		while (true) {
+			int i = next_chunk++;
+			if (i >= chunks.size() || handler->isCanceled()) break;
+
+			ScopedTimer timer(Instrumentation::TIMER_PARSE_CHUNK);
+			OSMRoadsParser parser(roads);
+			parser.recordTo(&chunks[i], nodeFilter);
+			OSMStreamParser reader(&parser);
+			reader.scan(bounds[i], bounds[i + 1] - bounds[i], elements);
+			if (progress != NULL) progress->consume(bounds[i + 1] - bounds[i]);
+		}
+	};
+
+	std::vector<std::thread> threads;
+	for (int i = 0; i < numThreads - 1 && i < chunks.size() - 1; i++) {
+		threads.push_back(std::thread(work));
+	}
+	work();
+
+	for (int i = 0; i < threads.size(); i++) {
+		threads[i].join();
+	}
+}
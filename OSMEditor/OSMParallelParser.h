@@ -0,0 +1,30 @@
+#pragma once
+
+#include <vector>
+#include <QString>
+#include "OSMRoadsParser.h"
+
+/**
+* Parser which reads OSM XML files on multiple threads.
+* The file is split into chunks at the boundaries of the node/way/relation elements, and each worker thread reads
+* a chunk into its own OSMRoadsChunk by OSMStreamParser and a private OSMRoadsParser, so the classification rules are
+* shared with the serial path. The chunks are then added to the graph one by one in the file order, so the resulting
+* graph is exactly the same as the one built by OSMStreamParser.
+*/
+class OSMParallelParser {
+private:
+	OSMRoadsParser* handler;
+	bool usedNodesOnly;
+	int numThreads;
+	size_t bufferMemory;
+
+public:
+	OSMParallelParser(OSMRoadsParser* handler, bool usedNodesOnly = false, int numThreads = 0);
+
+	bool parse(const QString& filename);
+	void parse(const char* data, qint64 size);
+	size_t bufferMemoryUsage() const { return bufferMemory; }
+
+private:
+	void readChunks(const std::vector<const char*>& bounds, int elements, const OSMNodeTable* nodeFilter, std::vector<OSMRoadsChunk>& chunks);
+};
@@ -0,0 +1,536 @@
+#include "OSMPbfParser.h"
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <string.h>
+#include "OSMStreamParser.h"
+#include "MappedFile.h"
+
+namespace {
+	/** number of blocks per thread that are decoded before they are added to the graph */
+	const int BLOCKS_PER_THREAD = 4;
+
+	/** the maximum size of a blob allowed by the specification */
+	const int MAX_BLOB_SIZE = 32 * 1024 * 1024;
+
+	enum { WIRE_VARINT = 0, WIRE_64BIT = 1, WIRE_BYTES = 2, WIRE_32BIT = 5 };
+
+	/**
+	* Reader of the fields of a protobuf message.
+	* Once the data turns out to be broken, the reader stops at the end and failed() returns true.
+	*/
+	class PbfReader {
+	private:
+		const unsigned char* p;
+		const unsigned char* end;
+		bool error;
+
+	public:
+		int field;
+		int wireType;
+
+	public:
+		PbfReader() : p(NULL), end(NULL), error(false), field(0), wireType(0) {}
+		PbfReader(const char* data, int size) : p((const unsigned char*)data), end((const unsigned char*)data + size), error(false), field(0), wireType(0) {}
+
+		bool atEnd() const { return p >= end; }
+		bool failed() const { return error; }
+
+		/**
+		* Read the key of the next field, and return false if there is no more field.
+		*/
+		bool next() {
+			if (p >= end) return false;
+
+			unsigned long long key = varint();
+			field = (int)(key >> 3);
+			wireType = (int)(key & 7);
+			return !error;
+		}
+
+		unsigned long long varint() {
+			unsigned long long value = 0;
+			for (int shift = 0; shift < 64 && p < end; shift += 7) {
+				unsigned char b = *p++;
+				value |= (unsigned long long)(b & 0x7f) << shift;
+				if ((b & 0x80) == 0) return value;
+			}
+
+			fail();
+			return 0;
+		}
+
+		/** zigzag-encoded signed integer */
+		long long svarint() {
+			unsigned long long value = varint();
+			return (long long)(value >> 1) ^ -(long long)(value & 1);
+		}
+
+		/** length-delimited field */
+		void bytes(const char*& data, int& size) {
+			unsigned long long len = varint();
+			if (len > (unsigned long long)(end - p)) {
+				fail();
+				data = NULL;
+				size = 0;
+				return;
+			}
+
+			data = (const char*)p;
+			size = (int)len;
+			p += len;
+		}
+
+		/** length-delimited field which is an embedded message or a packed repeated field */
+		PbfReader message() {
+			const char* data;
+			int size;
+			bytes(data, size);
+			return PbfReader(data, size);
+		}
+
+		void skip() {
+			const char* data;
+			int size;
+			switch (wireType) {
+			case WIRE_VARINT: varint(); break;
+			case WIRE_64BIT: skipBytes(8); break;
+			case WIRE_BYTES: bytes(data, size); break;
+			case WIRE_32BIT: skipBytes(4); break;
+			default: fail(); break;
+			}
+		}
+
+	private:
+		void skipBytes(int size) {
+			if (end - p < size) fail();
+			else p += size;
+		}
+
+		void fail() {
+			error = true;
+			p = end;
+		}
+	};
+
+	inline bool equals(const char* str, int len, const char* literal) {
+		return len == strlen(literal) && memcmp(str, literal, len) == 0;
+	}
+
+	inline int toInt32BigEndian(const char* data) {
+		const unsigned char* p = (const unsigned char*)data;
+		return (int)(((unsigned int)p[0] << 24) | ((unsigned int)p[1] << 16) | ((unsigned int)p[2] << 8) | (unsigned int)p[3]);
+	}
+
+	/**
+	* Convert the coordinate in the block to degrees.
+	* It is divided by 1e9 as an exact integer, so that the result is the same as reading the decimal in the XML file.
+	*/
+	inline double toDegree(long long offset, long long granularity, long long value) {
+		return (double)(offset + granularity * value) / 1e9;
+	}
+}
+
+/**
+* @param numThreads	number of the threads to use, or 0 to use all the cores
+*/
+OSMPbfParser::OSMPbfParser(OSMRoadsParser* handler, bool usedNodesOnly, int numThreads) {
+	this->handler = handler;
+	this->usedNodesOnly = usedNodesOnly;
+	bufferMemory = 0;
+
+	if (numThreads <= 0) numThreads = std::thread::hardware_concurrency();
+	this->numThreads = std::max(1, numThreads);
+}
+
+/**
+* Parse the PBF file, which is memory-mapped by MappedFile.
+*
+* @return		false if the file cannot be opened or is broken
+*/
+bool OSMPbfParser::parse(const QString& filename) {
+	ScopedTimer timer(Instrumentation::TIMER_PARSE);
+	MappedFile file(filename);
+	if (!file.open()) return false;
+	if (file.size() == 0) return true;
+
+	return parse(file.data(), file.size());
+}
+
+/**
+* Parse the PBF data in the buffer.
+* The blocks which have been read before an error is found are kept in the graph, as well as those before the parsing is canceled.
+*
+* @return		false if the data is broken or uses an unsupported feature
+*/
+bool OSMPbfParser::parse(const char* data, qint64 size) {
+	bufferMemory = 0;
+
+	// Each blob is preceded by its header, which is preceded by its size.
+	// The header block is read here, and the data blocks are listed to be decoded on the worker threads.
+	std::vector<Block> blocks;
+	const char* p = data;
+	const char* end = data + size;
+	while (p < end) {
+		if (end - p < 4) return false;
+		int header_size = toInt32BigEndian(p);
+		p += 4;
+		if (header_size < 0 || end - p < header_size) return false;
+
+		PbfReader header(p, header_size);
+		const char* type = NULL;
+		int type_len = 0;
+		long long blob_size = -1;
+		while (header.next()) {
+			if (header.field == 1 && header.wireType == WIRE_BYTES) {
+				header.bytes(type, type_len);
+			}
+			else if (header.field == 3 && header.wireType == WIRE_VARINT) {
+				blob_size = (long long)header.varint();
+			}
+			else {
+				header.skip();
+			}
+		}
+		p += header_size;
+		if (header.failed() || blob_size < 0 || blob_size > MAX_BLOB_SIZE || end - p < blob_size) return false;
+
+		if (equals(type, type_len, "OSMHeader")) {
+			QByteArray block;
+			if (!decodeBlob(p, blob_size, block) || !parseHeaderBlock(block.constData(), block.size())) return false;
+		}
+		else if (equals(type, type_len, "OSMData")) {
+			Block block;
+			block.data = p;
+			block.size = blob_size;
+			blocks.push_back(block);
+		}
+		// blobs of unknown types are skipped as the specification requires
+
+		p += blob_size;
+	}
+
+	// The blocks are read once for each scan and once more when they are added.
+	OSMParseProgress* progress = handler->getProgress();
+	if (progress != NULL) {
+		qint64 blocks_size = 0;
+		for (int i = 0; i < blocks.size(); i++) {
+			blocks_size += blocks[i].size;
+		}
+		progress->setTotal(blocks_size * (usedNodesOnly ? 3 : 2));
+	}
+
+	// The blocks are decoded in batches so that only a limited number of decoded blocks are kept in memory.
+	int batch_size = numThreads * BLOCKS_PER_THREAD;
+	std::vector<OSMRoadsChunk> road_chunks;
+	size_t road_memory = 0;
+	if (usedNodesOnly) {
+		// collect the nodes which the roads refer to
+		if (!readBlocks(blocks, 0, blocks.size(), OSMStreamParser::WAYS_ONLY, NULL, road_chunks)) return false;
+		if (handler->isCanceled()) return true;
+		handler->beginUsedNodeScan();
+		for (int i = 0; i < road_chunks.size(); i++) {
+			handler->addUsedNodes(road_chunks[i]);
+			road_memory += road_chunks[i].memoryUsage();
+		}
+		handler->endUsedNodeScan();
+	}
+
+	for (int begin = 0; begin < blocks.size(); begin += batch_size) {
+		int batch_end = std::min(begin + batch_size, (int)blocks.size());
+
+		std::vector<OSMRoadsChunk> chunks;
+		if (usedNodesOnly) {
+			// read the coordinates of the collected nodes only, and put the roads back to the chunks
+			if (!readBlocks(blocks, begin, batch_end, OSMStreamParser::NODES_ONLY, &handler->getNodeTable(), chunks)) return false;
+			if (handler->isCanceled()) return true;
+			for (int i = 0; i < chunks.size(); i++) {
+				chunks[i].roads.swap(road_chunks[begin + i].roads);
+				chunks[i].nds.swap(road_chunks[begin + i].nds);
+			}
+		}
+		else {
+			if (!readBlocks(blocks, begin, batch_end, OSMStreamParser::ALL_ELEMENTS, NULL, chunks)) return false;
+			if (handler->isCanceled()) return true;
+		}
+
+		size_t memory = road_memory;
+		for (int i = 0; i < chunks.size(); i++) {
+			memory += chunks[i].memoryUsage();
+		}
+		bufferMemory = std::max(bufferMemory, memory);
+
+		// add the chunks in the file order
+		for (int i = 0; i < chunks.size(); i++) {
+			handler->addChunk(chunks[i]);
+			if (progress != NULL) progress->consume(blocks[begin + i].size);
+		}
+		if (handler->isCanceled()) return true;
+	}
+
+	return true;
+}
+
+/**
+* Decode the blob into the block, which is either stored as it is or compressed by zlib.
+*
+* @return		false if the blob is broken or compressed by an unsupported method
+*/
+bool OSMPbfParser::decodeBlob(const char* data, int size, QByteArray& block) {
+	PbfReader blob(data, size);
+	const char* raw = NULL;
+	int raw_len = 0;
+	const char* zlib_data = NULL;
+	int zlib_len = 0;
+	long long raw_size = -1;
+	while (blob.next()) {
+		if (blob.field == 1 && blob.wireType == WIRE_BYTES) {
+			blob.bytes(raw, raw_len);
+		}
+		else if (blob.field == 2 && blob.wireType == WIRE_VARINT) {
+			raw_size = (long long)blob.varint();
+		}
+		else if (blob.field == 3 && blob.wireType == WIRE_BYTES) {
+			blob.bytes(zlib_data, zlib_len);
+		}
+		else {
+			blob.skip();
+		}
+	}
+	if (blob.failed()) return false;
+
+	if (raw != NULL) {
+		block = QByteArray::fromRawData(raw, raw_len);
+		return true;
+	}
+
+	if (zlib_data == NULL || raw_size < 0 || raw_size > MAX_BLOB_SIZE) return false;
+
+	// qUncompress takes the zlib stream preceded by the uncompressed size in big endian
+	QByteArray compressed(zlib_len + 4, Qt::Uninitialized);
+	compressed[0] = (char)(raw_size >> 24);
+	compressed[1] = (char)(raw_size >> 16);
+	compressed[2] = (char)(raw_size >> 8);
+	compressed[3] = (char)raw_size;
+	memcpy(compressed.data() + 4, zlib_data, zlib_len);
+	block = qUncompress(compressed);
+
+	return block.size() == raw_size;
+}
+
+/**
+* Decode the data blocks [begin, end) into the chunks on the worker threads.
+* Once the parsing is canceled, the workers stop taking the blocks.
+*
+* @return		false if any of the blocks is broken
+*/
+bool OSMPbfParser::readBlocks(const std::vector<Block>& blocks, int begin, int end, int elements, const OSMNodeTable* nodeFilter, std::vector<OSMRoadsChunk>& chunks) {
+	chunks.clear();
+	chunks.resize(end - begin);
+
+	std::atomic<int> next_block(begin);
+	std::atomic<bool> ok(true);
+	RoadGraph* roads = handler->getRoads();
+	OSMParseProgress* progress = handler->getProgress();
+	auto work = [&]() {
+		QByteArray block;
+		while (true) {
+			int i = next_block++;
+			if (i >= end || handler->isCanceled()) break;
+
+			ScopedTimer timer(Instrumentation::TIMER_PARSE_CHUNK);
+			if (!decodeBlob(blocks[i].data, blocks[i].size, block)) {
+				ok = false;
+				continue;
+			}
+
+			OSMRoadsParser parser(roads);
+			parser.recordTo(&chunks[i - begin], nodeFilter);
+			if (!parsePrimitiveBlock(block.constData(), block.size(), &parser, elements)) ok = false;
+			if (progress != NULL) progress->consume(blocks[i].size);
+		}
+	};
+
+	std::vector<std::thread> threads;
+	for (int i = 0; i < numThreads - 1 && i < end - begin - 1; i++) {
+		threads.push_back(std::thread(work));
+	}
+	work();
+
+	for (int i = 0; i < threads.size(); i++) {
+		threads[i].join();
+	}
+
+	return ok;
+}
+
+/**
+* Read the bounding box in the header block.
+*
+* @return		false if the block is broken or requires an unsupported feature
+*/
+bool OSMPbfParser::parseHeaderBlock(const char* data, int size) {
+	PbfReader reader(data, size);
+	while (reader.next()) {
+		if (reader.field == 1 && reader.wireType == WIRE_BYTES) {
+			// HeaderBBox in nanodegrees
+			long long left = 0, right = 0, top = 0, bottom = 0;
+			PbfReader bbox = reader.message();
+			while (bbox.next()) {
+				if (bbox.wireType != WIRE_VARINT) bbox.skip();
+				else if (bbox.field == 1) left = bbox.svarint();
+				else if (bbox.field == 2) right = bbox.svarint();
+				else if (bbox.field == 3) top = bbox.svarint();
+				else if (bbox.field == 4) bottom = bbox.svarint();
+				else bbox.skip();
+			}
+			if (bbox.failed()) return false;
+
+			handler->handleBounds(toDegree(0, 1, bottom), toDegree(0, 1, top), toDegree(0, 1, left), toDegree(0, 1, right));
+		}
+		else if (reader.field == 4 && reader.wireType == WIRE_BYTES) {
+			const char* feature;
+			int feature_len;
+			reader.bytes(feature, feature_len);
+			if (!equals(feature, feature_len, "OsmSchema-V0.6") && !equals(feature, feature_len, "DenseNodes") && !equals(feature, feature_len, "HistoricalInformation")) return false;
+		}
+		else {
+			reader.skip();
+		}
+	}
+
+	return !reader.failed();
+}
+
+/**
+* Pass the nodes and the ways in the primitive block to the parser.
+* The elements are filtered in the same way as OSMStreamParser::scan does.
+*
+* @return		false if the block is broken
+*/
+bool OSMPbfParser::parsePrimitiveBlock(const char* data, int size, OSMRoadsParser* parser, int elements) {
+	// The string table and the coordinate parameters may follow the groups, so the groups are read afterwards.
+	std::vector<std::pair<const char*, int> > strings;
+	std::vector<PbfReader> groups;
+	long long granularity = 100;
+	long long lat_offset = 0;
+	long long lon_offset = 0;
+
+	PbfReader block(data, size);
+	while (block.next()) {
+		if (block.field == 1 && block.wireType == WIRE_BYTES) {
+			PbfReader table = block.message();
+			while (table.next()) {
+				if (table.field == 1 && table.wireType == WIRE_BYTES) {
+					const char* str;
+					int len;
+					table.bytes(str, len);
+					strings.push_back(std::make_pair(str, len));
+				}
+				else {
+					table.skip();
+				}
+			}
+			if (table.failed()) return false;
+		}
+		else if (block.field == 2 && block.wireType == WIRE_BYTES) {
+			groups.push_back(block.message());
+		}
+		else if (block.field == 17 && block.wireType == WIRE_VARINT) {
+			granularity = (long long)block.varint();
+		}
+		else if (block.field == 19 && block.wireType == WIRE_VARINT) {
+			lat_offset = (long long)block.varint();
+		}
+		else if (block.field == 20 && block.wireType == WIRE_VARINT) {
+			lon_offset = (long long)block.varint();
+		}
+		else {
+			block.skip();
+		}
+	}
+	if (block.failed()) return false;
+
+	for (int g = 0; g < groups.size(); g++) {
+		PbfReader& group = groups[g];
+		while (group.next()) {
+			if (group.field == 1 && group.wireType == WIRE_BYTES && elements != OSMStreamParser::WAYS_ONLY) {
+				// node
+				long long id = 0, lat = 0, lon = 0;
+				PbfReader node = group.message();
+				while (node.next()) {
+					if (node.wireType != WIRE_VARINT) node.skip();
+					else if (node.field == 1) id = node.svarint();
+					else if (node.field == 8) lat = node.svarint();
+					else if (node.field == 9) lon = node.svarint();
+					else node.skip();
+				}
+				if (node.failed()) return false;
+
+				parser->handleNode(id, toDegree(lon_offset, granularity, lon), toDegree(lat_offset, granularity, lat));
+			}
+			else if (group.field == 2 && group.wireType == WIRE_BYTES && elements != OSMStreamParser::WAYS_ONLY) {
+				// dense nodes, whose ids and coordinates are packed and delta-coded
+				PbfReader ids, lats, lons;
+				PbfReader dense = group.message();
+				while (dense.next()) {
+					if (dense.wireType != WIRE_BYTES) dense.skip();
+					else if (dense.field == 1) ids = dense.message();
+					else if (dense.field == 8) lats = dense.message();
+					else if (dense.field == 9) lons = dense.message();
+					else dense.skip();
+				}
+				if (dense.failed()) return false;
+
+				long long id = 0, lat = 0, lon = 0;
+				while (!ids.atEnd() && !lats.atEnd() && !lons.atEnd()) {
+					id += ids.svarint();
+					lat += lats.svarint();
+					lon += lons.svarint();
+					parser->handleNode(id, toDegree(lon_offset, granularity, lon), toDegree(lat_offset, granularity, lat));
+				}
+				if (ids.failed() || lats.failed() || lons.failed()) return false;
+			}
+			else if (group.field == 3 && group.wireType == WIRE_BYTES) {
+				// way, whose tags refer to the string table and whose refs are packed and delta-coded
+				unsigned long long id = 0;
+				PbfReader keys, vals, refs;
+				PbfReader way = group.message();
+				while (way.next()) {
+					if (way.field == 1 && way.wireType == WIRE_VARINT) id = way.varint();
+					else if (way.field == 2 && way.wireType == WIRE_BYTES) keys = way.message();
+					else if (way.field == 3 && way.wireType == WIRE_BYTES) vals = way.message();
+					else if (way.field == 8 && way.wireType == WIRE_BYTES) refs = way.message();
+					else way.skip();
+				}
+				if (way.failed()) return false;
+
+				parser->handleWay(id);
+				if (elements != OSMStreamParser::NODES_ONLY) {
+					while (!keys.atEnd() && !vals.atEnd()) {
+						unsigned long long key = keys.varint();
+						unsigned long long val = vals.varint();
+						if (key >= strings.size() || val >= strings.size()) return false;
+
+						parser->handleTag(strings[key].first, strings[key].second, strings[val].first, strings[val].second);
+					}
+
+					long long ref = 0;
+					while (!refs.atEnd()) {
+						ref += refs.svarint();
+						parser->handleNd(ref);
+					}
+					if (keys.failed() || vals.failed() || refs.failed()) return false;
+				}
+				parser->handleWayEnd();
+			}
+			else {
+				// relations and changesets are not used
+				group.skip();
+			}
+		}
+		if (group.failed()) return false;
+	}
+
+	return true;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <vector>
+#include <QString>
+#include <QByteArray>
+#include "OSMRoadsParser.h"
+
+/**
+* Parser for OSM PBF files (.osm.pbf).
+* The protobuf messages are decoded directly without any generated code, and the zlib-compressed blobs are inflated
+* by qUncompress. Plain nodes, dense nodes and ways are passed to the handlers of OSMRoadsParser, so the graph is built
+* by the same rules as the XML path.
+* The data blocks are decoded on multiple threads into OSMRoadsChunk, and added to the graph in the file order.
+*/
+class OSMPbfParser {
+private:
+	struct Block {
+		const char* data;
+		int size;
+	};
+
+	OSMRoadsParser* handler;
+	bool usedNodesOnly;
+	int numThreads;
+	size_t bufferMemory;
+
+public:
+	OSMPbfParser(OSMRoadsParser* handler, bool usedNodesOnly = false, int numThreads = 0);
+
+	bool parse(const QString& filename);
+	bool parse(const char* data, qint64 size);
+	size_t bufferMemoryUsage() const { return bufferMemory; }
+
+	static bool decodeBlob(const char* data, int size, QByteArray& block);
+
+private:
+	bool readBlocks(const std::vector<Block>& blocks, int begin, int end, int elements, const OSMNodeTable* nodeFilter, std::vector<OSMRoadsChunk>& chunks);
+	bool parseHeaderBlock(const char* data, int size);
+	static bool parsePrimitiveBlock(const char* data, int size, OSMRoadsParser* parser, int elements);
+};
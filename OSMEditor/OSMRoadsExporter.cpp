@@ -1,30 +1,36 @@
 #include "OSMRoadsExporter.h"
 #include <QFile>
-#include <QTextStream>
+#include "BufferedWriter.h"
 
+/**
+* Write the roads to the OSM file.
+* The elements are written to the file through a small buffer as soon as they are generated, so the extra memory does
+* not depend on the size of the graph. The output is the same as the one QDomDocument used to produce.
+*/
 void OSMRoadsExporter::save(const QString& filename, const RoadGraph& roads) {
+	ScopedTimer timer(Instrumentation::TIMER_EXPORT);
 	QFile file(filename);
 	if (!file.open(QFile::WriteOnly)) throw "File cannot open.";
 
-	QDomDocument doc;
+	BufferedWriter out(&file);
 
 	// set root node
-	QDomElement root = doc.createElement("osm");
-	root.setAttribute("generator", "OSM Editor");
-	root.setAttribute("version", "0.6");
-	doc.appendChild(root);
+	out.write("<osm generator=\"OSM Editor\" version=\"0.6\">\n");
 
 	// calculate the bounding box
 	double minlon, maxlon, minlat, maxlat;
 	calculateBounds(roads, minlon, maxlon, minlat, maxlat);
 
 	// write boundary
-	QDomElement bounds = doc.createElement("bounds");
-	bounds.setAttribute("minlon", minlon);
-	bounds.setAttribute("maxlon", maxlon);
-	bounds.setAttribute("minlat", minlat);
-	bounds.setAttribute("maxlat", maxlat);
-	root.appendChild(bounds);
+	out.write("    <bounds minlon=\"");
+	out.writeDouble(minlon);
+	out.write("\" maxlon=\"");
+	out.writeDouble(maxlon);
+	out.write("\" minlat=\"");
+	out.writeDouble(minlat);
+	out.write("\" maxlat=\"");
+	out.writeDouble(maxlat);
+	out.write("\"/>\n");
 
 	int node_id = 0;
 
@@ -33,12 +39,7 @@ void OSMRoadsExporter::save(const QString& filename, const RoadGraph& roads) {
 	for (boost::tie(vi, vend) = boost::vertices(roads.graph); vi != vend; vi++) {
 		if (!roads.graph[*vi]->valid) continue;
 
-		QDomElement node = doc.createElement("node");
-		node.setAttribute("id", *vi);
-		std::pair<double, double> lonlat = RoadGraph::projMeterToLatLon(roads.graph[*vi]->pt, roads.centerLonLat);
-		node.setAttribute("lon", lonlat.first);
-		node.setAttribute("lat", lonlat.second);
-		root.appendChild(node);
+		writeNode(out, *vi, RoadGraph::projMeterToLatLon(roads.graph[*vi]->pt, roads.centerLonLat));
 
 		node_id = std::max(node_id, (int)*vi);
 	}
@@ -56,77 +57,74 @@ void OSMRoadsExporter::save(const QString& filename, const RoadGraph& roads) {
 		RoadVertexDesc tgt = boost::target(*ei, roads.graph);
 		if (!roads.graph[src]->valid || !roads.graph[tgt]->valid) continue;
 
-		QDomElement way = doc.createElement("way");
-		way.setAttribute("id", way_id++);
-
-		if ((roads.graph[*ei]->polyline[0] - roads.graph[src]->pt).lengthSquared() < (roads.graph[*ei]->polyline[0] - roads.graph[tgt]->pt).lengthSquared()) {
-			QDomElement nd = doc.createElement("nd");
-			nd.setAttribute("ref", src);
-			way.appendChild(nd);
-		}
-		else {
-			QDomElement nd = doc.createElement("nd");
-			nd.setAttribute("ref", tgt);
-			way.appendChild(nd);
-		}
-
-		for (int i = 1; i < roads.graph[*ei]->polyline.size() - 1; i++) {
-			QDomElement node = doc.createElement("node");
-			node.setAttribute("id", node_id);
-			std::pair<double, double> lonlat = RoadGraph::projMeterToLatLon(roads.graph[*ei]->polyline[i], roads.centerLonLat);
-			node.setAttribute("lon", lonlat.first);
-			node.setAttribute("lat", lonlat.second);
-			root.appendChild(node);
-
-			QDomElement nd = doc.createElement("nd");
-			nd.setAttribute("ref", node_id);
-			way.appendChild(nd);
+		const std::vector<QVector2D>& polyline = roads.graph[*ei]->polyline;
 
+		// The intermediate points of the polyline are written as nodes before the way, which refers to them.
+		int first_node_id = node_id;
+		for (int i = 1; i < polyline.size() - 1; i++) {
+			writeNode(out, node_id, RoadGraph::projMeterToLatLon(polyline[i], roads.centerLonLat));
 			node_id++;
 		}
 
-		if ((roads.graph[*ei]->polyline[0] - roads.graph[src]->pt).lengthSquared() < (roads.graph[*ei]->polyline[0] - roads.graph[tgt]->pt).lengthSquared()) {
-			QDomElement nd = doc.createElement("nd");
-			nd.setAttribute("ref", tgt);
-			way.appendChild(nd);
+		// orient the end points in the same direction as the polyline
+		if ((polyline[0] - roads.graph[src]->pt).lengthSquared() >= (polyline[0] - roads.graph[tgt]->pt).lengthSquared()) {
+			std::swap(src, tgt);
 		}
-		else {
-			QDomElement nd = doc.createElement("nd");
-			nd.setAttribute("ref", src);
-			way.appendChild(nd);
+
+		out.write("    <way id=\"");
+		out.writeInt(way_id++);
+		out.write("\">\n");
+
+		writeNd(out, src);
+		for (int id = first_node_id; id < node_id; id++) {
+			writeNd(out, id);
 		}
+		writeNd(out, tgt);
 
-		QDomElement tag_highway = doc.createElement("tag");
-		tag_highway.setAttribute("k", "highway");
+		out.write("        <tag k=\"highway\"");
 		if (roads.graph[*ei]->type == RoadEdge::TYPE_HIGHWAY) {
-			tag_highway.setAttribute("v", "trunk");
+			out.write(" v=\"trunk\"");
 		}
 		else if (roads.graph[*ei]->type == RoadEdge::TYPE_BOULEVARD) {
-			tag_highway.setAttribute("v", "primary");
+			out.write(" v=\"primary\"");
 		}
 		else if (roads.graph[*ei]->type == RoadEdge::TYPE_AVENUE) {
-			tag_highway.setAttribute("v", "secondary");
+			out.write(" v=\"secondary\"");
 		}
 		else if (roads.graph[*ei]->type == RoadEdge::TYPE_STREET) {
-			tag_highway.setAttribute("v", "residential");
+			out.write(" v=\"residential\"");
 		}
-		way.appendChild(tag_highway);
+		out.write("/>\n");
 
-		QDomElement tag_lanes = doc.createElement("tag");
-		tag_lanes.setAttribute("k", "lanes");
-		tag_lanes.setAttribute("v", roads.graph[*ei]->lanes);
-		way.appendChild(tag_lanes);
+		out.write("        <tag k=\"lanes\" v=\"");
+		out.writeInt(roads.graph[*ei]->lanes);
+		out.write("\"/>\n");
 
-		QDomElement tag_oneway = doc.createElement("tag");
-		tag_oneway.setAttribute("k", "oneway");
-		tag_oneway.setAttribute("v", roads.graph[*ei]->oneWay ? "yes" : "no");
-		way.appendChild(tag_oneway);
+		out.write("        <tag k=\"oneway\" v=\"");
+		out.write(roads.graph[*ei]->oneWay ? "yes" : "no");
+		out.write("\"/>\n");
 
-		root.appendChild(way);
+		out.write("    </way>\n");
 	}
 
-	QTextStream out(&file);
-	doc.save(out, 4);
+	out.write("</osm>\n");
+	if (!out.flush()) throw "File cannot be written.";
+}
+
+void OSMRoadsExporter::writeNode(BufferedWriter& out, unsigned long long id, const std::pair<double, double>& lonlat) {
+	out.write("    <node id=\"");
+	out.writeInt(id);
+	out.write("\" lon=\"");
+	out.writeDouble(lonlat.first);
+	out.write("\" lat=\"");
+	out.writeDouble(lonlat.second);
+	out.write("\"/>\n");
+}
+
+void OSMRoadsExporter::writeNd(BufferedWriter& out, unsigned long long ref) {
+	out.write("        <nd ref=\"");
+	out.writeInt(ref);
+	out.write("\"/>\n");
 }
 
 void OSMRoadsExporter::calculateBounds(const RoadGraph& roads, double& minlon, double& maxlon, double& minlat, double& maxlat) {
@@ -1,8 +1,10 @@
 #pragma once
 
-#include <QDomDocument>
+#include <QString>
 #include "RoadGraph.h"
 
+class BufferedWriter;
+
 class OSMRoadsExporter {
 public:
 	OSMRoadsExporter() {}
@@ -10,5 +12,9 @@ public:
 public:
 	static void save(const QString& filename, const RoadGraph& roads);
 	static void calculateBounds(const RoadGraph& roads, double& minlon, double& maxlon, double& minlat, double& maxlat);
+
+private:
+	static void writeNode(BufferedWriter& out, unsigned long long id, const std::pair<double, double>& lonlat);
+	static void writeNd(BufferedWriter& out, unsigned long long ref);
 };
 
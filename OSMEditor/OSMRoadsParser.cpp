@@ -7,6 +7,11 @@ double OSMRoadsParser::M_PI = 3.141592653;
 
 OSMRoadsParser::OSMRoadsParser(RoadGraph* roads) {
 	this->roads = roads;
+	scanningUsedNodes = false;
+	usedNodesOnly = false;
+	chunk = NULL;
+	chunkNodeFilter = NULL;
+	progress = NULL;
 
 	way.parentNodeName = "osm";
 }
@@ -40,32 +45,146 @@ bool OSMRoadsParser::endElement(const QString& namespaceURI, const QString& loca
 	if (localName == "way") {
 		way.parentNodeName = "osm";
 
-		createRoadEdge();
+		handleWayEnd();
 	}
 
 	return true;
 }
 
 void OSMRoadsParser::handleBounds(const QXmlAttributes &atts) {
-	float minlat = atts.value("minlat").toFloat();
-	float maxlat = atts.value("maxlat").toFloat();
-	float minlon = atts.value("minlon").toFloat();
-	float maxlon = atts.value("maxlon").toFloat();
-	roads->centerLonLat = QVector2D((minlon + maxlon) * 0.5, (minlat + maxlat) * 0.5);
+	handleBounds(atts.value("minlat").toFloat(), atts.value("maxlat").toFloat(), atts.value("minlon").toFloat(), atts.value("maxlon").toFloat());
 }
 
 void OSMRoadsParser::handleNode(const QXmlAttributes &atts) {
-	unsigned long long id = atts.value("id").toULongLong();
-	QVector2D pos = RoadGraph::projLatLonToMeter(atts.value("lon").toDouble(), atts.value("lat").toDouble(), roads->centerLonLat);
+	handleNode(atts.value("id").toULongLong(), atts.value("lon").toDouble(), atts.value("lat").toDouble());
+}
+
+void OSMRoadsParser::handleWay(const QXmlAttributes &atts) {
+	handleWay(atts.value("id").toULongLong());
+}
+
+void OSMRoadsParser::handleNd(const QXmlAttributes &atts) {
+	handleNd(atts.value("ref").toULongLong());
+}
 
-	idToActualId.insert(id, id);
+void OSMRoadsParser::handleTag(const QXmlAttributes &atts) {
+	QByteArray key = atts.value("k").toUtf8();
+	QByteArray value = atts.value("v").toUtf8();
+	handleTag(key.constData(), key.size(), value.constData(), value.size());
+}
+
+/**
+* Allocate the node list for the expected number of nodes in advance.
+*/
+void OSMRoadsParser::reserveNodes(int num_nodes) {
+	nodeTable.reserve(num_nodes);
+}
+
+/**
+* Start collecting the nodes which the roads refer to.
+* Until endUsedNodeScan() is called, the ways only register their node ids, and no edge is created.
+*/
+void OSMRoadsParser::beginUsedNodeScan() {
+	scanningUsedNodes = true;
+}
+
+/**
+* Finish collecting the nodes. After this, the coordinates are stored only for the collected nodes.
+*/
+void OSMRoadsParser::endUsedNodeScan() {
+	scanningUsedNodes = false;
+	usedNodesOnly = true;
+}
+
+/**
+* Record the nodes and the roads to the chunk instead of adding them, so that this parser can read a part of the file
+* in a worker thread. The graph is not modified, and only its centerLonLat is read.
+* If nodeFilter is specified, the nodes which are not in it are not recorded.
+*/
+void OSMRoadsParser::recordTo(OSMRoadsChunk* chunk, const OSMNodeTable* nodeFilter) {
+	this->chunk = chunk;
+	this->chunkNodeFilter = nodeFilter;
+}
+
+/**
+* Register the nodes which the roads in the chunk refer to, as the used node scan does.
+*/
+void OSMRoadsParser::addUsedNodes(const OSMRoadsChunk& chunk) {
+	for (int i = 0; i < chunk.roads.size(); i++) {
+		for (int k = chunk.roads[i].ndsBegin; k < chunk.roads[i].ndsEnd; k++) {
+			nodeTable.insertId(chunk.nds[k]);
+		}
+	}
+}
+
+/**
+* Add the nodes and the roads in the chunk in the same order as they appear in the file,
+* so that the graph is the same as the one built by parsing the file serially.
+*/
+void OSMRoadsParser::addChunk(const OSMRoadsChunk& chunk) {
+	ScopedTimer timer(Instrumentation::TIMER_ADD_CHUNK);
+	int n = 0;
+	for (int i = 0; i < chunk.roads.size(); i++) {
+		const OSMRoadsChunk::Road& road = chunk.roads[i];
+		for (; n < chunk.nodes.size() && chunk.nodes[n].numWaysBefore <= road.wayIndex; n++) {
+			storeNode(chunk.nodes[n].id, chunk.nodes[n].pt);
+		}
+
+		way.isStreet = true;
+		way.type = road.type;
+		way.lanes = road.lanes;
+		way.oneWay = road.oneWay;
+		way.link = road.link;
+		way.roundabout = road.roundabout;
+		way.nds.assign(chunk.nds.begin() + road.ndsBegin, chunk.nds.begin() + road.ndsEnd);
+		createRoadEdge();
+	}
+
+	for (; n < chunk.nodes.size(); n++) {
+		storeNode(chunk.nodes[n].id, chunk.nodes[n].pt);
+	}
+}
+
+void OSMRoadsParser::handleBounds(float minlat, float maxlat, float minlon, float maxlon) {
+	roads->centerLonLat = QVector2D((minlon + maxlon) * 0.5, (minlat + maxlat) * 0.5);
+}
+
+void OSMRoadsParser::handleNode(unsigned long long id, double lon, double lat) {
+	if (chunk != NULL) {
+		if (chunkNodeFilter != NULL && chunkNodeFilter->find(id) < 0) return;
+
+		OSMRoadsChunk::Node node;
+		node.id = id;
+		node.pt = RoadGraph::projLatLonToMeter(lon, lat, roads->centerLonLat);
+		node.numWaysBefore = chunk->numWays;
+		chunk->nodes.push_back(node);
+		return;
+	}
+
+	storeNode(id, RoadGraph::projLatLonToMeter(lon, lat, roads->centerLonLat));
+}
+
+/**
+* Store the coordinates of the node.
+* In the used-nodes-only mode, the nodes which were not collected by the scan are ignored.
+*/
+void OSMRoadsParser::storeNode(unsigned long long id, const QVector2D& pt) {
+	if (usedNodesOnly) {
+		int slot = nodeTable.find(id);
+		if (slot < 0) return;
+
+		nodeTable.setPt(slot, pt);
+		return;
+	}
 
 	// add a vertex
-	vertices.insert(id, RoadVertex(pos));
+	nodeTable.insert(id, pt);
 }
 
-void OSMRoadsParser::handleWay(const QXmlAttributes &atts) {
-	way.way_id = atts.value("id").toULongLong();
+void OSMRoadsParser::handleWay(unsigned long long id) {
+	if (chunk != NULL) chunk->numWays++;
+
+	way.way_id = id;
 
 	way.isStreet = false;
 	way.oneWay = false;
@@ -77,70 +196,98 @@ void OSMRoadsParser::handleWay(const QXmlAttributes &atts) {
 	way.nds.clear();
 }
 
-void OSMRoadsParser::handleNd(const QXmlAttributes &atts) {
-	QString hoge = atts.value("ref");
-	unsigned long long ref = atts.value("ref").toULongLong();
+void OSMRoadsParser::handleNd(unsigned long long ref) {
 	way.nds.push_back(ref);
 }
 
-void OSMRoadsParser::handleTag(const QXmlAttributes &atts) {
-	QString key = atts.value("k");
-	if (key == "highway") {
-		QString value = atts.value("v");
+/**
+* Update the current way according to the tag.
+* The key and the value are UTF-8 strings which are not null-terminated.
+*/
+void OSMRoadsParser::handleTag(const char* key, int key_len, const char* value, int value_len) {
+	if (equals(key, key_len, "highway")) {
 		way.isStreet = true;
-		if (value=="motorway" || value=="motorway_link" || value=="trunk") {
+		if (equals(value, value_len, "motorway") || equals(value, value_len, "motorway_link") || equals(value, value_len, "trunk")) {
 			way.type = RoadEdge::TYPE_HIGHWAY;
-		} else if (value == "trunk_link") {
+		} else if (equals(value, value_len, "trunk_link")) {
 			way.type = RoadEdge::TYPE_HIGHWAY;
 			way.link = true;
-		} else if (value=="primary") {
+		} else if (equals(value, value_len, "primary")) {
 			way.type = RoadEdge::TYPE_BOULEVARD;
-		} else if (value=="primary_link") {
+		} else if (equals(value, value_len, "primary_link")) {
 			way.type = RoadEdge::TYPE_BOULEVARD;
 			way.link = true;
-		} else if (value=="secondary") {
+		} else if (equals(value, value_len, "secondary")) {
 			way.type = RoadEdge::TYPE_AVENUE;
-		} else if (value=="secondary_link") {
+		} else if (equals(value, value_len, "secondary_link")) {
 			way.type = RoadEdge::TYPE_AVENUE;
 			way.link = true;
-		} else if (value=="tertiary") {
+		} else if (equals(value, value_len, "tertiary")) {
 			way.type = RoadEdge::TYPE_AVENUE;
-		} else if (value=="tertiary_link") {
+		} else if (equals(value, value_len, "tertiary_link")) {
 			way.type = RoadEdge::TYPE_AVENUE;
 			way.link = true;
 		}
-		else if (value == "residential" || value == "living_street" || value == "unclassified") {
+		else if (equals(value, value_len, "residential") || equals(value, value_len, "living_street") || equals(value, value_len, "unclassified")) {
 			way.type = RoadEdge::TYPE_STREET;
 		}
-		else if (value == "pedestrian") {
+		else if (equals(value, value_len, "pedestrian")) {
 			way.type = RoadEdge::TYPE_STREET;
 		} else {
 			way.type = RoadEdge::TYPE_OTHERS;
 		}
-	} else if (key == "sidewalk") {
-	} else if (key == "junction") {
-		QString value = atts.value("v");
-		if (value == "roundabout") {
+	} else if (equals(key, key_len, "junction")) {
+		if (equals(value, value_len, "roundabout")) {
 			way.roundabout = true;
 		}
-	} else if (key == "bridge") {
-	} else if (key == "bridge_number") {
-	} else if (key == "oneway") {
-		QString value = atts.value("v");
-		if (value == "yes") {
+	} else if (equals(key, key_len, "oneway")) {
+		if (equals(value, value_len, "yes")) {
 			way.oneWay = true;
 		}
-	} else if (key == "lanes") {
-		way.lanes = atts.value("v").toUInt();
-	} else if (key == "name") {
-	} else if (key == "maxspeed") {
-	} else if (key == "layer") {
-	} else {
+	} else if (equals(key, key_len, "lanes")) {
+		way.lanes = toUInt(value, value_len);
+	}
+}
+
+void OSMRoadsParser::handleWayEnd() {
+	if (chunk != NULL) {
+		if (!isRoad()) return;
+
+		OSMRoadsChunk::Road road;
+		road.wayIndex = chunk->numWays - 1;
+		road.type = way.type;
+		road.lanes = way.lanes;
+		road.oneWay = way.oneWay;
+		road.link = way.link;
+		road.roundabout = way.roundabout;
+		road.ndsBegin = chunk->nds.size();
+		chunk->nds.insert(chunk->nds.end(), way.nds.begin(), way.nds.end());
+		road.ndsEnd = chunk->nds.size();
+		chunk->roads.push_back(road);
+		return;
+	}
+
+	if (scanningUsedNodes) {
+		if (!isRoad()) return;
+
+		for (int k = 0; k < way.nds.size(); k++) {
+			nodeTable.insertId(way.nds[k]);
+		}
+		return;
 	}
+
+	createRoadEdge();
+}
+
+/**
+* Return true if the current way is a road which is added to the graph.
+*/
+bool OSMRoadsParser::isRoad() const {
+	return way.isStreet && way.type != 0;
 }
 
 void OSMRoadsParser::createRoadEdge() {
-	if (!way.isStreet || way.type == 0) return;
+	if (!isRoad()) return;
 
 	if (way.nds.size() == 0) return;
 	for (int k = 0; k < way.nds.size() - 1; k++) {
@@ -148,28 +295,30 @@ void OSMRoadsParser::createRoadEdge() {
 		unsigned long long next = way.nds[k + 1];
 
 		// check if both end points are already registered
-		if (!idToActualId.contains(id)) continue;
-		if (!idToActualId.contains(next)) continue;
+		int sourceSlot = nodeTable.find(id);
+		if (sourceSlot < 0 || !nodeTable.hasPt(sourceSlot)) continue;
+		int destSlot = nodeTable.find(next);
+		if (destSlot < 0 || !nodeTable.hasPt(destSlot)) continue;
 
 		RoadVertexDesc sourceDesc;
-		if (idToDesc.contains(id)) {		// obtain the vertex desc
-			sourceDesc = idToDesc[id];
+		if (nodeTable.vertex(sourceSlot) >= 0) {		// obtain the vertex desc
+			sourceDesc = nodeTable.vertex(sourceSlot);
 		} else {							// add a vertex
-			RoadVertexPtr v = RoadVertexPtr(new RoadVertex(vertices[id].pt));
+			RoadVertexPtr v = RoadVertexPtr(new RoadVertex(nodeTable.pt(sourceSlot)));
 			sourceDesc = boost::add_vertex(roads->graph);
 			roads->graph[sourceDesc] = v;
 
-			idToDesc.insert(id, sourceDesc);
+			nodeTable.setVertex(sourceSlot, sourceDesc);
 		}
 
 		RoadVertexDesc destDesc;
-		if (idToDesc.contains(next)) {		// obtain the vertex desc
-			destDesc = idToDesc[next];
+		if (nodeTable.vertex(destSlot) >= 0) {		// obtain the vertex desc
+			destDesc = nodeTable.vertex(destSlot);
 		} else {							// add a vertex
-			RoadVertexPtr v = RoadVertexPtr(new RoadVertex(vertices[next].pt));
+			RoadVertexPtr v = RoadVertexPtr(new RoadVertex(nodeTable.pt(destSlot)));
 			destDesc = boost::add_vertex(roads->graph);
 			roads->graph[destDesc] = v;
-			idToDesc.insert(next, destDesc);
+			nodeTable.setVertex(destSlot, destDesc);
 		}
 
 		// add a road segment
@@ -178,5 +327,26 @@ void OSMRoadsParser::createRoadEdge() {
 		e->addPoint(roads->graph[destDesc]->pt);
 		std::pair<RoadEdgeDesc, bool> edge_pair = boost::add_edge(sourceDesc, destDesc, roads->graph);
 		roads->graph[edge_pair.first] = e;
+		if (progress != NULL) progress->addEdge(e);
+	}
+}
+
+bool OSMRoadsParser::equals(const char* str, int len, const char* literal) {
+	return strlen(literal) == len && memcmp(str, literal, len) == 0;
+}
+
+/**
+* Convert the string to an unsigned integer.
+* As QString::toUInt does, return 0 if the string is not a valid number.
+*/
+uint OSMRoadsParser::toUInt(const char* str, int len) {
+	if (len == 0) return 0;
+
+	uint ret = 0;
+	for (int i = 0; i < len; i++) {
+		if (str[i] < '0' || str[i] > '9') return 0;
+		ret = ret * 10 + (str[i] - '0');
 	}
+
+	return ret;
 }
\ No newline at end of file
@@ -1,9 +1,14 @@
 #pragma once
 
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
 #include <QString>
 #include <QtXml/qxml.h>
 #include <QVector3D>
 #include "RoadGraph.h"
+#include "OSMNodeTable.h"
 
 class RoadNode;
 class RoadEdge;
@@ -21,6 +26,85 @@ typedef struct {
 	std::vector<unsigned long long> nds;
 } Way;
 
+/**
+* Nodes and roads read from a part of the OSM file, which are added to the graph later in the file order.
+*/
+struct OSMRoadsChunk {
+	struct Node {
+		unsigned long long id;
+		QVector2D pt;
+		int numWaysBefore;		// number of the ways that precede this node in the chunk
+	};
+
+	struct Road {
+		int wayIndex;			// index of the way among all the ways in the chunk
+		uint type;
+		uint lanes;
+		bool oneWay;
+		bool link;
+		bool roundabout;
+		int ndsBegin;
+		int ndsEnd;
+	};
+
+	std::vector<Node> nodes;
+	std::vector<Road> roads;
+	std::vector<unsigned long long> nds;
+	int numWays;
+
+	OSMRoadsChunk() : numWays(0) {}
+
+	size_t memoryUsage() const {
+		return nodes.capacity() * sizeof(Node) + roads.capacity() * sizeof(Road) + nds.capacity() * sizeof(unsigned long long);
+	}
+};
+
+/**
+* Progress of parsing a file on a worker thread, which the readers report through OSMRoadsParser.
+* The bytes are counted once for each pass over them, so the total is the size of the data times the number of the passes.
+* The edges added to the graph are kept until they are taken, so that the roads can be drawn while the rest of the file is parsed.
+* The readers stop at the next chunk, block, or megabyte once the parsing is canceled.
+*/
+class OSMParseProgress {
+private:
+	std::atomic<long long> bytesTotal;
+	std::atomic<long long> bytesConsumed;
+	std::atomic<bool> canceled;
+	std::mutex mutex;
+	std::vector<RoadEdgePtr> newEdges;
+
+public:
+	OSMParseProgress() : bytesTotal(0), bytesConsumed(0), canceled(false) {}
+
+	void reset() {
+		bytesTotal = 0;
+		bytesConsumed = 0;
+		canceled = false;
+		std::lock_guard<std::mutex> lock(mutex);
+		newEdges.clear();
+	}
+	void setTotal(long long bytes) { bytesTotal = bytes; }
+	void consume(long long bytes) { bytesConsumed.fetch_add(bytes, std::memory_order_relaxed); }
+	long long total() const { return bytesTotal; }
+	long long consumed() const { return std::min(bytesConsumed.load(std::memory_order_relaxed), bytesTotal.load()); }
+	void cancel() { canceled = true; }
+	bool isCanceled() const { return canceled.load(std::memory_order_relaxed); }
+
+	void addEdge(const RoadEdgePtr& edge) {
+		std::lock_guard<std::mutex> lock(mutex);
+		newEdges.push_back(edge);
+	}
+
+	/**
+	* Append the edges added since the last call to the list.
+	*/
+	void takeEdges(std::vector<RoadEdgePtr>& edges) {
+		std::lock_guard<std::mutex> lock(mutex);
+		edges.insert(edges.end(), newEdges.begin(), newEdges.end());
+		newEdges.clear();
+	}
+};
+
 class OSMRoadsParser : public QXmlDefaultHandler {
 private:
 	static double M_PI;
@@ -35,9 +119,22 @@ private:
 	RoadGraph* roads;
 
 	/** temporary node list */
-	QMap<unsigned long long, RoadVertexDesc> idToDesc;
-	QMap<unsigned long long, unsigned long long> idToActualId;
-	QMap<unsigned long long, RoadVertex> vertices;
+	OSMNodeTable nodeTable;
+
+	/** true while collecting the nodes referred by the roads, during which no edge is created */
+	bool scanningUsedNodes;
+
+	/** true if only the nodes collected by the scan are stored */
+	bool usedNodesOnly;
+
+	/** if not NULL, the nodes and the roads are recorded to this chunk instead of being added */
+	OSMRoadsChunk* chunk;
+
+	/** if not NULL, only the nodes in this table are recorded to the chunk */
+	const OSMNodeTable* chunkNodeFilter;
+
+	/** if not NULL, the readers report their progress to this, and the new edges are added to it as well */
+	OSMParseProgress* progress;
 
 public:
 	/** node list to be output to XML file */
@@ -53,12 +150,39 @@ public:
 	bool characters(const QString &ch_in);
 	bool endElement(const QString&, const QString& localName, const QString& qName);
 
+	void reserveNodes(int num_nodes);
+	void beginUsedNodeScan();
+	void endUsedNodeScan();
+	void recordTo(OSMRoadsChunk* chunk, const OSMNodeTable* nodeFilter = NULL);
+	void addUsedNodes(const OSMRoadsChunk& chunk);
+	void addChunk(const OSMRoadsChunk& chunk);
+	const OSMNodeTable& getNodeTable() const { return nodeTable; }
+	RoadGraph* getRoads() const { return roads; }
+	void setProgress(OSMParseProgress* progress) { this->progress = progress; }
+	OSMParseProgress* getProgress() const { return progress; }
+	bool isCanceled() const { return progress != NULL && progress->isCanceled(); }
+	int numStoredNodes() const { return nodeTable.size(); }
+	size_t nodeMemoryUsage() const { return nodeTable.memoryUsage(); }
+
+	// handlers which take already parsed values, so that other readers can share the same rules
+	void handleBounds(float minlat, float maxlat, float minlon, float maxlon);
+	void handleNode(unsigned long long id, double lon, double lat);
+	void handleWay(unsigned long long id);
+	void handleNd(unsigned long long ref);
+	void handleTag(const char* key, int key_len, const char* value, int value_len);
+	void handleWayEnd();
+
 private:
 	void handleBounds(const QXmlAttributes &atts);
 	void handleNode(const QXmlAttributes &atts);
 	void handleWay(const QXmlAttributes &atts);
 	void handleNd(const QXmlAttributes &atts);
 	void handleTag(const QXmlAttributes &atts);
+	void storeNode(unsigned long long id, const QVector2D& pt);
+	bool isRoad() const;
 	void createRoadEdge();
+
+	static bool equals(const char* str, int len, const char* literal);
+	static uint toUInt(const char* str, int len);
 };
 
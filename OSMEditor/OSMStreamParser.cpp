@@ -0,0 +1,345 @@
+#include "OSMStreamParser.h"
+#include <QByteArray>
+#include <string.h>
+#include "MappedFile.h"
+
+namespace {
+	/** number of the bytes between the reports of the progress, at which the parsing stops if it is canceled */
+	const qint64 PROGRESS_INTERVAL = 1024 * 1024;
+}
+
+namespace {
+	const double POW10[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+
+	inline bool isSpace(char c) {
+		return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+	}
+
+	inline bool equals(const char* str, int len, const char* literal, int literal_len) {
+		return len == literal_len && memcmp(str, literal, len) == 0;
+	}
+
+	/**
+	* Return the pointer to the first occurrence of the pattern, or end if it is not found.
+	*/
+	const char* find(const char* p, const char* end, const char* pattern, int pattern_len) {
+		while (p + pattern_len <= end) {
+			p = (const char*)memchr(p, pattern[0], end - p);
+			if (p == NULL || p + pattern_len > end) break;
+			if (memcmp(p, pattern, pattern_len) == 0) return p;
+			p++;
+		}
+		return end;
+	}
+}
+
+OSMStreamParser::OSMStreamParser(OSMRoadsParser* handler, bool usedNodesOnly) {
+	this->handler = handler;
+	this->usedNodesOnly = usedNodesOnly;
+	elements = ALL_ELEMENTS;
+}
+
+/**
+* Parse the OSM file, which is memory-mapped by MappedFile.
+*
+* @return		false if the file cannot be opened
+*/
+bool OSMStreamParser::parse(const QString& filename) {
+	ScopedTimer timer(Instrumentation::TIMER_PARSE);
+	MappedFile file(filename);
+	if (!file.open()) return false;
+	if (file.size() == 0) return true;
+
+	parse(file.data(), file.size());
+
+	return true;
+}
+
+/**
+* Parse the OSM XML data in the buffer.
+*/
+void OSMStreamParser::parse(const char* data, qint64 size) {
+	if (handler->getProgress() != NULL) handler->getProgress()->setTotal(usedNodesOnly ? size * 2 : size);
+
+	if (usedNodesOnly) {
+		// collect the nodes referred by the roads, so that the table grows only to their number
+		handler->beginUsedNodeScan();
+		scan(data, size, WAYS_ONLY);
+		handler->endUsedNodeScan();
+		if (handler->isCanceled()) return;
+	}
+	else {
+		// A node element with its attributes takes at least about 150 bytes, so this is enough for most files.
+		handler->reserveNodes(size / 150);
+	}
+
+	scan(data, size);
+}
+
+/**
+* Pass the elements in the buffer to the handler.
+* The buffer has to start outside of any element, e.g. at a position returned by findTopLevelElement().
+* WAYS_ONLY skips nodes and bounds, and NODES_ONLY skips bounds and the nds and tags of ways, but still
+* reports the start and the end of each way so that the handler can count them.
+* If the handler has the progress, the bytes are reported to it every PROGRESS_INTERVAL, and the scan stops there once it is canceled.
+*/
+void OSMStreamParser::scan(const char* data, qint64 size, int elements) {
+	this->elements = elements;
+
+	const char* p = data;
+	const char* end = data + size;
+	bool in_way = false;
+	OSMParseProgress* progress = handler->getProgress();
+	const char* reported = data;
+
+	while (p < end) {
+		p = (const char*)memchr(p, '<', end - p);
+		if (p == NULL) break;
+
+		p = parseElement(p + 1, end, in_way);
+
+		if (progress != NULL && p - reported >= PROGRESS_INTERVAL) {
+			progress->consume(p - reported);
+			reported = p;
+			if (progress->isCanceled()) return;
+		}
+	}
+
+	if (progress != NULL) progress->consume(end - reported);
+}
+
+/**
+* Return the pointer to the '<' of the first node, way or relation element at or after p, or end if there is none.
+* Since these elements are direct children of the osm element, the data can be split into chunks at these positions.
+*/
+const char* OSMStreamParser::findTopLevelElement(const char* p, const char* end) {
+	while (p < end) {
+		p = (const char*)memchr(p, '<', end - p);
+		if (p == NULL) return end;
+
+		const char* name = p + 1;
+		const char* q = name;
+		while (q < end && *q != '>' && *q != '/' && !isSpace(*q)) q++;
+		if (q < end && (equals(name, q - name, "node", 4) || equals(name, q - name, "way", 3) || equals(name, q - name, "relation", 8))) {
+			return p;
+		}
+
+		p = q;
+	}
+
+	return end;
+}
+
+/**
+* Parse an element which starts right after '<', and return the pointer right after its '>'.
+*/
+const char* OSMStreamParser::parseElement(const char* p, const char* end, bool& in_way) {
+	if (p >= end) return end;
+
+	// skip comments, declarations and processing instructions
+	if (*p == '!') {
+		if (end - p >= 3 && p[1] == '-' && p[2] == '-') {
+			p = find(p + 3, end, "-->", 3);
+			return p == end ? end : p + 3;
+		}
+		p = (const char*)memchr(p, '>', end - p);
+		return p == NULL ? end : p + 1;
+	}
+	if (*p == '?') {
+		p = find(p + 1, end, "?>", 2);
+		return p == end ? end : p + 2;
+	}
+
+	// end tag
+	if (*p == '/') {
+		const char* name = ++p;
+		while (p < end && *p != '>' && !isSpace(*p)) p++;
+		if (in_way && equals(name, p - name, "way", 3)) {
+			in_way = false;
+			handler->handleWayEnd();
+		}
+		p = (const char*)memchr(p, '>', end - p);
+		return p == NULL ? end : p + 1;
+	}
+
+	// start tag
+	// skipped elements are not even tokenized
+	const char* name = p;
+	while (p < end && *p != '>' && *p != '/' && !isSpace(*p)) p++;
+	int name_len = p - name;
+
+	const char* attr_name;
+	int attr_name_len;
+	const char* value;
+	int value_len;
+
+	if (elements != NODES_ONLY && equals(name, name_len, "nd", 2)) {
+		while (nextAttribute(p, end, attr_name, attr_name_len, value, value_len)) {
+			if (!in_way) continue;
+
+			unsigned long long ref;
+			if (equals(attr_name, attr_name_len, "ref", 3) && parseULongLong(value, value + value_len, ref)) {
+				handler->handleNd(ref);
+			}
+		}
+	}
+	else if (elements != WAYS_ONLY && equals(name, name_len, "node", 4)) {
+		unsigned long long id = 0;
+		double lon = 0.0;
+		double lat = 0.0;
+		while (nextAttribute(p, end, attr_name, attr_name_len, value, value_len)) {
+			if (equals(attr_name, attr_name_len, "id", 2)) {
+				parseULongLong(value, value + value_len, id);
+			}
+			else if (equals(attr_name, attr_name_len, "lon", 3)) {
+				parseDouble(value, value + value_len, lon);
+			}
+			else if (equals(attr_name, attr_name_len, "lat", 3)) {
+				parseDouble(value, value + value_len, lat);
+			}
+		}
+		handler->handleNode(id, lon, lat);
+	}
+	else if (elements != NODES_ONLY && equals(name, name_len, "tag", 3)) {
+		const char* key = NULL;
+		int key_len = 0;
+		const char* val = NULL;
+		int val_len = 0;
+		while (nextAttribute(p, end, attr_name, attr_name_len, value, value_len)) {
+			if (equals(attr_name, attr_name_len, "k", 1)) {
+				key = value;
+				key_len = value_len;
+			}
+			else if (equals(attr_name, attr_name_len, "v", 1)) {
+				val = value;
+				val_len = value_len;
+			}
+		}
+		if (in_way && key != NULL) {
+			handler->handleTag(key, key_len, val, val_len);
+		}
+	}
+	else if (equals(name, name_len, "way", 3)) {
+		unsigned long long id = 0;
+		while (nextAttribute(p, end, attr_name, attr_name_len, value, value_len)) {
+			if (equals(attr_name, attr_name_len, "id", 2)) {
+				parseULongLong(value, value + value_len, id);
+			}
+		}
+		handler->handleWay(id);
+		in_way = true;
+
+		// an empty way ends here
+		if (p < end && *p == '/') {
+			in_way = false;
+			handler->handleWayEnd();
+		}
+	}
+	else if (elements == ALL_ELEMENTS && equals(name, name_len, "bounds", 6)) {
+		double minlat = 0.0;
+		double maxlat = 0.0;
+		double minlon = 0.0;
+		double maxlon = 0.0;
+		while (nextAttribute(p, end, attr_name, attr_name_len, value, value_len)) {
+			if (equals(attr_name, attr_name_len, "minlat", 6)) {
+				parseDouble(value, value + value_len, minlat);
+			}
+			else if (equals(attr_name, attr_name_len, "maxlat", 6)) {
+				parseDouble(value, value + value_len, maxlat);
+			}
+			else if (equals(attr_name, attr_name_len, "minlon", 6)) {
+				parseDouble(value, value + value_len, minlon);
+			}
+			else if (equals(attr_name, attr_name_len, "maxlon", 6)) {
+				parseDouble(value, value + value_len, maxlon);
+			}
+		}
+		handler->handleBounds(minlat, maxlat, minlon, maxlon);
+	}
+
+	p = (const char*)memchr(p, '>', end - p);
+	return p == NULL ? end : p + 1;
+}
+
+/**
+* Read the next attribute of the start tag, and advance p to the end of the attribute.
+* When there is no more attribute, return false, and p points to '/' or '>' of the tag.
+*/
+bool OSMStreamParser::nextAttribute(const char*& p, const char* end, const char*& name, int& name_len, const char*& value, int& value_len) {
+	while (p < end && isSpace(*p)) p++;
+	if (p >= end || *p == '>' || *p == '/') return false;
+
+	name = p;
+	while (p < end && *p != '=' && *p != '>' && !isSpace(*p)) p++;
+	name_len = p - name;
+
+	while (p < end && *p != '"' && *p != '\'' && *p != '>') p++;
+	if (p >= end || *p == '>') return false;
+
+	char quote = *p++;
+	value = p;
+	p = (const char*)memchr(p, quote, end - p);
+	if (p == NULL) {
+		p = end;
+		return false;
+	}
+
+	value_len = p - value;
+	p++;
+	return true;
+}
+
+/**
+* Parse the unsigned integer in [str, end).
+*
+* @return		false if the string does not start with a digit
+*/
+bool OSMStreamParser::parseULongLong(const char* str, const char* end, unsigned long long& value) {
+	if (str >= end || *str < '0' || *str > '9') return false;
+
+	value = 0;
+	for (; str < end && *str >= '0' && *str <= '9'; str++) {
+		value = value * 10 + (*str - '0');
+	}
+
+	return true;
+}
+
+/**
+* Parse the decimal number in [str, end).
+* Numbers with up to 15 significant digits and no exponent, which covers the coordinates in OSM files,
+* are converted by one exact division, which gives the same result as QString::toDouble.
+* Other numbers fall back to QByteArray::toDouble.
+*
+* @return		false if the string is not a number
+*/
+bool OSMStreamParser::parseDouble(const char* str, const char* end, double& value) {
+	const char* p = str;
+	bool negative = false;
+	if (p < end && (*p == '-' || *p == '+')) {
+		negative = *p == '-';
+		p++;
+	}
+
+	unsigned long long mantissa = 0;
+	int num_digits = 0;
+	int num_decimals = 0;
+	for (; p < end && *p >= '0' && *p <= '9'; p++, num_digits++) {
+		if (num_digits < 18) mantissa = mantissa * 10 + (*p - '0');
+	}
+	if (p < end && *p == '.') {
+		for (p++; p < end && *p >= '0' && *p <= '9'; p++, num_digits++, num_decimals++) {
+			if (num_digits < 18) mantissa = mantissa * 10 + (*p - '0');
+		}
+	}
+
+	if (p == end && num_digits > 0 && num_digits <= 15 && num_decimals <= 22) {
+		value = (double)mantissa / POW10[num_decimals];
+		if (negative) value = -value;
+		return true;
+	}
+
+	bool ok;
+	value = QByteArray::fromRawData(str, end - str).toDouble(&ok);
+	return ok;
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <QString>
+#include "OSMRoadsParser.h"
+
+/**
+* Pull parser for OSM XML files.
+* The file is memory-mapped, and the elements and attributes which OSMRoadsParser needs are recognized by their bytes
+* without converting them to QString. Everything else in the file is skipped.
+* In the used-nodes-only mode, the file is scanned twice: the first pass reads only the ways to collect the nodes
+* which the roads refer to, and the second pass stores the coordinates of those nodes only.
+*/
+class OSMStreamParser {
+private:
+	OSMRoadsParser* handler;
+	bool usedNodesOnly;
+	int elements;
+
+public:
+	/** elements which scan() passes to the handler */
+	enum { ALL_ELEMENTS = 0, WAYS_ONLY, NODES_ONLY };
+
+public:
+	OSMStreamParser(OSMRoadsParser* handler, bool usedNodesOnly = false);
+
+	bool parse(const QString& filename);
+	void parse(const char* data, qint64 size);
+	void scan(const char* data, qint64 size, int elements = ALL_ELEMENTS);
+
+	static const char* findTopLevelElement(const char* p, const char* end);
+
+	static bool parseULongLong(const char* str, const char* end, unsigned long long& value);
+	static bool parseDouble(const char* str, const char* end, double& value);
+
+private:
+	const char* parseElement(const char* p, const char* end, bool& in_way);
+	static bool nextAttribute(const char*& p, const char* end, const char*& name, int& name_len, const char*& value, int& value_len);
+};
@@ -1,4 +1,5 @@
 #include "PropertyWidget.h"
+#include "MainWindow.h"
 
 PropertyWidget::PropertyWidget(MainWindow* mainWin) : QDockWidget("Property Window", (QWidget*)mainWin) {
 	this->mainWin = mainWin;
@@ -37,19 +38,23 @@ void PropertyWidget::setRoadEdge(RoadEdgePtr edge) {
 
 void PropertyWidget::onApply() {
 	if (edge) {
+		// The edge is updated through the canvas so that the change is recorded to the history and the snapshots.
+		RoadEdge new_edge = *edge;
 		if (ui.comboBoxEdgeType->currentIndex() == 0) {
-			edge->type = RoadEdge::TYPE_HIGHWAY;
+			new_edge.type = RoadEdge::TYPE_HIGHWAY;
 		}
 		else if (ui.comboBoxEdgeType->currentIndex() == 1) {
-			edge->type = RoadEdge::TYPE_BOULEVARD;
+			new_edge.type = RoadEdge::TYPE_BOULEVARD;
 		}
 		else if (ui.comboBoxEdgeType->currentIndex() == 2) {
-			edge->type = RoadEdge::TYPE_AVENUE;
+			new_edge.type = RoadEdge::TYPE_AVENUE;
 		}
 		else if (ui.comboBoxEdgeType->currentIndex() == 3) {
-			edge->type = RoadEdge::TYPE_STREET;
+			new_edge.type = RoadEdge::TYPE_STREET;
 		}
-		edge->lanes = ui.spinBoxNumLanes->value();
-		edge->oneWay = ui.checkBoxOneWay->isChecked();
+		new_edge.lanes = ui.spinBoxNumLanes->value();
+		new_edge.oneWay = ui.checkBoxOneWay->isChecked();
+
+		mainWin->canvas->updateEdge(edge, new_edge);
 	}
 }
\ No newline at end of file
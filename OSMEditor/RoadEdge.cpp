@@ -33,6 +33,16 @@ void RoadEdge::addPoint(const QVector2D &pt) {
 }
 
 float RoadEdge::getWidth(float widthPerLane) {
+	return getWidth(type, widthPerLane);
+}
+
+/**
+ * Return the width of the road of the type.
+ *
+ * @param widthPerLane	width of a lane in centimeters
+ * @return				width in meters, or 0 for the other types
+ */
+float RoadEdge::getWidth(int type, float widthPerLane) {
 	switch (type) {
 	case TYPE_HIGHWAY:
 		return widthPerLane * 2.0f * 0.01f;
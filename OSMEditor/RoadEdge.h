@@ -29,6 +29,7 @@ public:
 
 	void addPoint(const QVector2D &pt);
 	float getWidth(float widthPerLane);
+	static float getWidth(int type, float widthPerLane);
 
 };
 
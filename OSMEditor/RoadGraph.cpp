@@ -1,23 +1,120 @@
 ﻿#include "RoadGraph.h"
+#include "History.h"
 
 float RoadGraph::EPS = 1e-6f;
+int RoadGraph::MIN_COMPACTION_SIZE = 1024;
+int RoadGraph::MAX_CHANGED_BOXES = 65536;
 float M_PI = 3.141592653;
 
 RoadGraph::RoadGraph() {
+	widthBase = 350.0f;
+
+	colorHighway = QColor(255, 128, 64);
+	colorBoulevard = QColor(255, 192, 64);
+	colorAvenue = QColor(128, 128, 255);
+	colorStreet = QColor(160, 160, 160);
 	showHighways = true;
 	showBoulevard = true;
 	showAvenues = true;
 	showLocalStreets = true;
+
+	compactionThreshold = 0.5f;
+
+	indexedVertices = 0;
+	indexedEdges = 0;
+
+	command = NULL;
+
+	versioning = false;
+	versionedVertices = 0;
+	versionedEdges = 0;
+
+	numInvalidVertices = 0;
+	numInvalidEdges = 0;
+	countedVertices = 0;
+	countedEdges = 0;
+	numRetainedInvalid = 0;
+
+	revision = 0;
+
+	trackingChanges = false;
+	trackedVertices = 0;
+	trackedEdges = 0;
+}
+
+/**
+* Copy the graph and its settings, which shares the vertices and edges with the source as the copy of BGLGraph does (clone() copies them).
+*/
+RoadGraph::RoadGraph(const RoadGraph& roads) : RoadGraph() {
+	*this = roads;
 }
 
 RoadGraph::~RoadGraph() {
 }
 
+/**
+* Copy the graph and its settings in the same way as the copy constructor.
+* The spatial index, the versioning, the change tracking, and the command of History are not copied, since they refer to
+* the descriptors and the elements of the source graph. They are cleared instead, and built again when they are needed.
+*/
+RoadGraph& RoadGraph::operator=(const RoadGraph& roads) {
+	if (this == &roads) return *this;
+
+	clear();
+	graph = roads.graph;
+	centerLonLat = roads.centerLonLat;
+	command = NULL;
+
+	highwayHeight = roads.highwayHeight;
+	avenueHeight = roads.avenueHeight;
+	widthBase = roads.widthBase;
+	curbRatio = roads.curbRatio;
+	colorHighway = roads.colorHighway;
+	colorBoulevard = roads.colorBoulevard;
+	colorAvenue = roads.colorAvenue;
+	colorStreet = roads.colorStreet;
+	showHighways = roads.showHighways;
+	showBoulevard = roads.showBoulevard;
+	showAvenues = roads.showAvenues;
+	showLocalStreets = roads.showLocalStreets;
+	compactionThreshold = roads.compactionThreshold;
+
+	return *this;
+}
+
 void RoadGraph::clear() {
 	graph.clear();
+
+	vertexIndex.clear(vertexIndex.getCellSize());
+	segmentIndex.clear(segmentIndex.getCellSize());
+	indexedVertices = 0;
+	indexedEdges = 0;
+
+	versioning = false;
+	version.clear();
+	versionEdgeIndices.clear();
+	changedVertices.clear();
+	changedEdges.clear();
+	addedEdges.clear();
+	versionedVertices = 0;
+	versionedEdges = 0;
+
+	numInvalidVertices = 0;
+	numInvalidEdges = 0;
+	countedVertices = 0;
+	countedEdges = 0;
+	numRetainedInvalid = 0;
+
+	revision++;
+
+	trackingChanges = false;
+	changedBoxes.clear();
+	changedBoxVertices.clear();
+	changedBoxEdges.clear();
 }
 
 RoadGraph RoadGraph::clone() {
+	ScopedTimer timer(Instrumentation::TIMER_CLONE);
 	RoadGraph copied_roads;
 
 	QMap<RoadVertexDesc, RoadVertexDesc> mapping;
@@ -50,6 +147,155 @@ RoadGraph RoadGraph::clone() {
 	return copied_roads;
 }
 
+/**
+* Return the persistent version of the current graph, which can be kept and read from another thread at constant cost.
+* The first call copies the whole graph. After that, only the chunks of the elements changed since the last call are copied.
+*/
+RoadGraphVersion RoadGraph::snapshot() {
+	if (!versioning || versionedVertices != boost::num_vertices(graph) || versionedEdges != boost::num_edges(graph)) {
+		rebuildVersion();
+		return version;
+	}
+
+	version.setCenterLonLat(centerLonLat);
+
+	// append the added vertices and edges
+	for (RoadVertexDesc v = version.numVertices(); v < boost::num_vertices(graph); v++) {
+		version.addVertex(*graph[v]);
+	}
+	for (int i = 0; i < addedEdges.size(); i++) {
+		RoadEdgeDesc e = addedEdges[i];
+		versionEdgeIndices[graph[e].get()] = version.addEdge(boost::source(e, graph), boost::target(e, graph), *graph[e]);
+		changedEdges.erase(graph[e].get());
+	}
+
+	// update the changed vertices and edges which existed at the last snapshot
+	for (std::unordered_set<RoadVertexDesc>::iterator it = changedVertices.begin(); it != changedVertices.end(); ++it) {
+		version.setVertex(*it, *graph[*it]);
+	}
+	for (std::unordered_map<RoadEdge*, RoadEdgeDesc>::iterator it = changedEdges.begin(); it != changedEdges.end(); ++it) {
+		version.setEdge(versionEdgeIndices[it->first], *graph[it->second]);
+	}
+
+	changedVertices.clear();
+	changedEdges.clear();
+	addedEdges.clear();
+
+	return version;
+}
+
+/**
+* Copy the whole graph to the persistent version, and start tracking the changes.
+*/
+void RoadGraph::rebuildVersion() {
+	version.build(*this);
+
+	versionEdgeIndices.clear();
+	unsigned int index = 0;
+	RoadEdgeIter ei, eend;
+	for (boost::tie(ei, eend) = boost::edges(graph); ei != eend; ++ei) {
+		versionEdgeIndices[graph[*ei].get()] = index++;
+	}
+
+	changedVertices.clear();
+	changedEdges.clear();
+	addedEdges.clear();
+	versioning = true;
+	versionedVertices = boost::num_vertices(graph);
+	versionedEdges = boost::num_edges(graph);
+}
+
+/**
+* Add a vertex at the specified point.
+*/
+RoadVertexDesc RoadGraph::addVertex(const QVector2D& pt) {
+	bool indexed = isIndexUpToDate();
+	bool counted = isInvalidCountUpToDate();
+
+	RoadVertexDesc desc = boost::add_vertex(graph);
+	graph[desc] = RoadVertexPtr(new RoadVertex(pt));
+	recordVertex(desc, true);
+
+	if (indexed) {
+		indexVertex(desc, true);
+		indexedVertices++;
+	}
+	if (counted) countedVertices++;
+
+	return desc;
+}
+
+/**
+* Add an edge between src and tgt.
+*/
+RoadEdgeDesc RoadGraph::addEdge(RoadVertexDesc src, RoadVertexDesc tgt, RoadEdgePtr edge) {
+	bool indexed = isIndexUpToDate();
+	bool counted = isInvalidCountUpToDate();
+
+	std::pair<RoadEdgeDesc, bool> edge_pair = boost::add_edge(src, tgt, graph);
+	graph[edge_pair.first] = edge;
+	recordEdge(edge_pair.first, true);
+
+	if (indexed) {
+		indexEdge(edge_pair.first, true);
+		indexedEdges++;
+	}
+	if (counted) {
+		countedEdges++;
+		if (!edge->valid) numInvalidEdges++;
+	}
+
+	return edge_pair.first;
+}
+
+/**
+* Invalidate the vertex, and remove it from the spatial index.
+*/
+void RoadGraph::invalidateVertex(RoadVertexDesc v) {
+	recordVertex(v);
+	if (isIndexUpToDate()) indexVertex(v, false);
+	if (isInvalidCountUpToDate() && graph[v]->valid) numInvalidVertices++;
+	graph[v]->valid = false;
+}
+
+/**
+* Invalidate the edge, and remove it from the spatial index.
+*/
+void RoadGraph::invalidateEdge(RoadEdgeDesc e) {
+	recordEdge(e);
+	if (isIndexUpToDate()) indexEdge(e, false);
+	if (isInvalidCountUpToDate() && graph[e]->valid) numInvalidEdges++;
+	graph[e]->valid = false;
+}
+
+/**
+* Replace the attributes of the vertex, and update the spatial index.
+* This is used by History to restore the vertex.
+*/
+void RoadGraph::setVertex(RoadVertexDesc v, const RoadVertex& vertex) {
+	recordVertex(v);
+
+	bool indexed = isIndexUpToDate();
+	if (indexed) indexVertex(v, false);
+	if (isInvalidCountUpToDate()) numInvalidVertices += (graph[v]->valid ? 0 : -1) + (vertex.valid ? 0 : 1);
+	*graph[v] = vertex;
+	if (indexed) indexVertex(v, true);
+}
+
+/**
+* Replace the attributes and the polyline of the edge, and update the spatial index.
+* This is used by History to restore the edge.
+*/
+void RoadGraph::setEdge(RoadEdgeDesc e, const RoadEdge& edge) {
+	recordEdge(e);
+
+	bool indexed = isIndexUpToDate();
+	if (indexed) indexEdge(e, false);
+	if (isInvalidCountUpToDate()) numInvalidEdges += (graph[e]->valid ? 0 : -1) + (edge.valid ? 0 : 1);
+	*graph[e] = edge;
+	if (indexed) indexEdge(e, true);
+}
+
 /**
 * Return the degree of the specified vertex.
 */
@@ -64,8 +310,83 @@ int RoadGraph::getDegree(RoadVertexDesc v) {
 
 /**
 * Remove the vertices of degree of 2, and make it as a part of an edge.
+* Each chain of such vertices is merged into one edge at once, so every vertex is visited a bounded number of times
+* and the whole reduction takes O(V+E). As in reduce(desc), a vertex is kept if its two edges have different types,
+* and a chain which starts and ends at the same vertex keeps its last vertex so that no loop edge is created.
 */
 void RoadGraph::reduce() {
+	ScopedTimer timer(Instrumentation::TIMER_REDUCE);
+	int num_vertices = boost::num_vertices(graph);
+	std::vector<int> degrees(num_vertices);
+	for (RoadVertexDesc v = 0; v < num_vertices; v++) {
+		degrees[v] = graph[v]->valid ? getDegree(v) : 0;
+	}
+
+	// Merging a chain does not change the degrees of its end points, so the degrees are computed only once.
+	std::vector<bool> visited(num_vertices, false);
+	for (RoadVertexDesc v = 0; v < num_vertices; v++) {
+		if (visited[v] || !isReducible(v, degrees)) continue;
+
+		// walk to both ends of the chain
+		std::vector<RoadEdgeDesc> edges[2];
+		std::vector<RoadVertexDesc> vertices[2];
+		RoadEdgeDesc ed[2];
+		getReducibleEdges(v, ed);
+		visited[v] = true;
+		bool cycle = false;
+		for (int dir = 0; dir < 2 && !cycle; dir++) {
+			RoadVertexDesc cur = v;
+			RoadEdgeDesc e = ed[dir];
+			while (true) {
+				RoadVertexDesc next = boost::source(e, graph) == cur ? boost::target(e, graph) : boost::source(e, graph);
+				edges[dir].push_back(e);
+				vertices[dir].push_back(next);
+				if (next == v) {
+					cycle = true;
+					break;
+				}
+				if (!isReducible(next, degrees)) break;
+
+				visited[next] = true;
+				RoadEdgeDesc next_ed[2];
+				getReducibleEdges(next, next_ed);
+				e = next_ed[0] == e ? next_ed[1] : next_ed[0];
+				cur = next;
+			}
+		}
+
+		// line up the vertices and the edges from one end to the other
+		std::vector<RoadVertexDesc> chain_vertices;
+		std::vector<RoadEdgeDesc> chain_edges;
+		if (cycle) {
+			chain_vertices.push_back(v);
+			chain_vertices.insert(chain_vertices.end(), vertices[0].begin(), vertices[0].end());
+			chain_edges = edges[0];
+		}
+		else {
+			chain_vertices.assign(vertices[1].rbegin(), vertices[1].rend());
+			chain_vertices.push_back(v);
+			chain_vertices.insert(chain_vertices.end(), vertices[0].begin(), vertices[0].end());
+			chain_edges.assign(edges[1].rbegin(), edges[1].rend());
+			chain_edges.insert(chain_edges.end(), edges[0].begin(), edges[0].end());
+		}
+
+		// If the chain is a loop, keep the last vertex.
+		if (chain_vertices.front() == chain_vertices.back()) {
+			chain_vertices.pop_back();
+			chain_edges.pop_back();
+		}
+		if (chain_edges.size() < 2) continue;
+
+		mergeChain(chain_vertices, chain_edges);
+	}
+}
+
+/**
+* Remove the vertices of degree of 2 one at a time, restarting the scan after each removal.
+* This takes quadratic time for long chains, and is kept for comparison.
+*/
+void RoadGraph::reduceNaive() {
 	RoadVertexIter vi, vend;
 	bool deleted = false;
 	do {
@@ -115,35 +436,101 @@ bool RoadGraph::reduce(RoadVertexDesc desc) {
 	//if (hasEdge(roads, vd[0], vd[1])) return false;
 
 	RoadEdgePtr new_edge = RoadEdgePtr(new RoadEdge(edges[0]->type, edges[0]->lanes, edges[0]->oneWay));
-	orderPolyLine(ed[0], vd[0]);
-	orderPolyLine(ed[1], desc);
-
-	for (int i = 0; i < edges[0]->polyline.size(); i++) {
-		new_edge->addPoint(edges[0]->polyline[i]);
-	}
-	for (int i = 1; i < edges[1]->polyline.size(); i++) {
-		new_edge->addPoint(edges[1]->polyline[i]);
-	}
-	std::pair<RoadEdgeDesc, bool> edge_pair = boost::add_edge(vd[0], vd[1], graph);
-	graph[edge_pair.first] = new_edge;
+	PolylineView polyline0 = polylineFrom(ed[0], vd[0]);
+	PolylineView polyline1 = polylineFrom(ed[1], desc);
+	reservePolyline(new_edge->polyline, polyline0.size() + polyline1.size() - 1);
+	appendPoints(new_edge->polyline, polyline0, 0, polyline0.size());
+	appendPoints(new_edge->polyline, polyline1, 1, polyline1.size());
 
 	// invalidate the old edge
-	graph[ed[0]]->valid = false;
-	graph[ed[1]]->valid = false;
+	invalidateEdge(ed[0]);
+	invalidateEdge(ed[1]);
 
 	// invalidate the vertex
-	graph[desc]->valid = false;
+	invalidateVertex(desc);
+
+	addEdge(vd[0], vd[1], new_edge);
 
 	return true;
 }
 
+/**
+* Return true if the vertex can be merged into a chain by reduce(),
+* i.e., it has two valid edges of the same type, neither of which is a loop.
+*/
+bool RoadGraph::isReducible(RoadVertexDesc v, const std::vector<int>& degrees) {
+	if (!graph[v]->valid || degrees[v] != 2) return false;
+
+	RoadEdgeDesc ed[2];
+	getReducibleEdges(v, ed);
+	if (boost::source(ed[0], graph) == boost::target(ed[0], graph) || boost::source(ed[1], graph) == boost::target(ed[1], graph)) return false;
+
+	return graph[ed[0]]->type == graph[ed[1]]->type;
+}
+
+/**
+* Get the two valid edges of the vertex of degree 2.
+*/
+void RoadGraph::getReducibleEdges(RoadVertexDesc v, RoadEdgeDesc* ed) {
+	int count = 0;
+	RoadOutEdgeIter ei, eend;
+	for (boost::tie(ei, eend) = boost::out_edges(v, graph); ei != eend && count < 2; ++ei) {
+		if (graph[*ei]->valid) ed[count++] = *ei;
+	}
+}
+
+/**
+* Replace the chain of edges by one edge between its end points, and invalidate the vertices in between.
+* The polyline of the new edge is allocated once, and each polyline is appended in the direction of the chain.
+*
+* @param vertices	the vertices of the chain from one end to the other
+* @param edges		the edges of the chain, where the i-th edge connects the i-th and the (i+1)-th vertices
+*/
+void RoadGraph::mergeChain(const std::vector<RoadVertexDesc>& vertices, const std::vector<RoadEdgeDesc>& edges) {
+	RoadEdgePtr first_edge = graph[edges[0]];
+	RoadEdgePtr new_edge = RoadEdgePtr(new RoadEdge(first_edge->type, first_edge->lanes, first_edge->oneWay));
+
+	int num_points = 1;
+	for (int i = 0; i < edges.size(); i++) {
+		num_points += graph[edges[i]]->polyline.size() - 1;
+	}
+	reservePolyline(new_edge->polyline, num_points);
+
+	for (int i = 0; i < edges.size(); i++) {
+		PolylineView polyline = polylineFrom(edges[i], vertices[i]);
+		appendPoints(new_edge->polyline, polyline, i == 0 ? 0 : 1, polyline.size());
+	}
+
+	for (int i = 0; i < edges.size(); i++) {
+		invalidateEdge(edges[i]);
+	}
+	for (int i = 1; i < vertices.size() - 1; i++) {
+		invalidateVertex(vertices[i]);
+	}
+
+	addEdge(vertices.front(), vertices.back(), new_edge);
+}
+
 /**
 * Move the vertex to the specified location.
 * The outing edges are also moved accordingly.
 */
 void RoadGraph::moveVertex(RoadVertexDesc v, const QVector2D& pt) {
-	// Move the outing edges
+	// record and remove the vertex and the outing edges from the spatial index before changing their geometry
+	bool indexed = isIndexUpToDate();
 	RoadOutEdgeIter ei, eend;
+	recordVertex(v);
+	for (boost::tie(ei, eend) = boost::out_edges(v, graph); ei != eend; ++ei) {
+		recordEdge(*ei);
+	}
+	if (indexed) {
+		indexVertex(v, false);
+		for (boost::tie(ei, eend) = boost::out_edges(v, graph); ei != eend; ++ei) {
+			indexEdge(*ei, false);
+		}
+	}
+
+	// Move the outing edges
 	for (boost::tie(ei, eend) = boost::out_edges(v, graph); ei != eend; ++ei) {
 		RoadVertexDesc tgt = boost::target(*ei, graph);
 
@@ -159,6 +546,13 @@ void RoadGraph::moveVertex(RoadVertexDesc v, const QVector2D& pt) {
 
 	// Move the vertex
 	graph[v]->pt = pt;
+
+	if (indexed) {
+		indexVertex(v, true);
+		for (boost::tie(ei, eend) = boost::out_edges(v, graph); ei != eend; ++ei) {
+			indexEdge(*ei, true);
+		}
+	}
 }
 
 /**
@@ -220,35 +614,215 @@ RoadEdgeDesc RoadGraph::getEdge(RoadVertexDesc src, RoadVertexDesc tgt) {
 * If the distance is within the threshold, return true. Otherwise, return false.
 */
 bool RoadGraph::getEdge(const QVector2D &pt, float threshold, RoadEdgeDesc& e) {
+	QVector2D closest_pt;
+	return findClosestEdge(pt, threshold, e, closest_pt);
+}
+
+/**
+* Find the vertex which is the closest to the specified point using the spatial index.
+* If the distance is within the threshold, return true. Otherwise, return false.
+*
+* @param except		vertices for which this returns true are ignored
+*/
+bool RoadGraph::findClosestVertex(const QVector2D& pt, float threshold, RoadVertexDesc& closest_vertex_desc, std::function<bool(RoadVertexDesc)> except) {
+	ScopedTimer timer(Instrumentation::TIMER_FIND);
+	updateIndex();
+
 	float min_dist = std::numeric_limits<float>::max();
-	RoadEdgeDesc min_e;
+	vertexIndex.query(pt - QVector2D(threshold, threshold), pt + QVector2D(threshold, threshold), [&](RoadVertexDesc v) {
+		if (!graph[v]->valid) return;
+		if (except && except(v)) return;
+
+		float dist = (graph[v]->pt - pt).length();
+		if (dist < min_dist) {
+			min_dist = dist;
+			closest_vertex_desc = v;
+		}
+	});
 
-	RoadEdgeIter ei, eend;
-	for (boost::tie(ei, eend) = boost::edges(graph); ei != eend; ++ei) {
-		if (!graph[*ei]->valid) continue;
+	return min_dist < threshold;
+}
 
-		RoadVertexPtr src = graph[boost::source(*ei, graph)];
-		RoadVertexPtr tgt = graph[boost::target(*ei, graph)];
+/**
+* Collect the valid vertices in the box using the spatial index.
+* If the box covers the whole graph, the vertices are scanned directly, which is faster than visiting the cells.
+*/
+void RoadGraph::findVertices(const QVector2D& minPt, const QVector2D& maxPt, std::vector<RoadVertexDesc>& vertices) {
+	updateIndex();
 
-		if (!src->valid) continue;
-		if (!tgt->valid) continue;
+	vertices.clear();
+	if (vertexIndex.coversAll(minPt, maxPt)) {
+		RoadVertexIter vi, vend;
+		for (boost::tie(vi, vend) = boost::vertices(graph); vi != vend; ++vi) {
+			if (!graph[*vi]->valid) continue;
 
-		for (int i = 0; i < graph[*ei]->polyline.size() - 1; i++) {
-			float dist = pointSegmentDistance(graph[*ei]->polyline[i], graph[*ei]->polyline[i + 1], pt);
-			if (dist < min_dist) {
-				min_dist = dist;
-				e = *ei;
+			const QVector2D& pt = graph[*vi]->pt;
+			if (pt.x() >= minPt.x() && pt.x() <= maxPt.x() && pt.y() >= minPt.y() && pt.y() <= maxPt.y()) vertices.push_back(*vi);
+		}
+		return;
+	}
+
+	vertexIndex.queryUnique(minPt, maxPt, [&](RoadVertexDesc v, QVector2D& p0, QVector2D& p1) {
+		p0 = graph[v]->pt;
+		p1 = graph[v]->pt;
+	}, [&](RoadVertexDesc v) {
+		if (!graph[v]->valid) return;
+
+		const QVector2D& pt = graph[v]->pt;
+		if (pt.x() >= minPt.x() && pt.x() <= maxPt.x() && pt.y() >= minPt.y() && pt.y() <= maxPt.y()) vertices.push_back(v);
+	});
+}
+
+/**
+* Collect the valid edges which have a polyline segment that overlaps the box using the spatial index.
+* Each edge is collected only once, when its first segment that overlaps the box is found.
+* If the box covers the whole graph, the edges are scanned directly, which is faster than visiting the cells.
+*/
+void RoadGraph::findEdges(const QVector2D& minPt, const QVector2D& maxPt, std::vector<RoadEdgeDesc>& edges) {
+	updateIndex();
+
+	edges.clear();
+	if (segmentIndex.coversAll(minPt, maxPt)) {
+		RoadEdgeIter ei, eend;
+		for (boost::tie(ei, eend) = boost::edges(graph); ei != eend; ++ei) {
+			if (!graph[*ei]->valid) continue;
+
+			const std::vector<QVector2D>& polyline = graph[*ei]->polyline;
+			for (int i = 0; i < (int)polyline.size() - 1; i++) {
+				if (segmentOverlaps(polyline, i, minPt, maxPt)) {
+					edges.push_back(*ei);
+					break;
+				}
 			}
 		}
+		return;
+	}
+
+	segmentIndex.queryUnique(minPt, maxPt, [&](const RoadSegment& seg, QVector2D& p0, QVector2D& p1) {
+		p0 = graph[seg.edge]->polyline[seg.index];
+		p1 = graph[seg.edge]->polyline[seg.index + 1];
+	}, [&](const RoadSegment& seg) {
+		if (!graph[seg.edge]->valid) return;
+
+		// the segment is found from the cells it passes through, which may be outside the box
+		const std::vector<QVector2D>& polyline = graph[seg.edge]->polyline;
+		if (!segmentOverlaps(polyline, seg.index, minPt, maxPt)) return;
+
+		// the edge is collected when the preceding segments do not overlap the box
+		for (int i = seg.index - 1; i >= 0; i--) {
+			if (segmentOverlaps(polyline, i, minPt, maxPt)) return;
+		}
+
+		edges.push_back(seg.edge);
+	});
+}
+
+/**
+* Return the bounding boxes of the vertices and edges which have been changed since the last call, both before and after the changes,
+* so that the renderers can redraw only the changed areas.
+* If the changes are not known, e.g. on the first call, after clear, or after the graph is built without the record hooks, return false.
+* Then, everything has to be redrawn.
+*/
+bool RoadGraph::takeChangedBoxes(std::vector<std::pair<QVector2D, QVector2D> >& boxes) {
+	boxes.clear();
+
+	if (!trackingChanges || trackedVertices != boost::num_vertices(graph) || trackedEdges != boost::num_edges(graph)) {
+		trackingChanges = true;
+		changedBoxes.clear();
+		changedBoxVertices.clear();
+		changedBoxEdges.clear();
+		trackedVertices = boost::num_vertices(graph);
+		trackedEdges = boost::num_edges(graph);
+		return false;
+	}
+
+	flushChangedBoxes();
+	boxes.swap(changedBoxes);
+	return true;
+}
+
+/**
+* Return the average length of the polyline segments when the spatial index was built, which is its cell size.
+*/
+float RoadGraph::averageSegmentLength() {
+	updateIndex();
+
+	return segmentIndex.getCellSize();
+}
+
+/**
+* Return the number of valid vertices and edges.
+*/
+void RoadGraph::countValid(int& num_vertices, int& num_edges) const {
+	num_vertices = 0;
+	num_edges = 0;
+
+	RoadVertexIter vi, vend;
+	for (boost::tie(vi, vend) = boost::vertices(graph); vi != vend; ++vi) {
+		if (graph[*vi]->valid) num_vertices++;
 	}
 
-	if (min_dist < threshold) return true;
-	else return false;
+	RoadEdgeIter ei, eend;
+	for (boost::tie(ei, eend) = boost::edges(graph); ei != eend; ++ei) {
+		if (graph[*ei]->valid) num_edges++;
+	}
+}
+
+/**
+* Find the point of the edge polylines which is the closest to the specified point using the spatial index.
+* The last point of each polyline is not considered.
+* If the distance is within the threshold, return true. Otherwise, return false.
+*/
+bool RoadGraph::findClosestEdgePoint(const QVector2D& pt, float threshold, RoadEdgeDesc& closest_edge_desc, int& closest_edge_point) {
+	ScopedTimer timer(Instrumentation::TIMER_FIND);
+	updateIndex();
+
+	float min_dist = std::numeric_limits<float>::max();
+	segmentIndex.query(pt - QVector2D(threshold, threshold), pt + QVector2D(threshold, threshold), [&](const RoadSegment& seg) {
+		if (!graph[seg.edge]->valid) return;
+
+		float dist = (graph[seg.edge]->polyline[seg.index] - pt).length();
+		if (dist < min_dist) {
+			min_dist = dist;
+			closest_edge_desc = seg.edge;
+			closest_edge_point = seg.index;
+		}
+	});
+
+	return min_dist < threshold;
+}
+
+/**
+* Find the edge which is the closest to the specified point using the spatial index.
+* If the distance is within the threshold, return true. Otherwise, return false.
+*
+* @param closest_pt	the closest point on the edge
+* @param except		edges for which this returns true are ignored
+*/
+bool RoadGraph::findClosestEdge(const QVector2D& pt, float threshold, RoadEdgeDesc& closest_edge_desc, QVector2D& closest_pt, std::function<bool(RoadEdgeDesc)> except) {
+	ScopedTimer timer(Instrumentation::TIMER_FIND);
+	updateIndex();
 
+	float min_dist = std::numeric_limits<float>::max();
+	segmentIndex.query(pt - QVector2D(threshold, threshold), pt + QVector2D(threshold, threshold), [&](const RoadSegment& seg) {
+		if (!graph[seg.edge]->valid) return;
+		if (except && except(seg.edge)) return;
+
+		const std::vector<QVector2D>& polyline = graph[seg.edge]->polyline;
+		QVector2D pt2;
+		float dist = pointSegmentDistance(polyline[seg.index], polyline[seg.index + 1], pt, pt2);
+		if (dist < min_dist) {
+			min_dist = dist;
+			closest_edge_desc = seg.edge;
+			closest_pt = pt2;
+		}
+	});
+
+	return min_dist < threshold;
 }
 
 void RoadGraph::deleteEdge(RoadEdgeDesc desc) {
-	graph[desc]->valid = false;
+	invalidateEdge(desc);
 	RoadVertexDesc src = boost::source(desc, graph);
 	RoadVertexDesc tgt = boost::target(desc, graph);
 
@@ -261,7 +835,7 @@ void RoadGraph::deleteEdge(RoadEdgeDesc desc) {
 		}
 	}
 	if (cnt == 0) {
-		graph[src]->valid = false;
+		invalidateVertex(src);
 	}
 
 	cnt = 0;
@@ -272,8 +846,28 @@ void RoadGraph::deleteEdge(RoadEdgeDesc desc) {
 		}
 	}
 	if (cnt == 0) {
-		graph[tgt]->valid = false;
+		invalidateVertex(tgt);
+	}
+}
+
+/**
+* Delete the edges whose type is not one of the types, and the vertices which are left without edges.
+*
+* @param types		bit mask of RoadEdge::TYPE_XXX to keep
+* @return			the number of the deleted edges
+*/
+int RoadGraph::deleteEdgesExcept(int types) {
+	int count = 0;
+	RoadEdgeIter ei, eend;
+	for (boost::tie(ei, eend) = boost::edges(graph); ei != eend; ++ei) {
+		if (!graph[*ei]->valid) continue;
+		if (graph[*ei]->type & types) continue;
+
+		deleteEdge(*ei);
+		count++;
 	}
+
+	return count;
 }
 
 /**
@@ -291,7 +885,7 @@ bool RoadGraph::snapVertex(RoadVertexDesc v1, RoadVertexDesc v2) {
 
 		// if the edge is too short, remove it.
 		if (graph[e]->getLength() < 0.01f) {
-			graph[e]->valid = false;
+			invalidateEdge(e);
 		}
 	}
 
@@ -303,24 +897,24 @@ bool RoadGraph::snapVertex(RoadVertexDesc v1, RoadVertexDesc v2) {
 		RoadVertexDesc v1b = boost::target(*ei, graph);
 
 		// invalidate the old edge
-		graph[*ei]->valid = false;
+		invalidateEdge(*ei);
 
 		if (v1b == v2) continue;
 		if (hasEdge(v2, v1b)) continue;
 
 		// add a new edge
 		RoadEdgePtr e = RoadEdgePtr(new RoadEdge(*graph[*ei]));
+		Instrumentation::count(Instrumentation::POLYLINE_ALLOCATIONS);
 		e->valid = true;
-		std::pair<RoadEdgeDesc, bool> edge_pair = boost::add_edge(v2, v1b, graph);
-		graph[edge_pair.first] = e;
+		addEdge(v2, v1b, e);
 	}
 
 	// invalidate v1
-	graph[v1]->valid = false;
+	invalidateVertex(v1);
 
 	// if there is no edge from v2, disable it as well.
 	if (getDegree(v2) == 0) {
-		graph[v2]->valid = false;
+		invalidateVertex(v2);
 		return false;
 	}
 	else {
@@ -334,21 +928,19 @@ bool RoadGraph::snapVertex(RoadVertexDesc v1, RoadVertexDesc v2) {
 RoadVertexDesc RoadGraph::splitEdge(RoadEdgeDesc edge_desc, const QVector2D& pt) {
 	RoadEdgePtr edge = graph[edge_desc];
 
-	// find which point along the polyline is the closest to the specified split point.
-	int index;
-	QVector2D pos;
+	// find which point along the polyline is the closest to the specified split point
+	// by projecting it onto each segment, so that the cost depends only on the number of points.
+	int index = 0;
+	QVector2D pos = edge->polyline[0];
 	float min_dist = std::numeric_limits<float>::max();
-	for (int i = 0; i < graph[edge_desc]->polyline.size() - 1; i++) {
-		QVector2D vec = graph[edge_desc]->polyline[i + 1] - graph[edge_desc]->polyline[i];
-		float length = vec.length();
-		for (int j = 0; j < length; j += 1.0f) {
-			QVector2D pt2 = graph[edge_desc]->polyline[i] + vec * (float)j / length;
-			float dist = (pt2 - pt).lengthSquared();
-			if (dist < min_dist) {
-				min_dist = dist;
-				index = i;
-				pos = pt2;
-			}
+	for (int i = 0; i < (int)edge->polyline.size() - 1; i++) {
+		QVector2D closest_pt;
+		pointSegmentDistance(edge->polyline[i], edge->polyline[i + 1], pt, closest_pt);
+		float dist = (closest_pt - pt).lengthSquared();
+		if (dist < min_dist) {
+			min_dist = dist;
+			index = i;
+			pos = closest_pt;
 		}
 	}
 
@@ -356,59 +948,208 @@ RoadVertexDesc RoadGraph::splitEdge(RoadEdgeDesc edge_desc, const QVector2D& pt)
 	RoadVertexDesc tgt = boost::target(edge_desc, graph);
 
 	// add a new vertex at the specified point on the edge
-	RoadVertexPtr v = RoadVertexPtr(new RoadVertex(pos));
-	RoadVertexDesc v_desc = boost::add_vertex(graph);
-	graph[v_desc] = v;
+	RoadVertexDesc v_desc = addVertex(pos);
+
+	// the polyline from src to tgt, where the split point is on the index-th segment counted from src
+	PolylineView polyline = polylineFrom(edge_desc, src);
+	if (polyline.reversed) index = polyline.size() - 2 - index;
 
 	// add the first edge
 	RoadEdgePtr e1 = RoadEdgePtr(new RoadEdge(edge->type, edge->lanes, edge->oneWay));
-	if ((edge->polyline[0] - graph[src]->pt).lengthSquared() < (edge->polyline[0] - graph[tgt]->pt).lengthSquared()) {
-		for (int i = 0; i <= index; i++) {
-			e1->addPoint(edge->polyline[i]);
+	reservePolyline(e1->polyline, index + 2);
+	appendPoints(e1->polyline, polyline, 0, index + 1);
+	e1->polyline.push_back(pos);
+	addEdge(src, v_desc, e1);
+
+	// add the second edge
+	RoadEdgePtr e2 = RoadEdgePtr(new RoadEdge(edge->type, edge->lanes, edge->oneWay));
+	reservePolyline(e2->polyline, polyline.size() - index);
+	e2->polyline.push_back(pos);
+	appendPoints(e2->polyline, polyline, index + 1, polyline.size());
+	addEdge(v_desc, tgt, e2);
+
+	// remove the original edge
+	invalidateEdge(edge_desc);
+
+	return v_desc;
+}
+
+/**
+* Convert the road graph to a planar graph.
+* All the intersections between polyline segments are found in one pass by bucketing the segments
+* into a uniform grid, and then every intersected edge is split at all of its intersections at once.
+* As in planarifyOne(), edges that share an end point are not tested against each other.
+*
+* @return		the number of intersections resolved
+*/
+int RoadGraph::planarify() {
+	ScopedTimer timer(Instrumentation::TIMER_PLANARIFY);
+	struct Segment {
+		int edge;
+		int index;
+		float minx, miny, maxx, maxy;
+	};
+	struct Split {
+		int index;
+		float t;
+		RoadVertexDesc v;
+	};
+
+	// collect the polyline segments of all the valid edges
+	std::vector<RoadEdgeDesc> edges;
+	std::vector<Segment> segments;
+	float minx = std::numeric_limits<float>::max();
+	float miny = std::numeric_limits<float>::max();
+	float maxx = -std::numeric_limits<float>::max();
+	float maxy = -std::numeric_limits<float>::max();
+	float total_size = 0.0f;
+
+	RoadEdgeIter ei, eend;
+	for (boost::tie(ei, eend) = boost::edges(graph); ei != eend; ++ei) {
+		if (!graph[*ei]->valid) continue;
+
+		const std::vector<QVector2D>& polyline = graph[*ei]->polyline;
+		for (int i = 0; i < (int)polyline.size() - 1; i++) {
+			Segment seg;
+			seg.edge = edges.size();
+			seg.index = i;
+			seg.minx = std::min(polyline[i].x(), polyline[i + 1].x());
+			seg.miny = std::min(polyline[i].y(), polyline[i + 1].y());
+			seg.maxx = std::max(polyline[i].x(), polyline[i + 1].x());
+			seg.maxy = std::max(polyline[i].y(), polyline[i + 1].y());
+			segments.push_back(seg);
+
+			minx = std::min(minx, seg.minx);
+			miny = std::min(miny, seg.miny);
+			maxx = std::max(maxx, seg.maxx);
+			maxy = std::max(maxy, seg.maxy);
+			total_size += std::max(seg.maxx - seg.minx, seg.maxy - seg.miny);
 		}
-		e1->addPoint(pos);
+		edges.push_back(*ei);
 	}
-	else {
-		e1->addPoint(pos);
-		for (int i = index + 1; i < edge->polyline.size(); i++) {
-			e1->addPoint(edge->polyline[i]);
+	if (segments.size() < 2) return 0;
+
+	// The cell size is the average segment extent, but the number of cells is limited to a few times the number of segments.
+	float cell_size = std::max(total_size / segments.size(), 1.0f);
+	float max_cells = segments.size() * 4.0f;
+	if (((maxx - minx) / cell_size + 1) * ((maxy - miny) / cell_size + 1) > max_cells) {
+		cell_size = std::max(maxx - minx, maxy - miny) / std::sqrt(max_cells) + 1.0f;
+	}
+	int nx = (int)((maxx - minx) / cell_size) + 1;
+	int ny = (int)((maxy - miny) / cell_size) + 1;
+
+	// register each segment to all the cells its bounding box overlaps
+	std::vector<std::vector<int> > cells(nx * ny);
+	for (int i = 0; i < segments.size(); i++) {
+		int x0 = (int)((segments[i].minx - minx) / cell_size);
+		int y0 = (int)((segments[i].miny - miny) / cell_size);
+		int x1 = (int)((segments[i].maxx - minx) / cell_size);
+		int y1 = (int)((segments[i].maxy - miny) / cell_size);
+		for (int y = y0; y <= y1; y++) {
+			for (int x = x0; x <= x1; x++) {
+				cells[y * nx + x].push_back(i);
+			}
 		}
 	}
-	std::pair<RoadEdgeDesc, bool> edge_pair1 = boost::add_edge(src, v_desc, graph);
-	graph[edge_pair1.first] = e1;
 
-	// add the second edge
-	RoadEdgePtr e2 = RoadEdgePtr(new RoadEdge(edge->type, edge->lanes, edge->oneWay));
-	if ((edge->polyline[0] - graph[src]->pt).lengthSquared() < (edge->polyline[0] - graph[tgt]->pt).lengthSquared()) {
-		e2->addPoint(pos);
-		for (int i = index + 1; i < edge->polyline.size(); i++) {
-			e2->addPoint(edge->polyline[i]);
+	// find all the intersections
+	std::vector<std::vector<Split> > splits(edges.size());
+	int num_intersections = 0;
+	for (int c = 0; c < cells.size(); c++) {
+		for (int i = 0; i < cells[c].size(); i++) {
+			const Segment& s1 = segments[cells[c][i]];
+			RoadVertexDesc src = boost::source(edges[s1.edge], graph);
+			RoadVertexDesc tgt = boost::target(edges[s1.edge], graph);
+
+			for (int j = i + 1; j < cells[c].size(); j++) {
+				const Segment& s2 = segments[cells[c][j]];
+				if (s1.edge == s2.edge) continue;
+
+				// test each pair of segments only in the cell that contains the corner of their bounding box overlap
+				if (s1.maxx < s2.minx || s2.maxx < s1.minx || s1.maxy < s2.miny || s2.maxy < s1.miny) continue;
+				int ox = (int)((std::max(s1.minx, s2.minx) - minx) / cell_size);
+				int oy = (int)((std::max(s1.miny, s2.miny) - miny) / cell_size);
+				if (oy * nx + ox != c) continue;
+
+				// skip if two edges are adjacent
+				RoadVertexDesc src2 = boost::source(edges[s2.edge], graph);
+				RoadVertexDesc tgt2 = boost::target(edges[s2.edge], graph);
+				if (src == src2 || src == tgt2 || tgt == src2 || tgt == tgt2) continue;
+
+				const std::vector<QVector2D>& polyline1 = graph[edges[s1.edge]]->polyline;
+				const std::vector<QVector2D>& polyline2 = graph[edges[s2.edge]]->polyline;
+				float tab, tcd;
+				QVector2D intPt;
+				if (segmentSegmentIntersect(polyline1[s1.index], polyline1[s1.index + 1], polyline2[s2.index], polyline2[s2.index + 1], &tab, &tcd, intPt)) {
+					// add a vertex at the intersection, which is shared by both edges
+					RoadVertexDesc v_desc = addVertex(intPt);
+
+					Split split1 = { s1.index, tab, v_desc };
+					Split split2 = { s2.index, tcd, v_desc };
+					splits[s1.edge].push_back(split1);
+					splits[s2.edge].push_back(split2);
+					num_intersections++;
+				}
+			}
 		}
 	}
-	else {
-		for (int i = 0; i <= index; i++) {
-			e2->addPoint(edge->polyline[i]);
+
+	// split the intersected edges
+	for (int i = 0; i < edges.size(); i++) {
+		if (splits[i].empty()) continue;
+
+		std::sort(splits[i].begin(), splits[i].end(), [](const Split& s1, const Split& s2) {
+			return s1.index < s2.index || (s1.index == s2.index && s1.t < s2.t);
+		});
+
+		RoadEdgePtr edge = graph[edges[i]];
+		RoadVertexDesc src = boost::source(edges[i], graph);
+		RoadVertexDesc tgt = boost::target(edges[i], graph);
+		if ((edge->polyline[0] - graph[src]->pt).lengthSquared() > (edge->polyline[0] - graph[tgt]->pt).lengthSquared()) {
+			std::swap(src, tgt);
 		}
-		e2->addPoint(pos);
-	}
-	std::pair<RoadEdgeDesc, bool> edge_pair2 = boost::add_edge(v_desc, tgt, graph);
-	graph[edge_pair2.first] = e2;
 
-	// remove the original edge
-	graph[edge_desc]->valid = false;
+		// cut the polyline at each split point, where each piece consists of the previous split point,
+		// the points of the polyline up to the split segment, and the split point, and is allocated once
+		RoadVertexDesc prev_desc = src;
+		int first = 0;
+		for (int k = 0; k <= splits[i].size(); k++) {
+			bool last_piece = k == splits[i].size();
+			int last = last_piece ? edge->polyline.size() - 1 : splits[i][k].index;
+			RoadVertexDesc next_desc = last_piece ? tgt : splits[i][k].v;
+
+			RoadEdgePtr piece = RoadEdgePtr(new RoadEdge(edge->type, edge->lanes, edge->oneWay, edge->link, edge->roundabout));
+			reservePolyline(piece->polyline, (k > 0 ? 1 : 0) + last - first + 1 + (last_piece ? 0 : 1));
+			if (k > 0) piece->polyline.push_back(graph[prev_desc]->pt);
+			piece->polyline.insert(piece->polyline.end(), edge->polyline.begin() + first, edge->polyline.begin() + last + 1);
+			if (!last_piece) piece->polyline.push_back(graph[next_desc]->pt);
+			addEdge(prev_desc, next_desc, piece);
+
+			prev_desc = next_desc;
+			first = last + 1;
+		}
 
-	return v_desc;
+		// invalidate the original edge
+		invalidateEdge(edges[i]);
+	}
+
+	return num_intersections;
 }
 
 /**
-* Convert the road graph to a planar graph.
+* Convert the road graph to a planar graph by resolving one intersection at a time.
+* This is much slower than planarify(), and is kept for comparison.
+*
+* @return		the number of intersections resolved
 */
-void RoadGraph::planarify() {
-	bool split = true;
+int RoadGraph::planarifyNaive() {
+	int num_intersections = 0;
 
-	while (split) {
-		split = planarifyOne();
+	while (planarifyOne()) {
+		num_intersections++;
 	}
+
+	return num_intersections;
 }
 
 /**
@@ -448,8 +1189,8 @@ bool RoadGraph::planarifyOne() {
 						RoadVertexDesc new_v_desc2 = splitEdge(*ei2, intPt);
 
 						// invalidate the original road segments
-						graph[*ei]->valid = false;
-						graph[*ei2]->valid = false;
+						invalidateEdge(*ei);
+						invalidateEdge(*ei2);
 
 						// snap the intersection
 						snapVertex(new_v_desc2, new_v_desc);
@@ -465,24 +1206,401 @@ bool RoadGraph::planarifyOne() {
 }
 
 /**
-* Sort the points of the polyline of the edge such that the first point is the location of the src vertex.
+* Return true if the invalid vertices and edges, except those kept by the last compaction,
+* exceed compactionThreshold of all the vertices and edges. Small graphs are never compacted.
+*/
+bool RoadGraph::needsCompaction() {
+	int total = boost::num_vertices(graph) + boost::num_edges(graph);
+	if (total < MIN_COMPACTION_SIZE) return false;
+
+	updateInvalidCount();
+	return numInvalidVertices + numInvalidEdges - numRetainedInvalid > compactionThreshold * total;
+}
+
+/**
+* Forget the number of the invalid vertices and edges kept by the last compaction.
+* This is called when the history drops the commands which referred to them, so that needsCompaction() counts them
+* as garbage again. The next compaction counts the ones which are still referred to.
+*/
+void RoadGraph::releaseRetainedInvalid() {
+	numRetainedInvalid = 0;
+}
+
+/**
+* Remove the invalid vertices and edges, and the edges whose end points are invalid.
+*
+* @param mapping	the new descriptors of the remaining vertices and edges
+* @return			the number of removed vertices and edges
+*/
+int RoadGraph::compact(RoadGraphMapping& mapping) {
+	return compact(mapping, std::vector<bool>(), std::unordered_set<const void*>());
+}
+
+/**
+* Remove the invalid vertices and edges, and the edges whose end points are invalid, and store the vertices
+* and the edges densely again. The vertex and edge objects are moved to the new graph as they are, so pointers
+* to them remain valid, while all the descriptors have to be mapped to the new ones.
+* The referenced vertices and edges are kept even if they are invalid, and so are the end points of the kept edges.
+*
+* @param mapping				the new descriptors of the remaining vertices and edges
+* @param referenced_vertices	flags of the vertices to be kept, indexed by the descriptors
+* @param referenced_edges		properties of the descriptors of the edges to be kept
+* @return						the number of removed vertices and edges
+*/
+int RoadGraph::compact(RoadGraphMapping& mapping, const std::vector<bool>& referenced_vertices, const std::unordered_set<const void*>& referenced_edges) {
+	int num_vertices = boost::num_vertices(graph);
+	int num_edges = boost::num_edges(graph);
+
+	// the descriptors of the changed elements will change, so their bounding boxes are taken now
+	if (trackingChanges) {
+		if (trackedVertices == num_vertices && trackedEdges == num_edges) {
+			flushChangedBoxes();
+		}
+		else {
+			stopTrackingChanges();
+		}
+	}
+
+	// decide which vertices and edges are kept
+	std::vector<bool> kept_vertices(num_vertices);
+	for (RoadVertexDesc v = 0; v < num_vertices; v++) {
+		kept_vertices[v] = graph[v]->valid || (v < referenced_vertices.size() && referenced_vertices[v]);
+	}
+
+	std::vector<RoadEdgeDesc> kept_edges;
+	RoadEdgeIter ei, eend;
+	for (boost::tie(ei, eend) = boost::edges(graph); ei != eend; ++ei) {
+		RoadEdgeDesc e = *ei;
+		RoadVertexDesc src = boost::source(e, graph);
+		RoadVertexDesc tgt = boost::target(e, graph);
+		if ((graph[e]->valid && graph[src]->valid && graph[tgt]->valid) || referenced_edges.count(e.get_property()) > 0) {
+			kept_edges.push_back(e);
+			kept_vertices[src] = true;
+			kept_vertices[tgt] = true;
+		}
+	}
+
+	// take the kept vertices and edges out, and add them to the cleared graph
+	// (the graph is rebuilt in place because copying it would invalidate the edge descriptors)
+	std::vector<RoadVertexPtr> vertices;
+	mapping.vertices.assign(num_vertices, graph_traits<BGLGraph>::null_vertex());
+	for (RoadVertexDesc v = 0; v < num_vertices; v++) {
+		if (!kept_vertices[v]) continue;
+
+		mapping.vertices[v] = vertices.size();
+		vertices.push_back(graph[v]);
+	}
+
+	std::vector<RoadVertexDesc> sources(kept_edges.size());
+	std::vector<RoadVertexDesc> targets(kept_edges.size());
+	std::vector<RoadEdgePtr> edges(kept_edges.size());
+	std::vector<const void*> keys(kept_edges.size());
+	for (int i = 0; i < kept_edges.size(); i++) {
+		sources[i] = mapping.vertices[boost::source(kept_edges[i], graph)];
+		targets[i] = mapping.vertices[boost::target(kept_edges[i], graph)];
+		edges[i] = graph[kept_edges[i]];
+		keys[i] = kept_edges[i].get_property();
+	}
+
+	graph.clear();
+	mapping.edges.clear();
+	numInvalidVertices = 0;
+	numInvalidEdges = 0;
+	for (int i = 0; i < vertices.size(); i++) {
+		RoadVertexDesc v = boost::add_vertex(graph);
+		graph[v] = vertices[i];
+		if (!vertices[i]->valid) numInvalidVertices++;
+	}
+	for (int i = 0; i < edges.size(); i++) {
+		std::pair<RoadEdgeDesc, bool> edge_pair = boost::add_edge(sources[i], targets[i], graph);
+		graph[edge_pair.first] = edges[i];
+		mapping.edges[keys[i]] = edge_pair.first;
+		if (!edges[i]->valid) numInvalidEdges++;
+	}
+
+	// all the descriptors have changed, so the spatial index and the snapshots are rebuilt when they are needed next time
+	vertexIndex.clear(vertexIndex.getCellSize());
+	segmentIndex.clear(segmentIndex.getCellSize());
+	indexedVertices = 0;
+	indexedEdges = 0;
+
+	versioning = false;
+	version.clear();
+	versionEdgeIndices.clear();
+	changedVertices.clear();
+	changedEdges.clear();
+	addedEdges.clear();
+
+	countedVertices = boost::num_vertices(graph);
+	countedEdges = boost::num_edges(graph);
+	numRetainedInvalid = numInvalidVertices + numInvalidEdges;
+
+	trackedVertices = boost::num_vertices(graph);
+	trackedEdges = boost::num_edges(graph);
+
+	return num_vertices - countedVertices + num_edges - countedEdges;
+}
+
+/**
+* Return the view of the polyline of the edge which starts at the location of the src vertex.
+* The view is reversed if the first point of the polyline is closer to the other end vertex, and the polyline itself is left as it is.
+*/
+PolylineView RoadGraph::polylineFrom(RoadEdgeDesc e, RoadVertexDesc src) {
+	RoadVertexDesc tgt = boost::source(e, graph) == src ? boost::target(e, graph) : boost::source(e, graph);
+	const std::vector<QVector2D>& polyline = graph[e]->polyline;
+
+	return PolylineView(polyline, (graph[src]->pt - polyline[0]).lengthSquared() > (graph[tgt]->pt - polyline[0]).lengthSquared());
+}
+
+/**
+* Record the vertex to the command of History and to the changes for the next snapshot before it is changed or after it is added.
+*/
+void RoadGraph::recordVertex(RoadVertexDesc v, bool added) {
+	revision++;
+	if (command != NULL) command->recordVertex(*this, v, added);
+
+	if (trackingChanges) {
+		if (added) {
+			trackedVertices++;
+		}
+		else {
+			changedBoxes.push_back(std::make_pair(graph[v]->pt, graph[v]->pt));
+		}
+		changedBoxVertices.push_back(v);
+		if (changedBoxes.size() + changedBoxVertices.size() + changedBoxEdges.size() > MAX_CHANGED_BOXES) stopTrackingChanges();
+	}
+
+	if (versioning) {
+		if (added) {
+			versionedVertices++;
+		}
+		else {
+			changedVertices.insert(v);
+		}
+	}
+}
+
+/**
+* Record the edge to the command of History and to the changes for the next snapshot before it is changed or after it is added.
+*/
+void RoadGraph::recordEdge(RoadEdgeDesc e, bool added) {
+	revision++;
+	if (command != NULL) command->recordEdge(*this, e, added);
+
+	if (trackingChanges) {
+		if (added) {
+			trackedEdges++;
+		}
+		else if (!graph[e]->polyline.empty()) {
+			QVector2D minPt, maxPt;
+			polylineBoundingBox(graph[e]->polyline, minPt, maxPt);
+			changedBoxes.push_back(std::make_pair(minPt, maxPt));
+		}
+		changedBoxEdges.push_back(e);
+		if (changedBoxes.size() + changedBoxVertices.size() + changedBoxEdges.size() > MAX_CHANGED_BOXES) stopTrackingChanges();
+	}
+
+	if (versioning) {
+		if (added) {
+			addedEdges.push_back(e);
+			versionedEdges++;
+		}
+		else {
+			changedEdges[graph[e].get()] = e;
+		}
+	}
+}
+
+/**
+* Stop tracking the changes and release the pending ones, after which the next takeChangedBoxes reports that everything has changed.
+* This bounds the pending changes when nobody takes them, such as while the tiles are bypassed by drawing the roads directly.
+*/
+void RoadGraph::stopTrackingChanges() {
+	trackingChanges = false;
+	std::vector<std::pair<QVector2D, QVector2D> >().swap(changedBoxes);
+	std::vector<RoadVertexDesc>().swap(changedBoxVertices);
+	std::vector<RoadEdgeDesc>().swap(changedBoxEdges);
+}
+
+/**
+* Add the bounding boxes of the changed vertices and edges after the changes to the changed boxes.
+*/
+void RoadGraph::flushChangedBoxes() {
+	for (int i = 0; i < changedBoxVertices.size(); i++) {
+		const QVector2D& pt = graph[changedBoxVertices[i]]->pt;
+		changedBoxes.push_back(std::make_pair(pt, pt));
+	}
+	changedBoxVertices.clear();
+
+	for (int i = 0; i < changedBoxEdges.size(); i++) {
+		if (graph[changedBoxEdges[i]]->polyline.empty()) continue;
+
+		QVector2D minPt, maxPt;
+		polylineBoundingBox(graph[changedBoxEdges[i]]->polyline, minPt, maxPt);
+		changedBoxes.push_back(std::make_pair(minPt, maxPt));
+	}
+	changedBoxEdges.clear();
+}
+
+/**
+* Return true if the spatial index contains all the vertices and edges of the graph.
+*/
+bool RoadGraph::isIndexUpToDate() {
+	return indexedVertices == boost::num_vertices(graph) && indexedEdges == boost::num_edges(graph);
+}
+
+/**
+* Return true if the invalid vertices and edges have been counted for all the vertices and edges of the graph.
+*/
+bool RoadGraph::isInvalidCountUpToDate() {
+	return countedVertices == boost::num_vertices(graph) && countedEdges == boost::num_edges(graph);
+}
+
+/**
+* Count the invalid vertices and edges again if the counts are not up to date.
+*/
+void RoadGraph::updateInvalidCount() {
+	if (isInvalidCountUpToDate()) return;
+
+	numInvalidVertices = 0;
+	RoadVertexIter vi, vend;
+	for (boost::tie(vi, vend) = boost::vertices(graph); vi != vend; ++vi) {
+		if (!graph[*vi]->valid) numInvalidVertices++;
+	}
+
+	numInvalidEdges = 0;
+	RoadEdgeIter ei, eend;
+	for (boost::tie(ei, eend) = boost::edges(graph); ei != eend; ++ei) {
+		if (!graph[*ei]->valid) numInvalidEdges++;
+	}
+
+	countedVertices = boost::num_vertices(graph);
+	countedEdges = boost::num_edges(graph);
+}
+
+/**
+* Rebuild the spatial index if it is not up to date.
+* The cell size is set to the average length of the polyline segments.
 */
-void RoadGraph::orderPolyLine(RoadEdgeDesc e, RoadVertexDesc src) {
-	RoadVertexDesc tgt;
+void RoadGraph::updateIndex() {
+	if (isIndexUpToDate()) return;
+
+	float total_length = 0.0f;
+	int num_segments = 0;
+	RoadEdgeIter ei, eend;
+	for (boost::tie(ei, eend) = boost::edges(graph); ei != eend; ++ei) {
+		if (!graph[*ei]->valid) continue;
+
+		total_length += graph[*ei]->getLength();
+		num_segments += graph[*ei]->polyline.size() - 1;
+	}
+	float cell_size = num_segments > 0 ? std::max(total_length / num_segments, 1.0f) : vertexIndex.getCellSize();
+
+	vertexIndex.clear(cell_size);
+	segmentIndex.clear(cell_size);
+
+	RoadVertexIter vi, vend;
+	for (boost::tie(vi, vend) = boost::vertices(graph); vi != vend; ++vi) {
+		indexVertex(*vi, true);
+	}
+	for (boost::tie(ei, eend) = boost::edges(graph); ei != eend; ++ei) {
+		indexEdge(*ei, true);
+	}
 
-	RoadVertexDesc s = boost::source(e, graph);
-	RoadVertexDesc t = boost::target(e, graph);
+	indexedVertices = boost::num_vertices(graph);
+	indexedEdges = boost::num_edges(graph);
+}
+
+/**
+* Add the vertex to the spatial index if add is true, or remove it otherwise.
+* Invalid vertices are never registered.
+*/
+void RoadGraph::indexVertex(RoadVertexDesc v, bool add) {
+	if (!graph[v]->valid) return;
 
-	if (s == src) {
-		tgt = t;
+	if (add) {
+		vertexIndex.insert(v, graph[v]->pt, graph[v]->pt);
 	}
 	else {
-		tgt = s;
+		vertexIndex.remove(v, graph[v]->pt, graph[v]->pt);
+	}
+}
+
+/**
+* Add the polyline segments of the edge to the spatial index if add is true, or remove them otherwise.
+* Invalid edges are never registered.
+*/
+void RoadGraph::indexEdge(RoadEdgeDesc e, bool add) {
+	if (!graph[e]->valid) return;
+
+	const std::vector<QVector2D>& polyline = graph[e]->polyline;
+	for (int i = 0; i < (int)polyline.size() - 1; i++) {
+		if (add) {
+			segmentIndex.insert(RoadSegment(e, i), polyline[i], polyline[i + 1]);
+		}
+		else {
+			segmentIndex.remove(RoadSegment(e, i), polyline[i], polyline[i + 1]);
+		}
 	}
+}
+
+/**
+* Return the bounding box of the segment of the polyline which starts at the index-th point.
+*/
+void RoadGraph::segmentBoundingBox(const std::vector<QVector2D>& polyline, int index, QVector2D& minPt, QVector2D& maxPt) {
+	minPt = QVector2D(std::min(polyline[index].x(), polyline[index + 1].x()), std::min(polyline[index].y(), polyline[index + 1].y()));
+	maxPt = QVector2D(std::max(polyline[index].x(), polyline[index + 1].x()), std::max(polyline[index].y(), polyline[index + 1].y()));
+}
+
+/**
+* Return the bounding box of the polyline, which must not be empty.
+*/
+void RoadGraph::polylineBoundingBox(const std::vector<QVector2D>& polyline, QVector2D& minPt, QVector2D& maxPt) {
+	minPt = polyline[0];
+	maxPt = polyline[0];
+	for (int i = 1; i < polyline.size(); i++) {
+		minPt.setX(std::min(minPt.x(), polyline[i].x()));
+		minPt.setY(std::min(minPt.y(), polyline[i].y()));
+		maxPt.setX(std::max(maxPt.x(), polyline[i].x()));
+		maxPt.setY(std::max(maxPt.y(), polyline[i].y()));
+	}
+}
 
-	// If the order is opposite, reverse the order.
-	if ((graph[src]->pt - graph[e]->polyline[0]).lengthSquared() > (graph[tgt]->pt - graph[e]->polyline[0]).lengthSquared()) {
-		std::reverse(graph[e]->polyline.begin(), graph[e]->polyline.end());
+/**
+* Return true if the segment of the polyline which starts at the index-th point overlaps the box.
+*/
+bool RoadGraph::segmentOverlaps(const std::vector<QVector2D>& polyline, int index, const QVector2D& minPt, const QVector2D& maxPt) {
+	QVector2D segMinPt, segMaxPt;
+	segmentBoundingBox(polyline, index, segMinPt, segMaxPt);
+	if (segMaxPt.x() < minPt.x() || segMinPt.x() > maxPt.x() || segMaxPt.y() < minPt.y() || segMinPt.y() > maxPt.y()) return false;
+
+	// the segment misses the box if all the corners of the box are on the same side of its line
+	const QVector2D& a = polyline[index];
+	QVector2D d = polyline[index + 1] - a;
+	float c0 = d.x() * (minPt.y() - a.y()) - d.y() * (minPt.x() - a.x());
+	float c1 = d.x() * (minPt.y() - a.y()) - d.y() * (maxPt.x() - a.x());
+	float c2 = d.x() * (maxPt.y() - a.y()) - d.y() * (minPt.x() - a.x());
+	float c3 = d.x() * (maxPt.y() - a.y()) - d.y() * (maxPt.x() - a.x());
+	return !((c0 > 0 && c1 > 0 && c2 > 0 && c3 > 0) || (c0 < 0 && c1 < 0 && c2 < 0 && c3 < 0));
+}
+
+/**
+* Make room for the points of a new polyline at once, and count the allocation.
+*/
+void RoadGraph::reservePolyline(std::vector<QVector2D>& polyline, int num_points) {
+	if (polyline.capacity() < num_points) Instrumentation::count(Instrumentation::POLYLINE_ALLOCATIONS);
+	polyline.reserve(num_points);
+}
+
+/**
+* Append the points [begin, end) of the view to the polyline.
+*/
+void RoadGraph::appendPoints(std::vector<QVector2D>& polyline, const PolylineView& view, int begin, int end) {
+	if (view.reversed) {
+		polyline.insert(polyline.end(), view.points->rbegin() + begin, view.points->rbegin() + end);
+	}
+	else {
+		polyline.insert(polyline.end(), view.points->begin() + begin, view.points->begin() + end);
 	}
 }
 
@@ -513,6 +1631,10 @@ float RoadGraph::pointSegmentDistance(const QVector2D &a, const QVector2D &b, co
 float RoadGraph::pointSegmentDistance(const QVector2D &a, const QVector2D &b, const QVector2D &c, QVector2D& closest_pt) {
 	float r_numerator = QVector2D::dotProduct(c - a, b - a);
 	float r_denomenator = (b - a).lengthSquared();
+	if (r_denomenator == 0.0f) {
+		closest_pt = a;
+		return (c - a).length();
+	}
 	float r = r_numerator / r_denomenator;
 
 	if (r < 0 || r > 1) {
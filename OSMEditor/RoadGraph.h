@@ -9,8 +9,14 @@
 #include <boost/graph/topological_sort.hpp>
 #include <boost/graph/graph_utility.hpp>
 #include <boost/shared_ptr.hpp>
+#include <functional>
+#include <unordered_map>
+#include <unordered_set>
 #include "RoadVertex.h"
 #include "RoadEdge.h"
+#include "SpatialIndex.h"
+#include "RoadGraphVersion.h"
+#include "Instrumentation.h"
 
 using namespace boost;
 
@@ -22,14 +28,74 @@ typedef graph_traits<BGLGraph>::edge_iterator RoadEdgeIter;
 typedef graph_traits<BGLGraph>::out_edge_iterator RoadOutEdgeIter;
 typedef graph_traits<BGLGraph>::in_edge_iterator RoadInEdgeIter;
 
+class HistoryCommand;
+
+/**
+* A segment of the polyline of an edge, which starts at the index-th point.
+*/
+struct RoadSegment {
+	RoadEdgeDesc edge;
+	int index;
+
+	RoadSegment(RoadEdgeDesc edge, int index) : edge(edge), index(index) {}
+	bool operator==(const RoadSegment& other) const { return edge == other.edge && index == other.index; }
+};
+
+/**
+* Read-only view of the polyline of an edge in either direction, so that polylines can be concatenated without reversing them.
+*/
+struct PolylineView {
+	const std::vector<QVector2D>* points;
+	bool reversed;
+
+	PolylineView(const std::vector<QVector2D>& points, bool reversed) : points(&points), reversed(reversed) {}
+	int size() const { return points->size(); }
+	const QVector2D& operator[](int i) const { return reversed ? (*points)[points->size() - 1 - i] : (*points)[i]; }
+};
+
+/**
+* New descriptors of the vertices and edges which are kept by RoadGraph::compact.
+* The edges are looked up by the property of their old descriptors, which is not dereferenced.
+*/
+class RoadGraphMapping {
+public:
+	std::vector<RoadVertexDesc> vertices;
+	std::unordered_map<const void*, RoadEdgeDesc> edges;
+
+public:
+	/**
+	* Replace the old descriptor with the new one, and return false if the vertex has been removed.
+	*/
+	bool mapVertex(RoadVertexDesc& v) const {
+		if (v >= vertices.size() || vertices[v] == graph_traits<BGLGraph>::null_vertex()) return false;
+		v = vertices[v];
+		return true;
+	}
+
+	/**
+	* Replace the old descriptor with the new one, and return false if the edge has been removed.
+	*/
+	bool mapEdge(RoadEdgeDesc& e) const {
+		std::unordered_map<const void*, RoadEdgeDesc>::const_iterator it = edges.find(e.get_property());
+		if (it == edges.end()) return false;
+		e = it->second;
+		return true;
+	}
+};
+
 class RoadGraph {
 private:
 	static float EPS;
+	static int MIN_COMPACTION_SIZE;
+	static int MAX_CHANGED_BOXES;
 
 public:
 	BGLGraph graph;
 	QVector2D centerLonLat;
 
+	// command of History to which the vertices and edges are recorded before they are changed, or NULL
+	HistoryCommand* command;
+
 	// for rendering (These variables should be updated via setZ() function only!!
 	float highwayHeight;
 	float avenueHeight;
@@ -45,27 +111,117 @@ public:
 	bool showAvenues;
 	bool showLocalStreets;
 
+	// fraction of the invalid vertices and edges above which needsCompaction() returns true
+	float compactionThreshold;
+
+private:
+	// spatial index of the valid vertices and edge segments, which is rebuilt if the number of vertices or edges does not match
+	SpatialIndex<RoadVertexDesc> vertexIndex;
+	SpatialIndex<RoadSegment> segmentIndex;
+	int indexedVertices;
+	int indexedEdges;
+
+	// persistent copy of the graph which snapshot() returns, and the elements changed since the last snapshot.
+	// The changes are tracked only after the first snapshot, and the copy is rebuilt if the numbers of vertices or edges do not match.
+	bool versioning;
+	RoadGraphVersion version;
+	std::unordered_map<RoadEdge*, unsigned int> versionEdgeIndices;
+	std::unordered_set<RoadVertexDesc> changedVertices;
+	std::unordered_map<RoadEdge*, RoadEdgeDesc> changedEdges;
+	std::vector<RoadEdgeDesc> addedEdges;
+	int versionedVertices;
+	int versionedEdges;
+
+	// number of the invalid vertices and edges, which are counted again if the numbers of vertices or edges do not match,
+	// and the number of the invalid ones which were kept by the last compaction
+	int numInvalidVertices;
+	int numInvalidEdges;
+	int countedVertices;
+	int countedEdges;
+	int numRetainedInvalid;
+
+	// number of the changes recorded by recordVertex and recordEdge, by which the renderers detect that their caches are stale
+	unsigned int revision;
+
+	// bounding boxes of the vertices and edges before they were changed, and the changed ones whose bounding boxes after the changes are taken later.
+	// The changes are tracked only after the first takeChangedBoxes, and everything is reported as changed if the numbers of vertices or edges do not match.
+	// The tracking stops once MAX_CHANGED_BOXES changes are pending, e.g. while the tiles are not drawn, until the next takeChangedBoxes.
+	bool trackingChanges;
+	std::vector<std::pair<QVector2D, QVector2D> > changedBoxes;
+	std::vector<RoadVertexDesc> changedBoxVertices;
+	std::vector<RoadEdgeDesc> changedBoxEdges;
+	int trackedVertices;
+	int trackedEdges;
+
 public:
 	RoadGraph();
+	RoadGraph(const RoadGraph& roads);
 	~RoadGraph();
 
+	RoadGraph& operator=(const RoadGraph& roads);
+
 	void clear();
 	RoadGraph clone();
+	RoadGraphVersion snapshot();
+	RoadVertexDesc addVertex(const QVector2D& pt);
+	RoadEdgeDesc addEdge(RoadVertexDesc src, RoadVertexDesc tgt, RoadEdgePtr edge);
+	void invalidateVertex(RoadVertexDesc v);
+	void invalidateEdge(RoadEdgeDesc e);
+	void setVertex(RoadVertexDesc v, const RoadVertex& vertex);
+	void setEdge(RoadEdgeDesc e, const RoadEdge& edge);
 	int getDegree(RoadVertexDesc v);
 	void reduce();
+	void reduceNaive();
 	bool reduce(RoadVertexDesc desc);
 	void moveVertex(RoadVertexDesc v, const QVector2D& pt);
 	void movePolyline(std::vector<QVector2D>& polyline, const QVector2D& tgt_pos);
 	bool hasEdge(RoadVertexDesc desc1, RoadVertexDesc desc2);
 	RoadEdgeDesc getEdge(RoadVertexDesc src, RoadVertexDesc tgt);
 	bool getEdge(const QVector2D &pt, float threshold, RoadEdgeDesc& e);
+	bool findClosestVertex(const QVector2D& pt, float threshold, RoadVertexDesc& closest_vertex_desc, std::function<bool(RoadVertexDesc)> except = nullptr);
+	bool findClosestEdgePoint(const QVector2D& pt, float threshold, RoadEdgeDesc& closest_edge_desc, int& closest_edge_point);
+	bool findClosestEdge(const QVector2D& pt, float threshold, RoadEdgeDesc& closest_edge_desc, QVector2D& closest_pt, std::function<bool(RoadEdgeDesc)> except = nullptr);
+	void findVertices(const QVector2D& minPt, const QVector2D& maxPt, std::vector<RoadVertexDesc>& vertices);
+	void findEdges(const QVector2D& minPt, const QVector2D& maxPt, std::vector<RoadEdgeDesc>& edges);
 	void deleteEdge(RoadEdgeDesc desc);
+	int deleteEdgesExcept(int types);
 	bool snapVertex(RoadVertexDesc v1, RoadVertexDesc v2);
-	void orderPolyLine(RoadEdgeDesc e, RoadVertexDesc src);
+	PolylineView polylineFrom(RoadEdgeDesc e, RoadVertexDesc src);
 	RoadVertexDesc splitEdge(RoadEdgeDesc edge_desc, const QVector2D& pt);
-	void planarify();
+	int planarify();
+	int planarifyNaive();
 	bool planarifyOne();
+	bool needsCompaction();
+	void releaseRetainedInvalid();
+	unsigned int getRevision() const { return revision; }
+	bool takeChangedBoxes(std::vector<std::pair<QVector2D, QVector2D> >& boxes);
+	float averageSegmentLength();
+	void countValid(int& num_vertices, int& num_edges) const;
+	int compact(RoadGraphMapping& mapping);
+	int compact(RoadGraphMapping& mapping, const std::vector<bool>& referenced_vertices, const std::unordered_set<const void*>& referenced_edges);
 
+private:
+	void recordVertex(RoadVertexDesc v, bool added = false);
+	void recordEdge(RoadEdgeDesc e, bool added = false);
+	void rebuildVersion();
+	void flushChangedBoxes();
+	void stopTrackingChanges();
+	bool isReducible(RoadVertexDesc v, const std::vector<int>& degrees);
+	void getReducibleEdges(RoadVertexDesc v, RoadEdgeDesc* ed);
+	void mergeChain(const std::vector<RoadVertexDesc>& vertices, const std::vector<RoadEdgeDesc>& edges);
+	bool isInvalidCountUpToDate();
+	void updateInvalidCount();
+	bool isIndexUpToDate();
+	void updateIndex();
+	void indexVertex(RoadVertexDesc v, bool add);
+	void indexEdge(RoadEdgeDesc e, bool add);
+	static void segmentBoundingBox(const std::vector<QVector2D>& polyline, int index, QVector2D& minPt, QVector2D& maxPt);
+	static void polylineBoundingBox(const std::vector<QVector2D>& polyline, QVector2D& minPt, QVector2D& maxPt);
+	static bool segmentOverlaps(const std::vector<QVector2D>& polyline, int index, const QVector2D& minPt, const QVector2D& maxPt);
+	static void reservePolyline(std::vector<QVector2D>& polyline, int num_points);
+	static void appendPoints(std::vector<QVector2D>& polyline, const PolylineView& view, int begin, int end);
+
+public:
 	static float pointSegmentDistance(const QVector2D &a, const QVector2D &b, const QVector2D &c);
 	static float pointSegmentDistance(const QVector2D &a, const QVector2D &b, const QVector2D &c, QVector2D& closest_pt);
 	static bool segmentSegmentIntersect(const QVector2D& a, const QVector2D& b, const QVector2D& c, const QVector2D& d, float *tab, float *tcd, QVector2D& intPoint);
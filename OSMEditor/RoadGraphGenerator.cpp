@@ -0,0 +1,262 @@
+#include "RoadGraphGenerator.h"
+#include <cmath>
+#include <algorithm>
+
+namespace {
+	const float PI = 3.14159265f;
+
+	// probability of a road between the neighboring junctions of the random layout
+	const float RANDOM_ROAD_PROBABILITY = 0.85f;
+
+	// length in blocks of the long roads across the random layout
+	const float CROSSING_ROAD_LENGTH = 8.0f;
+
+	// number of the spokes from the center of the radial layout, which is doubled whenever the ring segments get twice as long as the blocks
+	const int MIN_SPOKES = 8;
+}
+
+RoadGraphGenerator::RoadGraphGenerator(int layout, int numEdges, unsigned int seed) {
+	this->layout = layout;
+	this->numEdges = numEdges;
+	this->seed = seed;
+	blockSize = 100.0f;
+	numInteriorPoints = 1;
+	crossingDensity = 0.1f;
+}
+
+/**
+* Generate the road network, which replaces the road graph.
+* The elements are added directly to the graph as the parser does, so the spatial index is built when it is queried first.
+*/
+void RoadGraphGenerator::generate(RoadGraph& roads) {
+	roads.clear();
+	rng.seed(seed);
+
+	switch (layout) {
+	case LAYOUT_RADIAL:
+		generateRadial(roads);
+		break;
+	case LAYOUT_RANDOM:
+		generateRandom(roads);
+		break;
+	default:
+		generateGrid(roads);
+		break;
+	}
+}
+
+/**
+* Return the layout of the name (grid, radial, or random), or -1 if it is unknown.
+*/
+int RoadGraphGenerator::parseLayout(const QString& name) {
+	for (int layout = 0; layout < NUM_LAYOUTS; layout++) {
+		if (name == layoutName(layout)) return layout;
+	}
+
+	return -1;
+}
+
+/**
+* Return the name of the layout.
+*/
+const char* RoadGraphGenerator::layoutName(int layout) {
+	switch (layout) {
+	case LAYOUT_RADIAL:
+		return "radial";
+	case LAYOUT_RANDOM:
+		return "random";
+	default:
+		return "grid";
+	}
+}
+
+/**
+* Generate a Manhattan grid of n x n junctions, which has 2n(n-1) edges.
+*/
+void RoadGraphGenerator::generateGrid(RoadGraph& roads) {
+	int n = (int)std::ceil(std::sqrt(numEdges * 0.5)) + 1;
+
+	std::vector<RoadVertexDesc> vertices(n * n);
+	for (int y = 0; y < n; y++) {
+		for (int x = 0; x < n; x++) {
+			vertices[y * n + x] = addVertex(roads, QVector2D(x * blockSize, y * blockSize));
+		}
+	}
+
+	for (int y = 0; y < n; y++) {
+		for (int x = 0; x < n; x++) {
+			if (x + 1 < n) addEdge(roads, vertices[y * n + x], vertices[y * n + x + 1], lineType(y));
+			if (y + 1 < n) addEdge(roads, vertices[y * n + x], vertices[(y + 1) * n + x], lineType(x));
+		}
+	}
+}
+
+/**
+* Generate rings around the center at every block, which are connected by the spokes.
+* The number of the spokes is doubled whenever the ring segments would get longer than twice the block size,
+* and the new spokes start at that ring. The first spokes from the center are highways and boulevards alternately.
+* Rings are added until the number of the edges is reached.
+*/
+void RoadGraphGenerator::generateRadial(RoadGraph& roads) {
+	QVector2D center(0.0f, 0.0f);
+	RoadVertexDesc center_desc = addVertex(roads, center);
+
+	std::vector<RoadVertexDesc> inner_ring;
+	int num_generated = 0;
+	for (int r = 1; num_generated < numEdges; r++) {
+		int num_spokes = MIN_SPOKES;
+		while (2.0f * PI * r / num_spokes > 2.0f) num_spokes *= 2;
+
+		std::vector<RoadVertexDesc> ring(num_spokes);
+		for (int k = 0; k < num_spokes; k++) {
+			float angle = 2.0f * PI * k / num_spokes;
+			ring[k] = addVertex(roads, center + QVector2D(std::cos(angle), std::sin(angle)) * (r * blockSize));
+		}
+
+		// connect the spokes from the inner ring, whose number is the same or half of this ring
+		int step = inner_ring.empty() ? 1 : num_spokes / (int)inner_ring.size();
+		for (int k = 0; k < num_spokes; k += step) {
+			RoadVertexDesc inner = inner_ring.empty() ? center_desc : inner_ring[k / step];
+			int first_spoke = k % (num_spokes / MIN_SPOKES) == 0 ? k / (num_spokes / MIN_SPOKES) : -1;
+			int type = first_spoke < 0 ? lineType(k) : (first_spoke % 2 == 0 ? RoadEdge::TYPE_HIGHWAY : RoadEdge::TYPE_BOULEVARD);
+			addEdge(roads, inner, ring[k], type);
+			num_generated++;
+		}
+
+		for (int k = 0; k < num_spokes; k++) {
+			addEdge(roads, ring[k], ring[(k + 1) % num_spokes], lineType(r), &center);
+			num_generated++;
+		}
+
+		inner_ring = ring;
+	}
+}
+
+/**
+* Generate a jittered grid where each road between the neighboring junctions exists at RANDOM_ROAD_PROBABILITY,
+* and long straight roads (highways and boulevards) across it which have no junction with the other roads.
+* The number of the long roads is chosen from the expected number of the roads each of them crosses,
+* which is 4 / PI times its length in blocks for random directions, so that the number of the crossings is about crossingDensity per edge.
+*/
+void RoadGraphGenerator::generateRandom(RoadGraph& roads) {
+	int n = std::max(2, (int)std::ceil(std::sqrt(numEdges / (2.0f * RANDOM_ROAD_PROBABILITY))));
+
+	// the junctions are added only when a road reaches them, so that no junction is left alone
+	std::vector<QVector2D> points(n * n);
+	std::vector<RoadVertexDesc> vertices(n * n);
+	std::vector<bool> added(n * n, false);
+	for (int y = 0; y < n; y++) {
+		for (int x = 0; x < n; x++) {
+			points[y * n + x] = QVector2D((x + random(0.2f, 0.8f)) * blockSize, (y + random(0.2f, 0.8f)) * blockSize);
+		}
+	}
+
+	int num_generated = 0;
+	for (int y = 0; y < n; y++) {
+		for (int x = 0; x < n; x++) {
+			for (int dir = 0; dir < 2; dir++) {
+				int x2 = dir == 0 ? x + 1 : x;
+				int y2 = dir == 0 ? y : y + 1;
+				if (x2 >= n || y2 >= n) continue;
+				if (random(0.0f, 1.0f) >= RANDOM_ROAD_PROBABILITY) continue;
+
+				int ends[2] = { y * n + x, y2 * n + x2 };
+				for (int i = 0; i < 2; i++) {
+					if (added[ends[i]]) continue;
+					vertices[ends[i]] = addVertex(roads, points[ends[i]]);
+					added[ends[i]] = true;
+				}
+				addEdge(roads, vertices[ends[0]], vertices[ends[1]], lineType(dir == 0 ? y : x));
+				num_generated++;
+			}
+		}
+	}
+
+	// the long roads are kept inside the grid if it is large enough
+	float length = std::min(CROSSING_ROAD_LENGTH, (float)n) * blockSize;
+	float crossings_per_road = 4.0f / PI * length / blockSize * RANDOM_ROAD_PROBABILITY;
+	int num_crossing_roads = (int)(crossingDensity * num_generated / crossings_per_road + 0.5f);
+	for (int i = 0; i < num_crossing_roads; i++) {
+		float angle = random(0.0f, PI);
+		QVector2D dir(std::cos(angle), std::sin(angle));
+		QVector2D mid(random(length * 0.5f, n * blockSize - length * 0.5f), random(length * 0.5f, n * blockSize - length * 0.5f));
+
+		RoadVertexDesc src = addVertex(roads, mid - dir * (length * 0.5f));
+		RoadVertexDesc tgt = addVertex(roads, mid + dir * (length * 0.5f));
+		addEdge(roads, src, tgt, i % 2 == 0 ? RoadEdge::TYPE_HIGHWAY : RoadEdge::TYPE_BOULEVARD);
+	}
+}
+
+RoadVertexDesc RoadGraphGenerator::addVertex(RoadGraph& roads, const QVector2D& pt) {
+	RoadVertexDesc desc = boost::add_vertex(roads.graph);
+	roads.graph[desc] = RoadVertexPtr(new RoadVertex(pt));
+	return desc;
+}
+
+/**
+* Add an edge whose interior points are evenly spaced between the end points and up to 1 m off to either side.
+* If the center is specified, the points are on the arc around the center instead of on the straight line.
+*/
+void RoadGraphGenerator::addEdge(RoadGraph& roads, RoadVertexDesc src, RoadVertexDesc tgt, int type, const QVector2D* center) {
+	const QVector2D& p0 = roads.graph[src]->pt;
+	const QVector2D& p1 = roads.graph[tgt]->pt;
+	QVector2D normal = QVector2D(p0.y() - p1.y(), p1.x() - p0.x()).normalized();
+
+	RoadEdgePtr edge = RoadEdgePtr(new RoadEdge(type, typeLanes(type)));
+	edge->polyline.reserve(numInteriorPoints + 2);
+	edge->polyline.push_back(p0);
+	for (int i = 1; i <= numInteriorPoints; i++) {
+		float t = (float)i / (numInteriorPoints + 1);
+		QVector2D pt;
+		if (center != NULL) {
+			float angle0 = std::atan2(p0.y() - center->y(), p0.x() - center->x());
+			float angle1 = std::atan2(p1.y() - center->y(), p1.x() - center->x());
+			if (angle1 < angle0) angle1 += 2.0f * PI;
+			float angle = angle0 + (angle1 - angle0) * t;
+			pt = *center + QVector2D(std::cos(angle), std::sin(angle)) * (p0 - *center).length();
+		}
+		else {
+			pt = p0 + (p1 - p0) * t;
+		}
+		edge->polyline.push_back(pt + normal * random(-1.0f, 1.0f));
+	}
+	edge->polyline.push_back(p1);
+
+	std::pair<RoadEdgeDesc, bool> edge_pair = boost::add_edge(src, tgt, roads.graph);
+	roads.graph[edge_pair.first] = edge;
+}
+
+/**
+* Return a random number in [min, max) from the next output of the generator.
+* The fraction is made of the top 24 bits of the output, which a float holds exactly, so that it never rounds up to 1.
+*/
+float RoadGraphGenerator::random(float min, float max) {
+	float t = (rng() >> 8) * (1.0f / 16777216.0f);
+	return std::min(min + (max - min) * t, std::nextafter(max, min));
+}
+
+/**
+* Return the road type of the index-th line of the grid: every 40th is a highway, every 20th a boulevard, every 5th an avenue, and the others are streets.
+*/
+int RoadGraphGenerator::lineType(int index) {
+	if (index % 40 == 0) return RoadEdge::TYPE_HIGHWAY;
+	else if (index % 20 == 0) return RoadEdge::TYPE_BOULEVARD;
+	else if (index % 5 == 0) return RoadEdge::TYPE_AVENUE;
+	else return RoadEdge::TYPE_STREET;
+}
+
+/**
+* Return the number of the lanes of the road type.
+*/
+int RoadGraphGenerator::typeLanes(int type) {
+	switch (type) {
+	case RoadEdge::TYPE_HIGHWAY:
+		return 4;
+	case RoadEdge::TYPE_BOULEVARD:
+		return 3;
+	case RoadEdge::TYPE_AVENUE:
+		return 2;
+	default:
+		return 1;
+	}
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <random>
+#include <QString>
+#include "RoadGraph.h"
+
+/**
+* Generates synthetic road networks of a given size for scale testing, which are the same for the same seed and parameters.
+*
+* The grid layout is a Manhattan grid of square blocks, the radial layout is rings around a center connected by spokes,
+* and the random layout is a jittered grid with missing roads and long straight roads across it, which cross the other roads
+* without a junction at about crossingDensity crossings per edge, so that planarify has to split them.
+* The road types are mixed by the hierarchy of the lines (every 5th line is an avenue, every 20th a boulevard, and every 40th a highway),
+* and each polyline has the specified number of interior points, slightly off the straight line.
+* The random numbers are taken directly from std::mt19937, whose sequence is defined by the standard, rather than from
+* the distributions of the standard library, which differ between the compilers.
+*/
+class RoadGraphGenerator {
+public:
+	enum { LAYOUT_GRID = 0, LAYOUT_RADIAL, LAYOUT_RANDOM, NUM_LAYOUTS };
+
+	int layout;
+	// approximate number of the edges to generate
+	int numEdges;
+	unsigned int seed;
+	// distance in meters between the neighboring junctions
+	float blockSize;
+	// number of the interior points of each polyline
+	int numInteriorPoints;
+	// number of the crossings without a junction per edge of the random layout
+	float crossingDensity;
+
+private:
+	std::mt19937 rng;
+
+public:
+	RoadGraphGenerator(int layout = LAYOUT_GRID, int numEdges = 10000, unsigned int seed = 1);
+
+	void generate(RoadGraph& roads);
+	static int parseLayout(const QString& name);
+	static const char* layoutName(int layout);
+
+private:
+	void generateGrid(RoadGraph& roads);
+	void generateRadial(RoadGraph& roads);
+	void generateRandom(RoadGraph& roads);
+	RoadVertexDesc addVertex(RoadGraph& roads, const QVector2D& pt);
+	void addEdge(RoadGraph& roads, RoadVertexDesc src, RoadVertexDesc tgt, int type, const QVector2D* center = NULL);
+	float random(float min, float max);
+	static int lineType(int index);
+	static int typeLanes(int type);
+};
@@ -0,0 +1,101 @@
+#include "RoadGraphLoader.h"
+#include <QFileInfo>
+#include "OSMParallelParser.h"
+#include "OSMPbfParser.h"
+#include "RoadGraphSnapshot.h"
+
+RoadGraphLoader::RoadGraphLoader() : done(false) {
+	succeeded = false;
+}
+
+RoadGraphLoader::~RoadGraphLoader() {
+	cancel();
+	if (thread.joinable()) thread.join();
+}
+
+/**
+* Start loading the file on the worker thread. If the previous file is still being loaded, it is canceled and discarded.
+*/
+void RoadGraphLoader::start(const QString& filename) {
+	if (thread.joinable()) {
+		cancel();
+		thread.join();
+	}
+
+	this->filename = filename;
+	roads.clear();
+	progress.reset();
+	done = false;
+	succeeded = false;
+
+	thread = std::thread([this]() {
+		try {
+			succeeded = load(this->filename, roads, &progress);
+		}
+		catch (...) {
+			succeeded = false;
+		}
+		done = true;
+	});
+}
+
+/**
+* Ask the parser to stop at its next chunk or block. The worker is done soon after that, and finish() returns RESULT_CANCELED.
+*/
+void RoadGraphLoader::cancel() {
+	progress.cancel();
+}
+
+/**
+* Wait for the worker, and replace the road graph with the loaded one if the file was loaded.
+* The graph is moved rather than copied, and the caches of the graph (e.g. the spatial index) are built again when they are queried.
+*
+* @return		RESULT_LOADED if the graph is replaced, or RESULT_FAILED / RESULT_CANCELED if it is kept as it is
+*/
+int RoadGraphLoader::finish(RoadGraph& roads) {
+	if (!thread.joinable()) return RESULT_FAILED;
+	thread.join();
+
+	int result = progress.isCanceled() ? RESULT_CANCELED : (succeeded ? RESULT_LOADED : RESULT_FAILED);
+	if (result == RESULT_LOADED) {
+		roads.clear();
+		roads.graph.swap(this->roads.graph);
+		roads.centerLonLat = this->roads.centerLonLat;
+	}
+
+	// release the old graph or the discarded one, and the edges which have not been taken
+	this->roads.clear();
+	progress.reset();
+
+	return result;
+}
+
+/**
+* Load the file into the road graph on the calling thread by the parser for its extension, with the parser threads of OSMParallelParser.
+* The snapshot is read at once, so its progress is reported only when it is done.
+*
+* @param progress		if not NULL, the progress and the new edges are reported to this, and the loading stops once it is canceled
+* @return				false if the file cannot be read
+*/
+bool RoadGraphLoader::load(const QString& filename, RoadGraph& roads, OSMParseProgress* progress, int numThreads) {
+	roads.clear();
+
+	if (filename.endsWith(".rgs", Qt::CaseInsensitive)) {
+		if (progress != NULL) progress->setTotal(QFileInfo(filename).size());
+		bool ret = RoadGraphSnapshot::load(filename, roads);
+		if (progress != NULL) progress->consume(progress->total());
+		return ret;
+	}
+	else if (filename.endsWith(".pbf", Qt::CaseInsensitive)) {
+		OSMRoadsParser parser(&roads);
+		parser.setProgress(progress);
+		OSMPbfParser reader(&parser, true, numThreads);
+		return reader.parse(filename);
+	}
+	else {
+		OSMRoadsParser parser(&roads);
+		parser.setProgress(progress);
+		OSMParallelParser reader(&parser, true, numThreads);
+		return reader.parse(filename);
+	}
+}
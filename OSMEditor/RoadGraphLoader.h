@@ -0,0 +1,44 @@
+#pragma once
+
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <QString>
+#include "RoadGraph.h"
+#include "OSMRoadsParser.h"
+
+/**
+* Loads an OSM file (.osm or .osm.pbf) or a snapshot (.rgs) into its own road graph on a worker thread.
+* The progress is reported by the bytes consumed by the parser, and the edges are kept as they are added to the graph,
+* so that the caller can draw them while the rest of the file is being parsed.
+* Once the worker is done, finish() moves the whole graph into the caller's one at once, unless the loading failed or was canceled.
+* The caller's graph is never touched by the worker.
+*/
+class RoadGraphLoader {
+public:
+	enum { RESULT_LOADED = 0, RESULT_FAILED, RESULT_CANCELED };
+
+private:
+	std::thread thread;
+	QString filename;
+	RoadGraph roads;
+	OSMParseProgress progress;
+	std::atomic<bool> done;
+	bool succeeded;
+
+public:
+	RoadGraphLoader();
+	~RoadGraphLoader();
+
+	void start(const QString& filename);
+	void cancel();
+	bool isLoading() const { return thread.joinable(); }
+	bool isDone() const { return done; }
+	const QString& getFilename() const { return filename; }
+	long long bytesConsumed() const { return progress.consumed(); }
+	long long bytesTotal() const { return progress.total(); }
+	void takeEdges(std::vector<RoadEdgePtr>& edges) { progress.takeEdges(edges); }
+	int finish(RoadGraph& roads);
+
+	static bool load(const QString& filename, RoadGraph& roads, OSMParseProgress* progress = NULL, int numThreads = 0);
+};
@@ -0,0 +1,73 @@
+#include "RoadGraphSaver.h"
+#include "RoadGraphSnapshot.h"
+#include "OSMRoadsExporter.h"
+
+RoadGraphSaver::RoadGraphSaver() : done(false) {
+	succeeded = false;
+}
+
+/**
+* Wait for the file being written, since stopping the worker would leave it broken.
+*/
+RoadGraphSaver::~RoadGraphSaver() {
+	if (thread.joinable()) thread.join();
+}
+
+/**
+* Start writing the version to the file on the worker thread. If the previous file is still being written, it is waited for first.
+*/
+void RoadGraphSaver::start(const QString& filename, const RoadGraphVersion& version) {
+	if (thread.joinable()) thread.join();
+
+	this->filename = filename;
+	this->version = version;
+	done = false;
+	succeeded = false;
+
+	thread = std::thread([this]() {
+		try {
+			RoadGraph roads;
+			this->version.toRoadGraph(roads);
+			succeeded = save(this->filename, roads);
+		}
+		catch (...) {
+			succeeded = false;
+		}
+		done = true;
+	});
+}
+
+/**
+* Wait for the worker, and release the version so that its chunks are no longer shared with the graph.
+*
+* @return		true if the file was written
+*/
+bool RoadGraphSaver::finish() {
+	if (!thread.joinable()) return false;
+	thread.join();
+
+	version.clear();
+
+	return succeeded;
+}
+
+/**
+* Save the road graph to the file on the calling thread by the writer for its extension.
+*
+* @return		false if the file cannot be written
+*/
+bool RoadGraphSaver::save(const QString& filename, const RoadGraph& roads) {
+	try {
+		if (filename.endsWith(".rgs", Qt::CaseInsensitive)) {
+			RoadGraphSnapshot::save(filename, roads);
+		}
+		else {
+			OSMRoadsExporter::save(filename, roads);
+		}
+	}
+	catch (const char*) {
+		return false;
+	}
+
+	return true;
+}
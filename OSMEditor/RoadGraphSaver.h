@@ -0,0 +1,34 @@
+#pragma once
+
+#include <thread>
+#include <atomic>
+#include <QString>
+#include "RoadGraph.h"
+#include "RoadGraphVersion.h"
+
+/**
+* Saves a version of the road graph to an OSM file (.osm) or a snapshot (.rgs) on a worker thread.
+* The version is taken by RoadGraph::snapshot() on the caller's thread, which copies only the chunks changed since
+* the last version, and the worker converts it to its own road graph before writing it.
+* Since a version is never changed once it is taken, the caller can keep editing the graph while the file is written.
+*/
+class RoadGraphSaver {
+private:
+	std::thread thread;
+	QString filename;
+	RoadGraphVersion version;
+	std::atomic<bool> done;
+	bool succeeded;
+
+public:
+	RoadGraphSaver();
+	~RoadGraphSaver();
+
+	void start(const QString& filename, const RoadGraphVersion& version);
+	bool isSaving() const { return thread.joinable(); }
+	bool isDone() const { return done; }
+	const QString& getFilename() const { return filename; }
+	bool finish();
+
+	static bool save(const QString& filename, const RoadGraph& roads);
+};
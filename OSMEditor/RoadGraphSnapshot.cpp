@@ -0,0 +1,193 @@
+#include "RoadGraphSnapshot.h"
+#include <QFile>
+#include <QByteArray>
+#include <string.h>
+#include <boost/make_shared.hpp>
+#include "BufferedWriter.h"
+#include "MappedFile.h"
+
+namespace {
+	const char MAGIC[4] = { 'R', 'G', 'S', 'S' };
+
+	// written in the native byte order, so that it reads differently on a machine of the other byte order
+	const quint32 BYTE_ORDER_MARK = 0x01020304;
+
+	enum { EDGE_VALID = 1, EDGE_ONE_WAY = 2, EDGE_LINK = 4, EDGE_ROUNDABOUT = 8 };
+
+	// All the fields are 4 bytes long, so the records have no padding and stay aligned in the mapped file.
+	struct Header {
+		char magic[4];
+		quint32 version;
+		float centerLon;
+		float centerLat;
+		quint32 numVertices;
+		quint32 numEdges;
+		quint32 numPoints;
+		quint32 byteOrder;		// BYTE_ORDER_MARK
+	};
+
+	struct VertexRecord {
+		float x;
+		float y;
+	};
+
+	struct EdgeRecord {
+		quint32 src;
+		quint32 tgt;
+		quint32 firstPoint;
+		quint32 numPoints;
+		qint32 type;
+		qint32 lanes;
+		quint32 flags;
+	};
+
+	struct PointRecord {
+		float x;
+		float y;
+	};
+
+	static_assert(sizeof(Header) == 32 && sizeof(VertexRecord) == 8 && sizeof(EdgeRecord) == 28, "snapshot records must not be padded");
+	static_assert(sizeof(QVector2D) == sizeof(PointRecord), "polylines are copied as arrays of PointRecord");
+}
+
+/**
+* Save the valid vertices and edges of the road graph to the snapshot file.
+*/
+void RoadGraphSnapshot::save(const QString& filename, const RoadGraph& roads) {
+	QFile file(filename);
+	if (!file.open(QFile::WriteOnly)) throw "File cannot open.";
+
+	// assign the consecutive indices to the valid vertices
+	std::vector<quint32> mapping(boost::num_vertices(roads.graph), 0);
+	quint32 num_vertices = 0;
+	RoadVertexIter vi, vend;
+	for (boost::tie(vi, vend) = boost::vertices(roads.graph); vi != vend; vi++) {
+		if (!roads.graph[*vi]->valid) continue;
+		mapping[*vi] = num_vertices++;
+	}
+
+	quint32 num_edges = 0;
+	quint32 num_points = 0;
+	RoadEdgeIter ei, eend;
+	for (boost::tie(ei, eend) = boost::edges(roads.graph); ei != eend; ei++) {
+		if (!roads.graph[*ei]->valid) continue;
+		if (!roads.graph[boost::source(*ei, roads.graph)]->valid || !roads.graph[boost::target(*ei, roads.graph)]->valid) continue;
+
+		num_edges++;
+		num_points += roads.graph[*ei]->polyline.size();
+	}
+
+	BufferedWriter out(&file);
+
+	Header header;
+	memcpy(header.magic, MAGIC, sizeof(MAGIC));
+	header.version = VERSION;
+	header.centerLon = roads.centerLonLat.x();
+	header.centerLat = roads.centerLonLat.y();
+	header.numVertices = num_vertices;
+	header.numEdges = num_edges;
+	header.numPoints = num_points;
+	header.byteOrder = BYTE_ORDER_MARK;
+	out.write((const char*)&header, sizeof(header));
+
+	for (boost::tie(vi, vend) = boost::vertices(roads.graph); vi != vend; vi++) {
+		if (!roads.graph[*vi]->valid) continue;
+
+		VertexRecord vertex;
+		vertex.x = roads.graph[*vi]->pt.x();
+		vertex.y = roads.graph[*vi]->pt.y();
+		out.write((const char*)&vertex, sizeof(vertex));
+	}
+
+	quint32 first_point = 0;
+	for (boost::tie(ei, eend) = boost::edges(roads.graph); ei != eend; ei++) {
+		const RoadEdgePtr& e = roads.graph[*ei];
+		if (!e->valid) continue;
+
+		RoadVertexDesc src = boost::source(*ei, roads.graph);
+		RoadVertexDesc tgt = boost::target(*ei, roads.graph);
+		if (!roads.graph[src]->valid || !roads.graph[tgt]->valid) continue;
+
+		EdgeRecord edge;
+		edge.src = mapping[src];
+		edge.tgt = mapping[tgt];
+		edge.firstPoint = first_point;
+		edge.numPoints = e->polyline.size();
+		edge.type = e->type;
+		edge.lanes = e->lanes;
+		edge.flags = EDGE_VALID | (e->oneWay ? EDGE_ONE_WAY : 0) | (e->link ? EDGE_LINK : 0) | (e->roundabout ? EDGE_ROUNDABOUT : 0);
+		out.write((const char*)&edge, sizeof(edge));
+
+		first_point += edge.numPoints;
+	}
+
+	for (boost::tie(ei, eend) = boost::edges(roads.graph); ei != eend; ei++) {
+		const RoadEdgePtr& e = roads.graph[*ei];
+		if (!e->valid) continue;
+		if (!roads.graph[boost::source(*ei, roads.graph)]->valid || !roads.graph[boost::target(*ei, roads.graph)]->valid) continue;
+
+		if (!e->polyline.empty()) {
+			out.write((const char*)&e->polyline[0], e->polyline.size() * sizeof(PointRecord));
+		}
+	}
+
+	if (!out.flush()) throw "File cannot be written.";
+}
+
+/**
+* Load the road graph from the snapshot file, which is memory-mapped by MappedFile.
+*
+* @return		false if the file cannot be opened or is not a valid snapshot
+*/
+bool RoadGraphSnapshot::load(const QString& filename, RoadGraph& roads) {
+	MappedFile file(filename);
+	if (!file.open()) return false;
+
+	return load(file.data(), file.size(), roads);
+}
+
+/**
+* Load the road graph from the snapshot data.
+* The graph is cleared first, and left empty if the data is not a valid snapshot.
+*
+* @return		false if the data is not a valid snapshot
+*/
+bool RoadGraphSnapshot::load(const char* data, qint64 size, RoadGraph& roads) {
+	roads.clear();
+
+	if (size < (qint64)sizeof(Header)) return false;
+	const Header* header = (const Header*)data;
+	if (memcmp(header->magic, MAGIC, sizeof(MAGIC)) != 0 || header->version > VERSION) return false;
+	if (header->byteOrder != BYTE_ORDER_MARK) return false;
+	if (size != sizeof(Header) + (qint64)header->numVertices * sizeof(VertexRecord) + (qint64)header->numEdges * sizeof(EdgeRecord) + (qint64)header->numPoints * sizeof(PointRecord)) return false;
+
+	const VertexRecord* vertices = (const VertexRecord*)(data + sizeof(Header));
+	const EdgeRecord* edges = (const EdgeRecord*)(vertices + header->numVertices);
+	const PointRecord* points = (const PointRecord*)(edges + header->numEdges);
+
+	// validate all the references before building the graph
+	for (quint32 i = 0; i < header->numEdges; i++) {
+		if (edges[i].src >= header->numVertices || edges[i].tgt >= header->numVertices) return false;
+		if (edges[i].firstPoint > header->numPoints || edges[i].numPoints > header->numPoints - edges[i].firstPoint) return false;
+	}
+
+	roads.centerLonLat = QVector2D(header->centerLon, header->centerLat);
+
+	// The vertices are allocated at once, and each element is created with a single allocation by make_shared.
+	roads.graph = BGLGraph(header->numVertices);
+	for (quint32 i = 0; i < header->numVertices; i++) {
+		roads.graph[i] = boost::make_shared<RoadVertex>(QVector2D(vertices[i].x, vertices[i].y));
+	}
+
+	for (quint32 i = 0; i < header->numEdges; i++) {
+		const EdgeRecord& record = edges[i];
+		RoadEdgePtr e = boost::make_shared<RoadEdge>(record.type, record.lanes, (record.flags & EDGE_ONE_WAY) != 0, (record.flags & EDGE_LINK) != 0, (record.flags & EDGE_ROUNDABOUT) != 0);
+		e->valid = (record.flags & EDGE_VALID) != 0;
+		e->polyline.assign((const QVector2D*)(points + record.firstPoint), (const QVector2D*)(points + record.firstPoint + record.numPoints));
+
+		std::pair<RoadEdgeDesc, bool> edge_pair = boost::add_edge(record.src, record.tgt, roads.graph);
+		roads.graph[edge_pair.first] = e;
+	}
+
+	return true;
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <QString>
+#include "RoadGraph.h"
+
+/**
+* Binary snapshot of the road graph (.rgs), which is loaded without parsing or projecting the coordinates again.
+*
+* The file consists of a fixed-size header followed by three arrays of fixed-size records in the native byte order of the machine
+* which wrote it, so that the records can be used directly from the mapped file: the vertices, the edges, and the points of all
+* the polylines, to which each edge refers by its range. The header has a byte order mark, and the files of the other byte order are rejected.
+* Only the valid vertices and edges are stored, in the same way as RoadGraph::clone copies them.
+* The version in the header is incremented whenever the layout changes, and newer files are rejected.
+*/
+class RoadGraphSnapshot {
+public:
+	static const unsigned int VERSION = 1;
+
+public:
+	static void save(const QString& filename, const RoadGraph& roads);
+	static bool load(const QString& filename, RoadGraph& roads);
+	static bool load(const char* data, qint64 size, RoadGraph& roads);
+};
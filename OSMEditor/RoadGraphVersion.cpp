@@ -0,0 +1,168 @@
+#include "RoadGraphVersion.h"
+#include <boost/make_shared.hpp>
+#include "RoadGraph.h"
+
+RoadGraphVersion::RoadGraphVersion() {
+	clear();
+}
+
+void RoadGraphVersion::clear() {
+	table = boost::make_shared<Table>();
+	table->numVertices = 0;
+	table->numEdges = 0;
+}
+
+/**
+* Copy all the vertices and edges of the road graph, including the invalid ones.
+*/
+void RoadGraphVersion::build(const RoadGraph& roads) {
+	clear();
+	table->centerLonLat = roads.centerLonLat;
+
+	RoadVertexIter vi, vend;
+	for (boost::tie(vi, vend) = boost::vertices(roads.graph); vi != vend; ++vi) {
+		addVertex(*roads.graph[*vi]);
+	}
+
+	RoadEdgeIter ei, eend;
+	for (boost::tie(ei, eend) = boost::edges(roads.graph); ei != eend; ++ei) {
+		addEdge(boost::source(*ei, roads.graph), boost::target(*ei, roads.graph), *roads.graph[*ei]);
+	}
+}
+
+/**
+* Convert the version to the road graph, which is cleared first.
+* The vertex descriptors and the order of the edges are the same as the road graph from which this version was taken.
+*/
+void RoadGraphVersion::toRoadGraph(RoadGraph& roads) const {
+	roads.clear();
+	roads.centerLonLat = table->centerLonLat;
+
+	roads.graph = BGLGraph(table->numVertices);
+	for (unsigned int v = 0; v < table->numVertices; v++) {
+		roads.graph[v] = boost::make_shared<RoadVertex>(vertex(v));
+	}
+
+	for (unsigned int e = 0; e < table->numEdges; e++) {
+		const EdgeRecord& record = edge(e);
+		std::pair<RoadEdgeDesc, bool> edge_pair = boost::add_edge(record.src, record.tgt, roads.graph);
+		roads.graph[edge_pair.first] = boost::make_shared<RoadEdge>(*record.edge);
+	}
+}
+
+void RoadGraphVersion::setCenterLonLat(const QVector2D& centerLonLat) {
+	mutableTable().centerLonLat = centerLonLat;
+}
+
+unsigned int RoadGraphVersion::addVertex(const RoadVertex& vertex) {
+	Table& t = mutableTable();
+	unsigned int v = t.numVertices++;
+	if (v % CHUNK_SIZE == 0) {
+		t.vertexChunks.push_back(boost::make_shared<VertexChunk>());
+		t.vertexChunks.back()->reserve(CHUNK_SIZE);
+	}
+	mutableVertexChunk(v / CHUNK_SIZE).push_back(vertex);
+
+	return v;
+}
+
+unsigned int RoadGraphVersion::addEdge(unsigned int src, unsigned int tgt, const RoadEdge& edge) {
+	Table& t = mutableTable();
+	unsigned int e = t.numEdges++;
+	if (e % CHUNK_SIZE == 0) {
+		t.edgeChunks.push_back(boost::make_shared<EdgeChunk>());
+		t.edgeChunks.back()->reserve(CHUNK_SIZE);
+	}
+
+	EdgeRecord record;
+	record.src = src;
+	record.tgt = tgt;
+	record.edge = boost::make_shared<RoadEdge>(edge);
+	mutableEdgeChunk(e / CHUNK_SIZE).push_back(record);
+
+	return e;
+}
+
+void RoadGraphVersion::setVertex(unsigned int v, const RoadVertex& vertex) {
+	mutableVertexChunk(v / CHUNK_SIZE)[v % CHUNK_SIZE] = vertex;
+}
+
+void RoadGraphVersion::setEdge(unsigned int e, const RoadEdge& edge) {
+	mutableEdgeChunk(e / CHUNK_SIZE)[e % CHUNK_SIZE].edge = boost::make_shared<RoadEdge>(edge);
+}
+
+/**
+* Return the number of bytes of the table, the chunks, and the edge objects which this version refers to.
+*/
+size_t RoadGraphVersion::memoryUsage() const {
+	return memoryUsage(false);
+}
+
+/**
+* Return the number of bytes which this version accounts for, where the memory shared with other versions
+* is divided by the number of them. The sum over all the versions is the memory they use in total.
+*/
+size_t RoadGraphVersion::ownMemoryUsage() const {
+	return memoryUsage(true);
+}
+
+/**
+* Return the table, which is copied first if it is shared with another version.
+*/
+RoadGraphVersion::Table& RoadGraphVersion::mutableTable() {
+	if (!table.unique()) table = boost::make_shared<Table>(*table);
+	return *table;
+}
+
+/**
+* Return the chunk of the vertices, which is copied first if it is shared with another version.
+*/
+RoadGraphVersion::VertexChunk& RoadGraphVersion::mutableVertexChunk(unsigned int chunk) {
+	Table& t = mutableTable();
+	if (!t.vertexChunks[chunk].unique()) {
+		boost::shared_ptr<VertexChunk> copied = boost::make_shared<VertexChunk>();
+		copied->reserve(CHUNK_SIZE);
+		copied->assign(t.vertexChunks[chunk]->begin(), t.vertexChunks[chunk]->end());
+		t.vertexChunks[chunk] = copied;
+	}
+	return *t.vertexChunks[chunk];
+}
+
+/**
+* Return the chunk of the edges, which is copied first if it is shared with another version.
+* The edge objects themselves are immutable, so they are shared by the copied chunk.
+*/
+RoadGraphVersion::EdgeChunk& RoadGraphVersion::mutableEdgeChunk(unsigned int chunk) {
+	Table& t = mutableTable();
+	if (!t.edgeChunks[chunk].unique()) {
+		boost::shared_ptr<EdgeChunk> copied = boost::make_shared<EdgeChunk>();
+		copied->reserve(CHUNK_SIZE);
+		copied->assign(t.edgeChunks[chunk]->begin(), t.edgeChunks[chunk]->end());
+		t.edgeChunks[chunk] = copied;
+	}
+	return *t.edgeChunks[chunk];
+}
+
+size_t RoadGraphVersion::memoryUsage(bool own) const {
+	double size = sizeof(Table) + (table->vertexChunks.capacity() + table->edgeChunks.capacity()) * sizeof(boost::shared_ptr<VertexChunk>);
+	if (own) size /= table.use_count();
+
+	for (int i = 0; i < table->vertexChunks.size(); i++) {
+		double chunk_size = sizeof(VertexChunk) + table->vertexChunks[i]->capacity() * sizeof(RoadVertex);
+		size += own ? chunk_size / table->vertexChunks[i].use_count() : chunk_size;
+	}
+
+	for (int i = 0; i < table->edgeChunks.size(); i++) {
+		const EdgeChunk& chunk = *table->edgeChunks[i];
+		double chunk_size = sizeof(EdgeChunk) + chunk.capacity() * sizeof(EdgeRecord);
+		double num_owners = own ? table->edgeChunks[i].use_count() : 1;
+		size += chunk_size / num_owners;
+
+		for (int j = 0; j < chunk.size(); j++) {
+			double edge_size = sizeof(RoadEdge) + chunk[j].edge->polyline.capacity() * sizeof(QVector2D);
+			size += own ? edge_size / chunk[j].edge.use_count() / num_owners : edge_size;
+		}
+	}
+
+	return (size_t)size;
+}
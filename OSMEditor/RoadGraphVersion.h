@@ -0,0 +1,74 @@
+#pragma once
+
+#include <vector>
+#include <QVector2D>
+#include <boost/shared_ptr.hpp>
+#include "RoadVertex.h"
+#include "RoadEdge.h"
+
+class RoadGraph;
+
+/**
+* Persistent version of the road graph, which is copied in constant time.
+*
+* The vertices and the edges are stored in chunks of CHUNK_SIZE elements, and the table of the chunks is shared
+* as well. Copies share everything, and a modification copies only the table and the chunk it changes if they are
+* shared with another copy. Each edge is an immutable RoadEdge object, so changing an edge replaces its object.
+* Since a version is never changed once it is shared, it can be read from another thread while the original
+* keeps being modified.
+*
+* The vertices and the edges have the same indices and order as the vertices and the edges of RoadGraph,
+* including the invalid ones.
+*/
+class RoadGraphVersion {
+public:
+	static const int CHUNK_SIZE = 256;
+
+	struct EdgeRecord {
+		unsigned int src;
+		unsigned int tgt;
+		boost::shared_ptr<const RoadEdge> edge;
+	};
+
+private:
+	typedef std::vector<RoadVertex> VertexChunk;
+	typedef std::vector<EdgeRecord> EdgeChunk;
+
+	struct Table {
+		QVector2D centerLonLat;
+		unsigned int numVertices;
+		unsigned int numEdges;
+		std::vector<boost::shared_ptr<VertexChunk> > vertexChunks;
+		std::vector<boost::shared_ptr<EdgeChunk> > edgeChunks;
+	};
+
+	boost::shared_ptr<Table> table;
+
+public:
+	RoadGraphVersion();
+
+	void clear();
+	void build(const RoadGraph& roads);
+	void toRoadGraph(RoadGraph& roads) const;
+
+	unsigned int numVertices() const { return table->numVertices; }
+	unsigned int numEdges() const { return table->numEdges; }
+	const QVector2D& centerLonLat() const { return table->centerLonLat; }
+	const RoadVertex& vertex(unsigned int v) const { return (*table->vertexChunks[v / CHUNK_SIZE])[v % CHUNK_SIZE]; }
+	const EdgeRecord& edge(unsigned int e) const { return (*table->edgeChunks[e / CHUNK_SIZE])[e % CHUNK_SIZE]; }
+
+	void setCenterLonLat(const QVector2D& centerLonLat);
+	unsigned int addVertex(const RoadVertex& vertex);
+	unsigned int addEdge(unsigned int src, unsigned int tgt, const RoadEdge& edge);
+	void setVertex(unsigned int v, const RoadVertex& vertex);
+	void setEdge(unsigned int e, const RoadEdge& edge);
+
+	size_t memoryUsage() const;
+	size_t ownMemoryUsage() const;
+
+private:
+	Table& mutableTable();
+	VertexChunk& mutableVertexChunk(unsigned int chunk);
+	EdgeChunk& mutableEdgeChunk(unsigned int chunk);
+	size_t memoryUsage(bool own) const;
+};
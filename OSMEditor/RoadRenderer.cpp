@@ -0,0 +1,324 @@
+#include "RoadRenderer.h"
+#include <cmath>
+#include <algorithm>
+
+float RoadRenderer::LOD_TOLERANCE = 0.5f;
+float RoadRenderer::MIN_MARKER_SPACING = 8.0f;
+
+RoadRenderer::RoadRenderer() {
+	culling = true;
+
+	numDrawnEdges = 0;
+	numDrawnPoints = 0;
+	numDrawCalls = 0;
+	markersDrawn = true;
+
+	roads = NULL;
+	scale = 1.0;
+	width = 0;
+	height = 0;
+
+	lodRoads = NULL;
+	lodLevel = 0;
+	lodRevision = 0;
+	lodEdges = 0;
+}
+
+/**
+* Set the view for the next drawEdges and drawVertices.
+* This collects the edges of the shown classes by the class, and the vertices except those whose edges are all hidden.
+* In the culling mode, only the visible ones are collected, and whether the point markers are drawn is decided.
+* The edges and vertices are collected with the margin of the marker radius and the half of the road width,
+* so that the roads and the markers across the border are drawn as well.
+*
+* @param origin		screen coordinates of the world origin
+* @param scale		pixels per meter
+*/
+void RoadRenderer::setView(RoadGraph& roads, const QPointF& origin, double scale, int width, int height) {
+	this->roads = &roads;
+	this->origin = origin;
+	this->scale = scale;
+	this->width = width;
+	this->height = height;
+	getStyles(roads, styles);
+
+	numDrawnEdges = 0;
+	numDrawnPoints = 0;
+	numDrawCalls = 0;
+	markersDrawn = true;
+	for (int c = 0; c < NUM_CLASSES; c++) {
+		visibleEdges[c].clear();
+		visiblePolylines[c].clear();
+	}
+	visibleVertices.clear();
+
+	bool all_shown = true;
+	for (int c = 0; c < NUM_CLASSES; c++) {
+		if (!styles[c].shown) all_shown = false;
+	}
+
+	if (!culling) {
+		RoadEdgeIter ei, eend;
+		for (boost::tie(ei, eend) = boost::edges(roads.graph); ei != eend; ++ei) {
+			if (!roads.graph[*ei]->valid) continue;
+
+			int c = getClass(roads.graph[*ei]->type);
+			if (!styles[c].shown) continue;
+
+			visibleEdges[c].push_back(*ei);
+			visiblePolylines[c].push_back(&roads.graph[*ei]->polyline);
+		}
+
+		RoadVertexIter vi, vend;
+		for (boost::tie(vi, vend) = boost::vertices(roads.graph); vi != vend; ++vi) {
+			if (!roads.graph[*vi]->valid) continue;
+			if (!all_shown && !hasShownEdge(*vi)) continue;
+
+			visibleVertices.push_back(*vi);
+		}
+		return;
+	}
+
+	// The zoom level doubles the scale, so the tolerance of the simplified polylines is between LOD_TOLERANCE and twice of it in pixels.
+	int level = (int)std::floor(std::log2(scale));
+	if (lodRoads != &roads || lodLevel != level || lodRevision != roads.getRevision() || lodEdges != boost::num_edges(roads.graph)) {
+		lodPolylines.clear();
+		lodRoads = &roads;
+		lodLevel = level;
+		lodRevision = roads.getRevision();
+		lodEdges = boost::num_edges(roads.graph);
+	}
+	float tolerance = LOD_TOLERANCE / std::pow(2.0f, level);
+
+	// the visible rectangle in the world coordinates, which is extended by the margin
+	float margin = getMargin(styles, scale) / scale;
+	QVector2D minPt(-origin.x() / scale - margin, (origin.y() - height) / scale - margin);
+	QVector2D maxPt((width - origin.x()) / scale + margin, origin.y() / scale + margin);
+	roads.findEdges(minPt, maxPt, foundEdges);
+
+	// the edges of the hidden classes are skipped before they are simplified
+	for (int i = 0; i < foundEdges.size(); i++) {
+		int c = getClass(roads.graph[foundEdges[i]]->type);
+		if (!styles[c].shown) continue;
+
+		visibleEdges[c].push_back(foundEdges[i]);
+		visiblePolylines[c].push_back(&getLodPolyline(foundEdges[i], tolerance));
+	}
+
+	// skip the markers if the polyline segments are shorter than MIN_MARKER_SPACING pixels on average
+	markersDrawn = roads.averageSegmentLength() * scale >= MIN_MARKER_SPACING;
+	if (markersDrawn) {
+		roads.findVertices(minPt, maxPt, visibleVertices);
+		if (!all_shown) {
+			visibleVertices.erase(std::remove_if(visibleVertices.begin(), visibleVertices.end(), [&](RoadVertexDesc v) { return !hasShownEdge(v); }), visibleVertices.end());
+		}
+	}
+}
+
+/**
+* Draw the edges of each class as a path with the pen of the class, and then the markers of their interior points.
+*/
+void RoadRenderer::drawEdges(QPainter& painter) {
+	for (int c = 0; c < NUM_CLASSES; c++) {
+		if (visibleEdges[c].empty()) continue;
+
+		QPainterPath path;
+		for (int i = 0; i < visiblePolylines[c].size(); i++) {
+			addPolyline(path, *visiblePolylines[c][i]);
+		}
+		painter.strokePath(path, QPen(styles[c].color, std::max(1.0, styles[c].width * scale), Qt::SolidLine, Qt::RoundCap, Qt::RoundJoin));
+		numDrawCalls++;
+	}
+
+	if (!markersDrawn) return;
+
+	for (int c = 0; c < NUM_CLASSES; c++) {
+		if (visibleEdges[c].empty()) continue;
+
+		painter.setPen(QPen(styles[c].color, 1));
+		painter.setBrush(styles[c].color);
+		for (int i = 0; i < visibleEdges[c].size(); i++) {
+			drawPointMarkers(painter, roads->graph[visibleEdges[c][i]]->polyline);
+		}
+	}
+}
+
+/**
+* Draw the markers of the vertices.
+*/
+void RoadRenderer::drawVertices(QPainter& painter) {
+	painter.setPen(QPen(QColor(192, 192, 192), 1));
+	painter.setBrush(QBrush(QColor(255, 255, 255)));
+
+	for (int i = 0; i < visibleVertices.size(); i++) {
+		drawMarker(painter, worldToScreenCoordinates(roads->graph[visibleVertices[i]]->pt), 5);
+	}
+}
+
+/**
+* Discard the simplified polylines.
+*/
+void RoadRenderer::clearCache() {
+	lodPolylines.clear();
+	lodRoads = NULL;
+}
+
+/**
+* Get the style of each class from the colors, the visibility, and the lane width of the road graph.
+*/
+void RoadRenderer::getStyles(const RoadGraph& roads, ClassStyle* styles) {
+	styles[CLASS_STREET].color = roads.colorStreet;
+	styles[CLASS_STREET].shown = roads.showLocalStreets;
+	styles[CLASS_STREET].width = RoadEdge::getWidth(RoadEdge::TYPE_STREET, roads.widthBase);
+	styles[CLASS_AVENUE].color = roads.colorAvenue;
+	styles[CLASS_AVENUE].shown = roads.showAvenues;
+	styles[CLASS_AVENUE].width = RoadEdge::getWidth(RoadEdge::TYPE_AVENUE, roads.widthBase);
+	styles[CLASS_BOULEVARD].color = roads.colorBoulevard;
+	styles[CLASS_BOULEVARD].shown = roads.showBoulevard;
+	styles[CLASS_BOULEVARD].width = RoadEdge::getWidth(RoadEdge::TYPE_BOULEVARD, roads.widthBase);
+	styles[CLASS_HIGHWAY].color = roads.colorHighway;
+	styles[CLASS_HIGHWAY].shown = roads.showHighways;
+	styles[CLASS_HIGHWAY].width = RoadEdge::getWidth(RoadEdge::TYPE_HIGHWAY, roads.widthBase);
+}
+
+/**
+* Return the distance in pixels from a polyline or a vertex within which it may be drawn,
+* which is the radius of the markers or the half of the widest shown road.
+*/
+float RoadRenderer::getMargin(const ClassStyle* styles, double scale) {
+	float margin = 3.0f;
+	for (int c = 0; c < NUM_CLASSES; c++) {
+		if (!styles[c].shown) continue;
+
+		margin = std::max(margin, (float)std::max(1.0, styles[c].width * scale) * 0.5f + 1.0f);
+	}
+
+	return margin;
+}
+
+/**
+* Return the class of the road type.
+*/
+int RoadRenderer::getClass(int type) {
+	switch (type) {
+	case RoadEdge::TYPE_HIGHWAY:
+		return CLASS_HIGHWAY;
+	case RoadEdge::TYPE_BOULEVARD:
+		return CLASS_BOULEVARD;
+	case RoadEdge::TYPE_AVENUE:
+		return CLASS_AVENUE;
+	default:
+		return CLASS_STREET;
+	}
+}
+
+/**
+* Simplify the polyline by Douglas-Peucker such that every removed point is within the tolerance from the simplified polyline.
+* The first and the last points are always kept.
+*/
+void RoadRenderer::simplify(const std::vector<QVector2D>& polyline, float tolerance, std::vector<QVector2D>& simplified) {
+	simplified.clear();
+	if (polyline.size() <= 2) {
+		simplified = polyline;
+		return;
+	}
+
+	std::vector<bool> kept(polyline.size(), false);
+	kept[0] = true;
+	kept[polyline.size() - 1] = true;
+	int num_kept = 2;
+
+	// ranges of the points whose farthest point from the segment between the ends has not been examined
+	std::vector<std::pair<int, int> > ranges;
+	ranges.push_back(std::make_pair(0, (int)polyline.size() - 1));
+	while (!ranges.empty()) {
+		int first = ranges.back().first;
+		int last = ranges.back().second;
+		ranges.pop_back();
+
+		float max_dist = tolerance;
+		int farthest = -1;
+		for (int i = first + 1; i < last; i++) {
+			QVector2D closest_pt;
+			float dist = RoadGraph::pointSegmentDistance(polyline[first], polyline[last], polyline[i], closest_pt);
+			if (dist > max_dist) {
+				max_dist = dist;
+				farthest = i;
+			}
+		}
+		if (farthest < 0) continue;
+
+		kept[farthest] = true;
+		num_kept++;
+		ranges.push_back(std::make_pair(first, farthest));
+		ranges.push_back(std::make_pair(farthest, last));
+	}
+
+	simplified.reserve(num_kept);
+	for (int i = 0; i < polyline.size(); i++) {
+		if (kept[i]) simplified.push_back(polyline[i]);
+	}
+}
+
+/**
+* Return the polyline of the edge simplified for the current zoom level, which is simplified only the first time it is requested.
+*/
+const std::vector<QVector2D>& RoadRenderer::getLodPolyline(RoadEdgeDesc e, float tolerance) {
+	const RoadEdgePtr& edge = roads->graph[e];
+
+	std::unordered_map<const RoadEdge*, std::vector<QVector2D> >::iterator it = lodPolylines.find(edge.get());
+	if (it != lodPolylines.end()) return it->second;
+
+	std::vector<QVector2D>& simplified = lodPolylines[edge.get()];
+	simplify(edge->polyline, tolerance, simplified);
+	return simplified;
+}
+
+/**
+* Return true if the vertex has a valid edge of a shown class or no valid edge at all.
+*/
+bool RoadRenderer::hasShownEdge(RoadVertexDesc v) {
+	bool has_edge = false;
+	RoadOutEdgeIter ei, eend;
+	for (boost::tie(ei, eend) = boost::out_edges(v, roads->graph); ei != eend; ++ei) {
+		if (!roads->graph[*ei]->valid) continue;
+
+		if (styles[getClass(roads->graph[*ei]->type)].shown) return true;
+		has_edge = true;
+	}
+
+	return !has_edge;
+}
+
+/**
+* Add the polyline to the path as a subpath in the screen coordinates.
+*/
+void RoadRenderer::addPolyline(QPainterPath& path, const std::vector<QVector2D>& polyline) {
+	if (polyline.empty()) return;
+
+	path.moveTo(worldToScreenCoordinates(polyline[0]));
+	for (int i = 1; i < polyline.size(); i++) {
+		path.lineTo(worldToScreenCoordinates(polyline[i]));
+	}
+
+	numDrawnEdges++;
+	numDrawnPoints += polyline.size();
+}
+
+/**
+* Draw the markers of the interior points of the polyline.
+*/
+void RoadRenderer::drawPointMarkers(QPainter& painter, const std::vector<QVector2D>& polyline) {
+	for (int i = 1; i < (int)polyline.size() - 1; i++) {
+		drawMarker(painter, worldToScreenCoordinates(polyline[i]), 3);
+	}
+}
+
+/**
+* Draw the marker of size x size pixels centered at the point.
+* The point is floored rather than truncated to the pixel, so that a marker across the border of the tiles is drawn consistently in both tiles.
+*/
+void RoadRenderer::drawMarker(QPainter& painter, const QPointF& pt, int size) {
+	numDrawCalls++;
+	painter.drawEllipse((int)std::floor(pt.x()) - size / 2, (int)std::floor(pt.y()) - size / 2, size, size);
+}
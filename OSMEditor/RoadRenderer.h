@@ -0,0 +1,86 @@
+#pragma once
+
+#include <vector>
+#include <unordered_map>
+#include <QPainter>
+#include <QPainterPath>
+#include "RoadGraph.h"
+
+/**
+* Draws the edges and vertices of the road graph with a painter.
+* The edges are drawn by the road class with the colors, the visibility, and the widths of RoadGraph,
+* in one QPainterPath per class from the local streets to the highways, and the edges of the hidden classes are skipped before anything else.
+* In the culling mode, only the edges and vertices in the visible rectangle are drawn using the spatial index,
+* the polylines are simplified by Douglas-Peucker for the zoom level, and the point markers are skipped if they would be too dense.
+* The markers are decided for the whole graph rather than for the view, so that the tiles of RoadTileCache agree with each other.
+* Otherwise, every valid edge and vertex is drawn at full detail.
+*/
+class RoadRenderer {
+public:
+	// maximum distance in pixels between a simplified polyline and the original one
+	static float LOD_TOLERANCE;
+	// minimum average length in pixels of the polyline segments for which the point markers are drawn
+	static float MIN_MARKER_SPACING;
+
+	// road classes in the drawing order, where the edges of the other types are drawn as local streets
+	enum { CLASS_STREET = 0, CLASS_AVENUE, CLASS_BOULEVARD, CLASS_HIGHWAY, NUM_CLASSES };
+
+	struct ClassStyle {
+		QColor color;
+		bool shown;
+		// width of the road in meters, which is drawn at least 1 pixel wide
+		float width;
+
+		bool operator==(const ClassStyle& other) const { return color == other.color && shown == other.shown && width == other.width; }
+		bool operator!=(const ClassStyle& other) const { return !(*this == other); }
+	};
+
+	bool culling;
+
+	// statistics of the last frame
+	int numDrawnEdges;
+	int numDrawnPoints;
+	int numDrawCalls;
+	bool markersDrawn;
+
+private:
+	RoadGraph* roads;
+	QPointF origin;
+	double scale;
+	int width;
+	int height;
+	ClassStyle styles[NUM_CLASSES];
+
+	// simplified polylines, which are discarded if the zoom level, the road graph, or its revision changes
+	std::unordered_map<const RoadEdge*, std::vector<QVector2D> > lodPolylines;
+	const RoadGraph* lodRoads;
+	int lodLevel;
+	unsigned int lodRevision;
+	int lodEdges;
+
+	// visible edges of the shown classes with their polylines to draw and visible vertices of the current view, and the buffer of the query results
+	std::vector<RoadEdgeDesc> visibleEdges[NUM_CLASSES];
+	std::vector<const std::vector<QVector2D>*> visiblePolylines[NUM_CLASSES];
+	std::vector<RoadVertexDesc> visibleVertices;
+	std::vector<RoadEdgeDesc> foundEdges;
+
+public:
+	RoadRenderer();
+
+	void setView(RoadGraph& roads, const QPointF& origin, double scale, int width, int height);
+	void drawEdges(QPainter& painter);
+	void drawVertices(QPainter& painter);
+	void clearCache();
+	static void getStyles(const RoadGraph& roads, ClassStyle* styles);
+	static float getMargin(const ClassStyle* styles, double scale);
+	static int getClass(int type);
+	static void simplify(const std::vector<QVector2D>& polyline, float tolerance, std::vector<QVector2D>& simplified);
+
+private:
+	const std::vector<QVector2D>& getLodPolyline(RoadEdgeDesc e, float tolerance);
+	bool hasShownEdge(RoadVertexDesc v);
+	void addPolyline(QPainterPath& path, const std::vector<QVector2D>& polyline);
+	void drawPointMarkers(QPainter& painter, const std::vector<QVector2D>& polyline);
+	void drawMarker(QPainter& painter, const QPointF& pt, int size);
+	QPointF worldToScreenCoordinates(const QVector2D& p) const { return QPointF(origin.x() + p.x() * scale, origin.y() - p.y() * scale); }
+};
@@ -0,0 +1,172 @@
+#include "RoadTileCache.h"
+#include <cmath>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+
+int RoadTileCache::TILE_SIZE = 256;
+int RoadTileCache::MAX_TILES = 256;
+
+/**
+* @param numThreads	number of the threads to draw the tiles, or 0 to use all the cores
+*/
+RoadTileCache::RoadTileCache(int numThreads) {
+	if (numThreads <= 0) numThreads = std::thread::hardware_concurrency();
+	this->numThreads = std::max(1, numThreads);
+	renderers.resize(this->numThreads);
+
+	numDrawnTiles = 0;
+	numRenderedTiles = 0;
+
+	roads = NULL;
+	frame = 0;
+	for (int c = 0; c < RoadRenderer::NUM_CLASSES; c++) {
+		styles[c].shown = false;
+		styles[c].width = 0.0f;
+	}
+}
+
+/**
+* Draw the tiles which cover the view, drawing the missing ones first.
+*
+* @param origin		screen coordinates of the world origin
+* @param scale		pixels per meter
+*/
+void RoadTileCache::draw(QPainter& painter, RoadGraph& roads, const QPointF& origin, double scale, int width, int height) {
+	// discard the tiles of the changed areas, or all the tiles if the changes are not known or the styles change
+	RoadRenderer::ClassStyle new_styles[RoadRenderer::NUM_CLASSES];
+	RoadRenderer::getStyles(roads, new_styles);
+	bool styles_changed = !std::equal(new_styles, new_styles + RoadRenderer::NUM_CLASSES, styles);
+	if (!roads.takeChangedBoxes(changedBoxes) || this->roads != &roads || styles_changed) {
+		tiles.clear();
+		this->roads = &roads;
+		std::copy(new_styles, new_styles + RoadRenderer::NUM_CLASSES, styles);
+	}
+	for (int i = 0; i < changedBoxes.size(); i++) {
+		invalidate(changedBoxes[i].first, changedBoxes[i].second);
+	}
+
+	frame++;
+	numDrawnTiles = 0;
+	numRenderedTiles = 0;
+
+	int x0 = (int)std::floor(-origin.x() / TILE_SIZE);
+	int y0 = (int)std::floor(-origin.y() / TILE_SIZE);
+	int x1 = (int)std::floor((width - origin.x()) / TILE_SIZE);
+	int y1 = (int)std::floor((height - origin.y()) / TILE_SIZE);
+
+	// add the missing tiles, and draw them all at once
+	missingTiles.clear();
+	for (int y = y0; y <= y1; y++) {
+		for (int x = x0; x <= x1; x++) {
+			std::pair<std::map<TileKey, Tile>::iterator, bool> inserted = tiles.insert(std::make_pair(TileKey(scale, x, y), Tile()));
+			if (inserted.second) missingTiles.push_back(inserted.first);
+			inserted.first->second.lastUsed = frame;
+		}
+	}
+	renderTiles(roads);
+	numRenderedTiles = missingTiles.size();
+
+	for (int y = y0; y <= y1; y++) {
+		for (int x = x0; x <= x1; x++) {
+			painter.drawImage(QPointF(origin.x() + x * TILE_SIZE, origin.y() + y * TILE_SIZE), tiles[TileKey(scale, x, y)].image);
+			numDrawnTiles++;
+		}
+	}
+
+	evict();
+}
+
+/**
+* Discard the tiles of all the scales which overlap the bounding box in the world coordinates.
+* The box is extended by the margin of RoadRenderer, within which the roads and the markers are drawn.
+*/
+void RoadTileCache::invalidate(const QVector2D& minPt, const QVector2D& maxPt) {
+	for (std::map<TileKey, Tile>::iterator it = tiles.begin(); it != tiles.end();) {
+		// the tile covers the world rectangle [x, x + 1) * TILE_SIZE / scale horizontally and (-y - 1, -y] * TILE_SIZE / scale vertically
+		double margin = RoadRenderer::getMargin(styles, it->first.scale) / it->first.scale;
+		double size = TILE_SIZE / it->first.scale;
+		double tileMinX = it->first.x * size;
+		double tileMaxY = -it->first.y * size;
+		if (maxPt.x() + margin < tileMinX || minPt.x() - margin > tileMinX + size || maxPt.y() + margin < tileMaxY - size || minPt.y() - margin > tileMaxY) {
+			++it;
+		}
+		else {
+			tiles.erase(it++);
+		}
+	}
+}
+
+/**
+* Discard all the tiles.
+*/
+void RoadTileCache::clear() {
+	tiles.clear();
+	roads = NULL;
+}
+
+/**
+* Return the memory used by the images of the tiles in bytes.
+*/
+int RoadTileCache::memoryUsage() const {
+	return tiles.size() * TILE_SIZE * TILE_SIZE * 4;
+}
+
+/**
+* Draw the missing tiles on the worker threads, which take the next tile one by one.
+* The spatial index is updated on this thread beforehand, so that the queries of the workers do not modify the graph.
+*/
+void RoadTileCache::renderTiles(RoadGraph& roads) {
+	if (missingTiles.empty()) return;
+
+	roads.averageSegmentLength();
+
+	std::atomic<int> next_tile(0);
+	auto work = [&](RoadRenderer* renderer) {
+		while (true) {
+			int i = next_tile++;
+			if (i >= missingTiles.size()) break;
+
+			renderTile(*renderer, roads, missingTiles[i]->first, missingTiles[i]->second.image);
+		}
+	};
+
+	std::vector<std::thread> threads;
+	for (int i = 1; i < numThreads && i < missingTiles.size(); i++) {
+		threads.push_back(std::thread(work, &renderers[i]));
+	}
+	work(&renderers[0]);
+
+	for (int i = 0; i < threads.size(); i++) {
+		threads[i].join();
+	}
+}
+
+/**
+* Draw the tile with the renderer, whose view is the tile.
+*/
+void RoadTileCache::renderTile(RoadRenderer& renderer, RoadGraph& roads, const TileKey& key, QImage& image) {
+	image = QImage(TILE_SIZE, TILE_SIZE, QImage::Format_RGB32);
+	image.fill(QColor(255, 255, 255));
+
+	QPainter painter(&image);
+	renderer.setView(roads, QPointF(-key.x * TILE_SIZE, -key.y * TILE_SIZE), key.scale, TILE_SIZE, TILE_SIZE);
+	renderer.drawEdges(painter);
+	renderer.drawVertices(painter);
+}
+
+/**
+* Discard the least recently used tiles which are not used by the last frame until the number of the tiles is MAX_TILES.
+*/
+void RoadTileCache::evict() {
+	while (tiles.size() > MAX_TILES) {
+		std::map<TileKey, Tile>::iterator oldest = tiles.end();
+		for (std::map<TileKey, Tile>::iterator it = tiles.begin(); it != tiles.end(); ++it) {
+			if (it->second.lastUsed == frame) continue;
+			if (oldest == tiles.end() || it->second.lastUsed < oldest->second.lastUsed) oldest = it;
+		}
+		if (oldest == tiles.end()) break;
+
+		tiles.erase(oldest);
+	}
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <map>
+#include <vector>
+#include <QImage>
+#include <QPainter>
+#include "RoadGraph.h"
+#include "RoadRenderer.h"
+
+/**
+* Images of the road graph drawn by RoadRenderer in square tiles, which are keyed by the scale and the tile coordinates.
+* The tile (x, y) covers the screen pixels [x * TILE_SIZE, (x + 1) * TILE_SIZE) relative to the screen position of the world origin,
+* so that panning only moves the tiles, and only the tiles which come into the view are drawn.
+* The tiles which overlap the bounding boxes of the changed vertices and edges are discarded before drawing,
+* and all the tiles are discarded if the styles of the road classes change.
+* The missing tiles are drawn in parallel into their own images, each thread with its own RoadRenderer.
+* The threads only read the graph, since the spatial index is brought up to date before they start,
+* and draw returns after they finish, so the graph cannot be edited while they are drawing.
+*/
+class RoadTileCache {
+public:
+	static int TILE_SIZE;
+	static int MAX_TILES;
+
+	// statistics of the last frame
+	int numDrawnTiles;
+	int numRenderedTiles;
+
+private:
+	struct TileKey {
+		double scale;
+		int x;
+		int y;
+
+		TileKey(double scale, int x, int y) : scale(scale), x(x), y(y) {}
+		bool operator<(const TileKey& other) const {
+			if (scale != other.scale) return scale < other.scale;
+			if (x != other.x) return x < other.x;
+			return y < other.y;
+		}
+	};
+
+	struct Tile {
+		QImage image;
+		unsigned int lastUsed;
+	};
+
+	int numThreads;
+	std::vector<RoadRenderer> renderers;
+	std::map<TileKey, Tile> tiles;
+	const RoadGraph* roads;
+	unsigned int frame;
+	RoadRenderer::ClassStyle styles[RoadRenderer::NUM_CLASSES];
+	std::vector<std::pair<QVector2D, QVector2D> > changedBoxes;
+	std::vector<std::map<TileKey, Tile>::iterator> missingTiles;
+
+public:
+	RoadTileCache(int numThreads = 0);
+
+	void draw(QPainter& painter, RoadGraph& roads, const QPointF& origin, double scale, int width, int height);
+	void invalidate(const QVector2D& minPt, const QVector2D& maxPt);
+	void clear();
+	int memoryUsage() const;
+
+private:
+	void renderTiles(RoadGraph& roads);
+	void renderTile(RoadRenderer& renderer, RoadGraph& roads, const TileKey& key, QImage& image);
+	void evict();
+};
@@ -0,0 +1,222 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <limits>
+#include <cmath>
+#include <unordered_map>
+#include <QVector2D>
+
+/**
+* Uniform grid of square cells, which are stored in a hash map so that only non-empty cells use memory.
+* Each item is a point or a line segment, and is registered to the cells that it passes through, which are walked
+* cell by cell along the segment so that a long diagonal segment is registered to O(length / cellSize) cells.
+*/
+template<typename T>
+class SpatialIndex {
+private:
+	float cellSize;
+	std::unordered_map<long long, std::vector<T> > cells;
+
+	// range of the cells to which items have been inserted since the last clear, which does not shrink when they are removed
+	int minCellX;
+	int minCellY;
+	int maxCellX;
+	int maxCellY;
+
+public:
+	SpatialIndex(float cellSize = 50.0f) : cellSize(cellSize) {
+		resetCellRange();
+	}
+
+	float getCellSize() const {
+		return cellSize;
+	}
+
+	/**
+	* Remove all the items, and change the cell size.
+	*/
+	void clear(float cellSize) {
+		this->cellSize = cellSize;
+		cells.clear();
+		resetCellRange();
+	}
+
+	/**
+	* Return true if the bounding box covers all the cells to which items have been inserted.
+	* Then, scanning all the items directly is faster than querying the cells.
+	*/
+	bool coversAll(const QVector2D& minPt, const QVector2D& maxPt) const {
+		int x0, y0, x1, y1;
+		cellRange(minPt, maxPt, x0, y0, x1, y1);
+		return x0 <= minCellX && y0 <= minCellY && x1 >= maxCellX && y1 >= maxCellY;
+	}
+
+	/**
+	* Register the item to the cells that the segment from p0 to p1 passes through. A point is given as p0 == p1.
+	*/
+	void insert(const T& item, const QVector2D& p0, const QVector2D& p1) {
+		forEachSegmentCell(p0, p1, [&](int x, int y) {
+			cells[key(x, y)].push_back(item);
+			return false;
+		});
+
+		int x0, y0, x1, y1;
+		cellRange(p0, p1, x0, y0, x1, y1);
+		minCellX = std::min(minCellX, std::min(x0, x1));
+		minCellY = std::min(minCellY, std::min(y0, y1));
+		maxCellX = std::max(maxCellX, std::max(x0, x1));
+		maxCellY = std::max(maxCellY, std::max(y0, y1));
+	}
+
+	/**
+	* Remove the item from the cells that the segment passes through.
+	* The segment has to be the same as the one used to insert the item.
+	*/
+	void remove(const T& item, const QVector2D& p0, const QVector2D& p1) {
+		forEachSegmentCell(p0, p1, [&](int x, int y) {
+			typename std::unordered_map<long long, std::vector<T> >::iterator it = cells.find(key(x, y));
+			if (it == cells.end()) return false;
+
+			typename std::vector<T>::iterator it2 = std::find(it->second.begin(), it->second.end(), item);
+			if (it2 == it->second.end()) return false;
+
+			// the order in a cell does not matter, so swap it with the last one
+			*it2 = it->second.back();
+			it->second.pop_back();
+			if (it->second.empty()) cells.erase(it);
+			return false;
+		});
+	}
+
+	/**
+	* Call func(item) for each item registered to the cells that the bounding box overlaps.
+	* An item that spans several cells may be visited more than once.
+	*/
+	template<typename Func>
+	void query(const QVector2D& minPt, const QVector2D& maxPt, Func func) const {
+		forEachCell(minPt, maxPt, [&](int x, int y, const std::vector<T>& items) {
+			for (int i = 0; i < items.size(); i++) {
+				func(items[i]);
+			}
+		});
+	}
+
+	/**
+	* Call func(item) exactly once for each item registered to the cells that the bounding box overlaps,
+	* where segment(item, p0, p1) returns the segment used to insert the item.
+	* An item is reported only from the first of its cells within the box, so that no duplicates have to be removed.
+	* The item itself may not overlap the box, which the caller checks if needed.
+	*/
+	template<typename SegmentFunc, typename Func>
+	void queryUnique(const QVector2D& minPt, const QVector2D& maxPt, SegmentFunc segment, Func func) const {
+		int x0, y0, x1, y1;
+		cellRange(minPt, maxPt, x0, y0, x1, y1);
+
+		forEachCell(minPt, maxPt, [&](int x, int y, const std::vector<T>& items) {
+			for (int i = 0; i < items.size(); i++) {
+				QVector2D p0, p1;
+				segment(items[i], p0, p1);
+
+				int first_x = x;
+				int first_y = y;
+				forEachSegmentCell(p0, p1, [&](int cx, int cy) {
+					if (cx < x0 || cx > x1 || cy < y0 || cy > y1) return false;
+					first_x = cx;
+					first_y = cy;
+					return true;
+				});
+				if (first_x != x || first_y != y) continue;
+
+				func(items[i]);
+			}
+		});
+	}
+
+private:
+	/**
+	* Call func(x, y, items) for each non-empty cell that the bounding box overlaps.
+	*/
+	template<typename Func>
+	void forEachCell(const QVector2D& minPt, const QVector2D& maxPt, Func func) const {
+		int x0, y0, x1, y1;
+		cellRange(minPt, maxPt, x0, y0, x1, y1);
+
+		// If the box covers more cells than the non-empty ones, scan the non-empty cells instead.
+		if ((double)(x1 - x0 + 1) * (y1 - y0 + 1) > cells.size()) {
+			for (typename std::unordered_map<long long, std::vector<T> >::const_iterator it = cells.begin(); it != cells.end(); ++it) {
+				int x = (int)(it->first >> 32);
+				int y = (int)(it->first & 0xffffffff);
+				if (x < x0 || x > x1 || y < y0 || y > y1) continue;
+
+				func(x, y, it->second);
+			}
+			return;
+		}
+
+		for (int y = y0; y <= y1; y++) {
+			for (int x = x0; x <= x1; x++) {
+				typename std::unordered_map<long long, std::vector<T> >::const_iterator it = cells.find(key(x, y));
+				if (it == cells.end()) continue;
+
+				func(x, y, it->second);
+			}
+		}
+	}
+
+	/**
+	* Call func(x, y) for each cell that the segment from p0 to p1 passes through, in the order from p0, until func returns true.
+	* The cells are walked by crossing one cell boundary at a time, so a segment through a corner also visits one of the cells next to it.
+	*/
+	template<typename Func>
+	void forEachSegmentCell(const QVector2D& p0, const QVector2D& p1, Func func) const {
+		int x, y, x1, y1;
+		cellRange(p0, p1, x, y, x1, y1);
+
+		int step_x = x1 > x ? 1 : -1;
+		int step_y = y1 > y ? 1 : -1;
+		double dx = p1.x() - p0.x();
+		double dy = p1.y() - p0.y();
+
+		// parameters along the segment at which the next vertical and horizontal cell boundaries are crossed
+		double t_max_x = dx > 0 ? ((x + 1) * (double)cellSize - p0.x()) / dx : (dx < 0 ? (x * (double)cellSize - p0.x()) / dx : std::numeric_limits<double>::max());
+		double t_max_y = dy > 0 ? ((y + 1) * (double)cellSize - p0.y()) / dy : (dy < 0 ? (y * (double)cellSize - p0.y()) / dy : std::numeric_limits<double>::max());
+		double t_delta_x = dx != 0 ? cellSize / std::abs(dx) : 0.0;
+		double t_delta_y = dy != 0 ? cellSize / std::abs(dy) : 0.0;
+
+		if (func(x, y)) return;
+
+		// The number of steps is fixed so that the walk ends at the cell of p1 even with rounding errors.
+		int num_steps = std::abs(x1 - x) + std::abs(y1 - y);
+		for (int i = 0; i < num_steps; i++) {
+			if (y == y1 || (x != x1 && t_max_x < t_max_y)) {
+				x += step_x;
+				t_max_x += t_delta_x;
+			}
+			else {
+				y += step_y;
+				t_max_y += t_delta_y;
+			}
+
+			if (func(x, y)) return;
+		}
+	}
+
+	void resetCellRange() {
+		minCellX = std::numeric_limits<int>::max();
+		minCellY = std::numeric_limits<int>::max();
+		maxCellX = std::numeric_limits<int>::min();
+		maxCellY = std::numeric_limits<int>::min();
+	}
+
+	void cellRange(const QVector2D& minPt, const QVector2D& maxPt, int& x0, int& y0, int& x1, int& y1) const {
+		x0 = (int)std::floor(minPt.x() / cellSize);
+		y0 = (int)std::floor(minPt.y() / cellSize);
+		x1 = (int)std::floor(maxPt.x() / cellSize);
+		y1 = (int)std::floor(maxPt.y() / cellSize);
+	}
+
+	static long long key(int x, int y) {
+		return (long long)(((unsigned long long)(unsigned int)x << 32) | (unsigned int)y);
+	}
+};
@@ -0,0 +1,377 @@
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <map>
+#include <QStringList>
+#include <QElapsedTimer>
+#include <QFileInfo>
+#include <QDir>
+#include "RoadGraph.h"
+#include "OSMRoadsExporter.h"
+#include "RoadGraphSnapshot.h"
+#include "RoadGraphGenerator.h"
+#include "RoadGraphLoader.h"
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+/**
+* Stages of the pipeline and where the cleaned files are written.
+*/
+struct PipelineOptions {
+	// bit mask of RoadEdge::TYPE_XXX to keep, or 0 to keep all the edges
+	int types;
+	bool reduce;
+	bool planarify;
+	bool compact;
+	bool snapshot;
+	// directory of the output files, or empty for the directory of each input file
+	QString outputDir;
+
+	PipelineOptions() : types(0), reduce(true), planarify(true), compact(true), snapshot(false) {}
+};
+
+/**
+* Return the peak resident set size of the process in bytes.
+*/
+size_t peakMemoryUsage() {
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) return 0;
+	return counters.PeakWorkingSetSize;
+#else
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+#ifdef __APPLE__
+	return usage.ru_maxrss;
+#else
+	return (size_t)usage.ru_maxrss * 1024;
+#endif
+#endif
+}
+
+/**
+* Return the bit mask of RoadEdge::TYPE_XXX of the comma separated road classes, or -1 if a class is unknown.
+*/
+int parseTypes(const QString& classes) {
+	int types = 0;
+	QStringList list = classes.split(",", QString::SkipEmptyParts);
+	for (int i = 0; i < list.size(); i++) {
+		QString name = list[i].trimmed().toLower();
+		if (name == "highway") {
+			types |= RoadEdge::TYPE_HIGHWAY;
+		}
+		else if (name == "boulevard") {
+			types |= RoadEdge::TYPE_BOULEVARD;
+		}
+		else if (name == "avenue") {
+			types |= RoadEdge::TYPE_AVENUE;
+		}
+		else if (name == "street") {
+			types |= RoadEdge::TYPE_STREET;
+		}
+		else {
+			return -1;
+		}
+	}
+
+	return types;
+}
+
+/**
+* Return the name of the cleaned file, which is <name>_clean.osm (or .rgs) in the output directory.
+*/
+QString outputFilename(const QString& filename, const PipelineOptions& options) {
+	QFileInfo info(filename);
+	QString name = info.fileName();
+	if (name.endsWith(".pbf", Qt::CaseInsensitive)) name.chop(4);
+	if (name.endsWith(".osm", Qt::CaseInsensitive) || name.endsWith(".rgs", Qt::CaseInsensitive)) name.chop(4);
+
+	QDir dir = options.outputDir.isEmpty() ? info.dir() : QDir(options.outputDir);
+	return dir.filePath(name + (options.snapshot ? "_clean.rgs" : "_clean.osm"));
+}
+
+/**
+* Report the input files which would be saved to the same output file, such as the files of the same name
+* in different directories with -o, or name.osm and name.osm.pbf. Their jobs would overwrite each other's output.
+* The paths are compared case-insensitively, since they are the same file on Windows.
+*
+* @return			false if any two files have the same output file
+*/
+bool checkOutputFilenames(const QStringList& filenames, const PipelineOptions& options) {
+	std::map<QString, int> outputs;
+	bool ok = true;
+	for (int i = 0; i < filenames.size(); i++) {
+		QString output = QFileInfo(outputFilename(filenames[i], options)).absoluteFilePath().toLower();
+		std::map<QString, int>::iterator it = outputs.find(output);
+		if (it != outputs.end()) {
+			std::cerr << filenames[it->second].toStdString() << " and " << filenames[i].toStdString() << " would both be saved as " << outputFilename(filenames[i], options).toStdString() << std::endl;
+			ok = false;
+		}
+		else {
+			outputs[output] = i;
+		}
+	}
+
+	return ok;
+}
+
+/**
+* Run the pipeline (load, filter, reduce, planarify, compact, save) on the file, and write the time of each stage to the report.
+*
+* @param numThreads	number of the threads of the parser
+* @return			false if the file cannot be read or written
+*/
+bool processFile(const QString& filename, const PipelineOptions& options, int numThreads, std::ostream& report) {
+	RoadGraph roads;
+	QElapsedTimer total_timer;
+	total_timer.start();
+	QElapsedTimer timer;
+
+	report << std::fixed << std::setprecision(1) << filename.toStdString() << ":";
+
+	timer.start();
+	if (!RoadGraphLoader::load(filename, roads, NULL, numThreads)) {
+		report << " cannot be read";
+		return false;
+	}
+	int num_vertices, num_edges;
+	roads.countValid(num_vertices, num_edges);
+	report << " load " << timer.nsecsElapsed() * 1e-6 << " ms (" << num_vertices << " vertices, " << num_edges << " edges)";
+
+	if (options.types != 0) {
+		timer.start();
+		int num_deleted = roads.deleteEdgesExcept(options.types);
+		report << ", filter " << timer.nsecsElapsed() * 1e-6 << " ms (" << num_deleted << " edges deleted)";
+	}
+
+	if (options.reduce) {
+		timer.start();
+		roads.reduce();
+		report << ", reduce " << timer.nsecsElapsed() * 1e-6 << " ms";
+	}
+
+	if (options.planarify) {
+		timer.start();
+		int num_intersections = roads.planarify();
+		report << ", planarify " << timer.nsecsElapsed() * 1e-6 << " ms (" << num_intersections << " intersections)";
+	}
+
+	if (options.compact) {
+		timer.start();
+		RoadGraphMapping mapping;
+		roads.compact(mapping);
+		report << ", compact " << timer.nsecsElapsed() * 1e-6 << " ms";
+	}
+
+	QString output = outputFilename(filename, options);
+	timer.start();
+	try {
+		if (options.snapshot) {
+			RoadGraphSnapshot::save(output, roads);
+		}
+		else {
+			OSMRoadsExporter::save(output, roads);
+		}
+	}
+	catch (const char*) {
+		report << ", " << output.toStdString() << " cannot be written";
+		return false;
+	}
+	roads.countValid(num_vertices, num_edges);
+	report << ", save " << timer.nsecsElapsed() * 1e-6 << " ms (" << num_vertices << " vertices, " << num_edges << " edges)";
+
+	report << ", total " << total_timer.nsecsElapsed() * 1e-6 << " ms, peak RSS " << peakMemoryUsage() / 1024 / 1024 << " MB";
+	return true;
+}
+
+/**
+* Generate the synthetic road network and save it as <layout>_<edges>_<seed>.osm (or .rgs) in the output directory.
+*
+* @return			false if the file cannot be written
+*/
+bool generateFile(RoadGraphGenerator& generator, const PipelineOptions& options) {
+	QElapsedTimer timer;
+	timer.start();
+	RoadGraph roads;
+	generator.generate(roads);
+	double elapsed_generate = timer.nsecsElapsed() * 1e-6;
+
+	std::ostringstream name;
+	name << RoadGraphGenerator::layoutName(generator.layout) << "_" << generator.numEdges << "_" << generator.seed << (options.snapshot ? ".rgs" : ".osm");
+	QString output = QDir(options.outputDir.isEmpty() ? "." : options.outputDir).filePath(name.str().c_str());
+
+	timer.start();
+	try {
+		if (options.snapshot) {
+			RoadGraphSnapshot::save(output, roads);
+		}
+		else {
+			OSMRoadsExporter::save(output, roads);
+		}
+	}
+	catch (const char*) {
+		std::cerr << output.toStdString() << " cannot be written" << std::endl;
+		return false;
+	}
+
+	int num_vertices, num_edges;
+	roads.countValid(num_vertices, num_edges);
+	std::cout << std::fixed << std::setprecision(1) << output.toStdString() << ": generate " << elapsed_generate << " ms (" << num_vertices << " vertices, " << num_edges << " edges), save " << timer.nsecsElapsed() * 1e-6 << " ms" << std::endl;
+	return true;
+}
+
+/**
+* Usage: osmroads-cli [-o dir] [--classes highway,boulevard,avenue,street] [--no-reduce] [--no-planarify] [--no-compact] [--rgs] [-j jobs] [--trace file.json] file.osm|file.osm.pbf|file.rgs ...
+* Each file is loaded, filtered to the road classes, reduced, planarified, compacted, and saved as <name>_clean.osm (or .rgs with --rgs)
+* in the output directory, which is the directory of the input file by default.
+* The files are processed by the specified number of threads at once (default: the number of cores), and the cores are shared by their parsers.
+* The time of each stage is reported for each file with the peak resident set size of the process so far,
+* which is per file only with -j 1, followed by the total time.
+* With --trace, the timed stages of all the files are saved as a Chrome trace (chrome://tracing) when they are done.
+* The exit code is 1 if any file cannot be read or written, and 2 if the arguments are invalid, including when two files would be saved as the same output file.
+*
+* Usage: osmroads-cli --generate grid|radial|random [--edges n] [--seed n] [--points n] [--crossings d] [--rgs] [-o dir]
+* A synthetic road network of about n edges (default: 100000) is generated by RoadGraphGenerator from the seed (default: 1)
+* and saved as <layout>_<edges>_<seed>.osm (or .rgs with --rgs) in the output directory, which is the current directory by default.
+* Each polyline has the specified number of interior points (default: 1), and the random layout has about d crossings per edge (default: 0.1).
+*/
+int main(int argc, char *argv[]) {
+	PipelineOptions options;
+	QStringList filenames;
+	int num_jobs = std::max(1, (int)std::thread::hardware_concurrency());
+	RoadGraphGenerator generator(-1, 100000);
+	QString trace_filename;
+
+	for (int i = 1; i < argc; i++) {
+		QString arg = argv[i];
+		if (arg == "-o" && i + 1 < argc) {
+			options.outputDir = argv[++i];
+		}
+		else if (arg == "--classes" && i + 1 < argc) {
+			options.types = parseTypes(argv[++i]);
+			if (options.types <= 0) {
+				std::cerr << "unknown road class in " << argv[i] << " (highway, boulevard, avenue, or street)" << std::endl;
+				return 2;
+			}
+		}
+		else if (arg == "--no-reduce") {
+			options.reduce = false;
+		}
+		else if (arg == "--no-planarify") {
+			options.planarify = false;
+		}
+		else if (arg == "--no-compact") {
+			options.compact = false;
+		}
+		else if (arg == "--rgs") {
+			options.snapshot = true;
+		}
+		else if (arg == "-j" && i + 1 < argc) {
+			num_jobs = std::max(1, atoi(argv[++i]));
+		}
+		else if (arg == "--trace" && i + 1 < argc) {
+			trace_filename = argv[++i];
+		}
+		else if (arg == "--generate" && i + 1 < argc) {
+			generator.layout = RoadGraphGenerator::parseLayout(argv[++i]);
+			if (generator.layout < 0) {
+				std::cerr << "unknown layout " << argv[i] << " (grid, radial, or random)" << std::endl;
+				return 2;
+			}
+		}
+		else if (arg == "--edges" && i + 1 < argc) {
+			generator.numEdges = std::max(1, atoi(argv[++i]));
+		}
+		else if (arg == "--seed" && i + 1 < argc) {
+			generator.seed = (unsigned int)strtoul(argv[++i], NULL, 10);
+		}
+		else if (arg == "--points" && i + 1 < argc) {
+			generator.numInteriorPoints = std::max(0, atoi(argv[++i]));
+		}
+		else if (arg == "--crossings" && i + 1 < argc) {
+			generator.crossingDensity = std::max(0.0, atof(argv[++i]));
+		}
+		else if (arg.startsWith("-")) {
+			std::cerr << "unknown option " << argv[i] << std::endl;
+			return 2;
+		}
+		else {
+			filenames.push_back(arg);
+		}
+	}
+
+	if (filenames.empty() && generator.layout < 0) {
+		std::cerr << "usage: osmroads-cli [-o dir] [--classes highway,boulevard,avenue,street] [--no-reduce] [--no-planarify] [--no-compact] [--rgs] [-j jobs] [--trace file.json] file.osm|file.osm.pbf|file.rgs ..." << std::endl;
+		std::cerr << "       osmroads-cli --generate grid|radial|random [--edges n] [--seed n] [--points n] [--crossings d] [--rgs] [-o dir]" << std::endl;
+		return 2;
+	}
+	if (!options.outputDir.isEmpty() && !QDir().mkpath(options.outputDir)) {
+		std::cerr << "cannot create " << options.outputDir.toStdString() << std::endl;
+		return 2;
+	}
+
+	if (generator.layout >= 0) {
+		return generateFile(generator, options) ? 0 : 1;
+	}
+	if (!checkOutputFilenames(filenames, options)) {
+		return 2;
+	}
+
+	num_jobs = std::min(num_jobs, (int)filenames.size());
+	int num_parser_threads = std::max(1, (int)std::thread::hardware_concurrency() / num_jobs);
+
+	if (!trace_filename.isEmpty()) Instrumentation::setEnabled(true);
+
+	QElapsedTimer timer;
+	timer.start();
+
+	// each worker takes the next file, and the report of each file is printed when it is done
+	std::atomic<int> next_file(0);
+	std::atomic<int> num_failed(0);
+	std::mutex report_mutex;
+	auto work = [&]() {
+		while (true) {
+			int i = next_file++;
+			if (i >= filenames.size()) break;
+
+			std::ostringstream report;
+			if (!processFile(filenames[i], options, num_parser_threads, report)) num_failed++;
+
+			std::lock_guard<std::mutex> lock(report_mutex);
+			std::cout << report.str() << std::endl;
+		}
+	};
+
+	std::vector<std::thread> threads;
+	for (int i = 0; i < num_jobs - 1; i++) {
+		threads.push_back(std::thread(work));
+	}
+	work();
+
+	for (int i = 0; i < threads.size(); i++) {
+		threads[i].join();
+	}
+
+	std::cout << filenames.size() << " files (" << num_failed << " failed) in " << timer.nsecsElapsed() * 1e-6 << " ms with " << num_jobs << " jobs, peak RSS " << peakMemoryUsage() / 1024 / 1024 << " MB" << std::endl;
+
+	if (!trace_filename.isEmpty()) {
+		if (!Instrumentation::saveTrace(trace_filename)) {
+			std::cerr << "cannot write " << trace_filename.toStdString() << std::endl;
+			num_failed++;
+		}
+		else {
+			std::cout << Instrumentation::numEvents() << " events traced to " << trace_filename.toStdString() << std::endl;
+		}
+	}
+
+	return num_failed > 0 ? 1 : 0;
+}